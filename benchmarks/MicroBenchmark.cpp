@@ -0,0 +1,426 @@
+/**
+ * @file MicroBenchmark.cpp
+ * @brief Microbenchmarks of the kernels used by the compressors.
+ *
+ * Every kernel is run in isolation on deterministic data. Each benchmark is
+ * repeated several times and the median is reported, as JSON on the standard
+ * output, so that runs can be compared to each other.
+ *
+ * The kernels with several implementations (see CpuDispatch) are measured at
+ * every level the processor supports; the rest use the level selected at
+ * startup, which can be lowered with SCOMPRESSOR_CPU.
+ *
+ * Usage: microbench [-r repetitions] [filter]
+ */
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <BitStreamWriter.hpp>
+#include <BitStreamReader.hpp>
+#include <BitBufferWriter.hpp>
+#include <BitBufferReader.hpp>
+#include <BitWriter.hpp>
+#include <BitReader.hpp>
+#include <NullSource.hpp>
+#include <HuffmanTree.hpp>
+#include <ByteChunk.hpp>
+#include <LZ77Compressor.hpp>
+#include <LZWCompressor.hpp>
+#include <CpuDispatch.hpp>
+#include <Filter.hpp>
+#include <Checksum.hpp>
+
+using namespace std;
+
+/**
+ * @class DiscardBuffer
+ * @brief Stream buffer that discards everything written to it.
+ */
+class DiscardBuffer : public std::streambuf {
+private:
+  char buffer[65536];
+protected:
+  int_type overflow(int_type c)
+  {
+    setp(buffer, buffer+sizeof(buffer));
+    return traits_type::not_eof(c);
+  }
+public:
+  DiscardBuffer() { setp(buffer, buffer+sizeof(buffer)); }
+};
+
+/**
+ * @class MemoryBuffer
+ * @brief Stream buffer that reads from memory, without copying it.
+ */
+class MemoryBuffer : public std::streambuf {
+public:
+  MemoryBuffer(const char * data, size_t n)
+  { char * p = const_cast<char *>(data); setg(p, p, p+n); }
+};
+
+/**
+ * @class Result
+ * @brief Result of a benchmark.
+ */
+struct Result {
+  /** Name of the benchmark. */
+  string name;
+  /** Operations per run. */
+  size_t ops;
+  /** Bytes processed per run (0 if it does not apply). */
+  size_t bytes;
+  /** Median time of a run, in seconds. */
+  double seconds;
+};
+
+/** Value written by the kernels, so that the compiler can not remove them. */
+static volatile size_t sink;
+
+/**
+ * @brief Generates deterministic text-like data.
+ * @param n size of the data, in bytes.
+ * @param seed seed of the generator.
+ * @return data.
+ */
+static string generateData(size_t n, uint32_t seed)
+{
+  static const char * words[] = {
+    "the ", "compressor ", "data ", "of ", "a ", "stream ", "bit ", "and ",
+    "dictionary ", "window ", "huffman ", "to ", "symbol ", "in ", "block ", "\n"
+  };
+  string s;
+  s.reserve(n+16);
+  uint32_t x = seed;
+  while ( s.size() < n ) {
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    if ( (x & 0x1F) == 0 ) s += (char)(x >> 24);
+    else s += words[(x >> 8) & 0x0F];
+  }
+  s.resize(n);
+  return s;
+}
+
+/**
+ * @struct KernelBenchmark
+ * @brief Benchmarks that need to reach the internals of the compressors.
+ */
+struct KernelBenchmark {
+  /**
+   * @brief Runs LZ77Compressor::find_prefix() on consecutive windows of data.
+   * @param fixed whether the widths are compile-time constants (as in the
+   * specialized loops) or read from the compressor (as in the generic one).
+   * @return number of searches.
+   */
+  static size_t findPrefix(LZ77Compressor& lz, const string& data, uint8_t sb, uint8_t lb,
+			   bool fixed)
+  {
+    if ( !lz.init(sb, lb) ) return 0;
+    if ( !fixed ) return findPrefix(lz, data, LZ77Compressor::RuntimeWidths(lz));
+    if ( sb == 9 && lb == 5 ) return findPrefix(lz, data, LZ77Compressor::FixedWidths<9, 5>(lz));
+    if ( sb == 12 && lb == 8 ) return findPrefix(lz, data, LZ77Compressor::FixedWidths<12, 8>(lz));
+    return 0;
+  }
+
+  template <typename Widths>
+  static size_t findPrefix(LZ77Compressor& lz, const string& data, const Widths& w)
+  {
+    size_t searches = 0, total = 0;
+    for(size_t off = 0; off+lz.WINDOW_SIZE <= data.size(); off += lz.LAHEAD_SIZE) {
+      memcpy(lz.window, data.data()+off, lz.WINDOW_SIZE);
+      lz.search_start = 0;
+      lz.lahead_start = lz.SEARCH_SIZE;
+      lz.lahead_end = lz.WINDOW_SIZE-1;
+      size_t max_l = 0, max_p = 0;
+      lz.find_prefix(w, max_l, max_p);
+      total += max_l;
+      ++searches;
+    }
+    lz.releaseMemory();
+    sink = total;
+    return searches;
+  }
+
+  /**
+   * @brief Runs the lookups and inserts of the compression dictionary of
+   * LZWCompressor (with its allocator and memory account) as its block loop
+   * does. The dictionary is reset with init_comp(), which erases the entries
+   * of the previous call, so the compressor must be reused between runs.
+   * @return number of lookups and inserts.
+   */
+  static size_t findInsert(LZWCompressor& lzw, const string& data, uint8_t db, uint8_t bb)
+  {
+    MemoryAccount::Scope scope(lzw.memory);
+    if ( !lzw.init_comp(db, bb) ) return 0;
+    LZWCompressor::CompDictionary& dictionary = lzw.com_dictionary;
+    ByteChunk chunk(lzw.BLOCK_SIZE);
+    size_t ops = 0;
+    for(size_t off = 0; off < data.size(); off += lzw.BLOCK_SIZE) {
+      const size_t end = min(off+lzw.BLOCK_SIZE, data.size());
+      chunk.resize(0);
+      for(size_t i = off; i < end; ++i) {
+	chunk.push_back(data[i]);
+	++ops;
+	if ( dictionary.find(chunk) != dictionary.end() ) continue;
+	if ( dictionary.size() < lzw.DICTIONARY_MAXSIZE ) {
+	  dictionary.insert(make_pair(chunk, dictionary.size()));
+	  ++ops;
+	}
+	chunk.resize(0);
+	chunk.push_back(data[i]);
+      }
+    }
+    sink = dictionary.size();
+    return ops;
+  }
+};
+
+/**
+ * @brief Runs a benchmark.
+ * @param name name of the benchmark.
+ * @param repetitions number of timed runs.
+ * @param bytes bytes processed per run.
+ * @param run function that runs the kernel once and returns the number of operations.
+ * @return result.
+ */
+template <typename Run>
+static Result measure(const string& name, int repetitions, size_t bytes, Run run)
+{
+  Result r = { name, run(), bytes, 0.0 }; /* warm-up */
+  vector<double> times;
+  for(int i = 0; i < repetitions; ++i) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    r.ops = run();
+    times.push_back(chrono::duration<double>(chrono::steady_clock::now()-start).count());
+  }
+  sort(times.begin(), times.end());
+  r.seconds = times[times.size()/2];
+  return r;
+}
+
+int main(int argc, char ** argv)
+{
+  int repetitions = 7, c;
+  while ( (c = getopt(argc, argv, "r:")) != -1 ) {
+    if ( c == 'r' && atoi(optarg) > 0 ) repetitions = atoi(optarg);
+    else {
+      cerr << "Usage: " << argv[0] << " [-r repetitions] [filter]" << endl;
+      return 1;
+    }
+  }
+  string filter = (optind < argc ? argv[optind] : "");
+
+  const size_t N = (1 << 20);
+  const string data = generateData(N, 2011);
+  vector<Result> results;
+#define BENCHMARK(name, bytes, ...)					\
+  if ( string(name).find(filter) != string::npos )			\
+    results.push_back(measure(name, repetitions, bytes, [&]() -> size_t __VA_ARGS__));
+
+  /* Bit writers and readers, at several field widths. */
+  static const int widths[] = { 1, 5, 8, 13, 24 };
+  for(size_t w = 0; w < sizeof(widths)/sizeof(widths[0]); ++w) {
+    const int bits = widths[w];
+    const size_t fields = N*8/bits;
+    const string wname = "/w" + to_string(bits);
+
+    BENCHMARK("BitStreamWriter::put" + wname, N, {
+	DiscardBuffer db; ostream os(&db);
+	BitStreamWriter bos(os);
+	for(size_t i = 0; i < fields; ++i) bos.put(i, bits);
+	bos.flush();
+	return fields;
+      });
+    BENCHMARK("BitStreamReader::get" + wname, N, {
+	MemoryBuffer mb(data.data(), N); istream is(&mb);
+	BitStreamReader bis(is);
+	size_t x = 0;
+	for(size_t i = 0; i < fields; ++i) x += bis.get(bits);
+	sink = x;
+	return fields;
+      });
+    BENCHMARK("BitWriter<StreamSink>::put" + wname, N, {
+	DiscardBuffer db; ostream os(&db);
+	BitWriter<StreamSink> bos(os);
+	for(size_t i = 0; i < fields; ++i) bos.put(i, bits);
+	bos.flush();
+	return fields;
+      });
+    BENCHMARK("BitReader<StreamSource>::get" + wname, N, {
+	MemoryBuffer mb(data.data(), N); istream is(&mb);
+	BitReader<StreamSource> bis(is);
+	size_t x = 0;
+	for(size_t i = 0; i < fields; ++i) x += bis.get(bits);
+	sink = x;
+	return fields;
+      });
+    BENCHMARK("BitBufferWriter::put" + wname, N, {
+	static vector<char> out(N+16);
+	BitBufferWriter bos(&out[0], out.size());
+	for(size_t i = 0; i < fields; ++i) bos.put(i, bits);
+	bos.flush();
+	return fields;
+      });
+    BENCHMARK("BitBufferReader::get" + wname, N, {
+	BitBufferReader bis(data.data(), N);
+	size_t x = 0;
+	for(size_t i = 0; i < fields; ++i) x += bis.get(bits);
+	sink = x;
+	return fields;
+      });
+  }
+
+  /* Histogram of the null source. */
+  BENCHMARK("NullSource::LoadFromBuffer", N, {
+      NullSource ns;
+      ns.LoadFromBuffer(data.data(), N);
+      sink = ns.size();
+      return N;
+    });
+
+  /* Huffman tree of a 256 symbols source. */
+  NullSource source;
+  source.LoadFromBuffer(data.data(), N);
+  for(int i = 0; i < 256; ++i) source[(char)i]++;
+  BENCHMARK("HuffmanTree::buildTree", 0, {
+      const size_t trees = 1000;
+      for(size_t i = 0; i < trees; ++i) {
+	HuffmanTree tree;
+	tree.buildTree(source);
+      }
+      return trees;
+    });
+
+  /* Longest match search of LZ77. */
+  static const int search[][2] = { { 9, 5 }, { 12, 8 } };
+  for(size_t i = 0; i < sizeof(search)/sizeof(search[0]); ++i) {
+    const int sb = search[i][0], lb = search[i][1];
+    const string pname = "LZ77Compressor::find_prefix/s" + to_string(sb) + "l" + to_string(lb);
+    BENCHMARK(pname, N, {
+	LZ77Compressor lz;
+	return KernelBenchmark::findPrefix(lz, data, sb, lb, false);
+      });
+    BENCHMARK(pname + "/fixed", N, {
+	LZ77Compressor lz;
+	return KernelBenchmark::findPrefix(lz, data, sb, lb, true);
+      });
+  }
+
+  /* Kernels with an implementation per instruction set level. The matches
+     are 64 bytes long, as found by LZ77 with 8 bits of look-ahead buffer. */
+  const CpuDispatch::Level selected = CpuDispatch::level();
+  string mismatched = data;
+  for(size_t i = 63; i < N; i += 64) mismatched[i] ^= 0x01;
+  for(int l = 0; l <= selected; ++l) {
+    const CpuDispatch::Level level = (CpuDispatch::Level)l;
+    const CpuDispatch::Kernels k = CpuDispatch::kernelsOf(level);
+    const string lname = string("/") + CpuDispatch::name(level);
+
+    BENCHMARK("CpuDispatch::matchLength" + lname, N, {
+	size_t x = 0, matches = 0;
+	for(size_t i = 0; i < N; i += x+1, ++matches)
+	  x = k.matchLength(data.data()+i, mismatched.data()+i, N-i);
+	sink = matches;
+	return matches;
+      });
+    BENCHMARK("CpuDispatch::copyMatch" + lname, N, {
+	static vector<char> out(N);
+	for(size_t i = 0; i < N; i += 64) k.copyMatch(&out[i], data.data()+i, 64);
+	sink = out[N-1];
+	return N/64;
+      });
+    BENCHMARK("CRC32C::compute" + lname, N, {
+	CpuDispatch::force(level);
+	sink = CRC32C::compute(data.data(), N);
+	CpuDispatch::force(selected);
+	return 1;
+      });
+
+    /* Filters, at the strides and element sizes of 32 and 64-bit numbers. */
+    static const size_t filter_params[] = { 1, 4, 8 };
+    for(size_t f = 0; f < sizeof(filter_params)/sizeof(filter_params[0]); ++f) {
+      const size_t fp = filter_params[f];
+      static vector<char> filtered(N);
+      BENCHMARK("Filter::deltaEncode/s" + to_string(fp) + lname, N, {
+	  CpuDispatch::force(level);
+	  Filter::deltaEncode(data.data(), &filtered[0], N, fp);
+	  CpuDispatch::force(selected);
+	  sink = filtered[N-1];
+	  return 1;
+	});
+      BENCHMARK("Filter::deltaDecode/s" + to_string(fp) + lname, N, {
+	  Filter::deltaDecode(&filtered[0], N, fp);
+	  sink = filtered[N-1];
+	  return 1;
+	});
+      if ( fp == 1 ) continue;
+      BENCHMARK("Filter::shuffle/e" + to_string(fp) + lname, N, {
+	  CpuDispatch::force(level);
+	  Filter::shuffle(data.data(), &filtered[0], N, fp);
+	  CpuDispatch::force(selected);
+	  sink = filtered[N-1];
+	  return 1;
+	});
+      BENCHMARK("Filter::unshuffle/e" + to_string(fp) + lname, N, {
+	  CpuDispatch::force(level);
+	  Filter::unshuffle(data.data(), &filtered[0], N, fp);
+	  CpuDispatch::force(selected);
+	  sink = filtered[N-1];
+	  return 1;
+	});
+    }
+  }
+
+  /* Hash of the chunks of the LZ78/LZW dictionaries. */
+  static const size_t lengths[] = { 4, 16, 64 };
+  for(size_t l = 0; l < sizeof(lengths)/sizeof(lengths[0]); ++l) {
+    const size_t len = lengths[l];
+    vector<ByteChunk> chunks;
+    for(size_t off = 0; off+len <= 65536; off += len) chunks.push_back(ByteChunk(data.data()+off, len));
+    BENCHMARK("ByteChunkHash/len" + to_string(len), chunks.size()*len, {
+	ByteChunkHash h;
+	size_t x = 0;
+	for(size_t i = 0; i < chunks.size(); ++i) x += h(chunks[i]);
+	sink = x;
+	return chunks.size();
+      });
+  }
+
+  /* Lookups and inserts of the compression dictionary of LZW, including
+     the reset between calls. */
+  static const int dictionary_bits[] = { 12, 16 };
+  for(size_t d = 0; d < sizeof(dictionary_bits)/sizeof(dictionary_bits[0]); ++d) {
+    const int db = dictionary_bits[d];
+    LZWCompressor lzw;
+    BENCHMARK("Dictionary::find_insert/db" + to_string(db), N, {
+	return KernelBenchmark::findInsert(lzw, data, db, 6);
+      });
+  }
+#undef BENCHMARK
+
+  cout << "{" << endl
+       << "  \"repetitions\": " << repetitions << "," << endl
+       << "  \"cpu\": \"" << CpuDispatch::name(CpuDispatch::level()) << "\"," << endl
+       << "  \"benchmarks\": [" << endl;
+  for(size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    cout << "    { \"name\": \"" << r.name << "\", "
+	 << "\"ops\": " << r.ops << ", "
+	 << "\"bytes\": " << r.bytes << ", " << fixed << setprecision(3)
+	 << "\"ns_per_op\": " << r.seconds*1e9/max(r.ops, (size_t)1) << ", "
+	 << "\"mb_per_s\": " << (r.bytes > 0 ? r.bytes/1e6/r.seconds : 0.0) << " }"
+	 << (i+1 < results.size() ? "," : "") << endl;
+  }
+  cout << "  ]" << endl << "}" << endl;
+  return 0;
+}
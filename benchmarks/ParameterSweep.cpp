@@ -0,0 +1,157 @@
+/**
+ * @file ParameterSweep.cpp
+ * @brief Runs the compressors over their parameter grids and reports the
+ * Pareto-optimal settings.
+ *
+ * Every valid combination of parameters of each algorithm is run on the input
+ * with the Benchmark class:
+ * - LZ77: search bits from 2 to the limit given with -w (default 14), and
+ *   look-ahead bits from 1 to search bits - 1.
+ * - LZ78: dictionary bits from 4 to 20, and block bits from 4 to 20.
+ * - LZW: dictionary bits from 8 to 20, and block bits from 4 to 20.
+ * - Huffman has no parameters.
+ *
+ * A setting is Pareto-optimal when no other setting is at least as good in
+ * ratio, compression speed and memory, and better in one of them.
+ *
+ * Usage: sweep [-a algorithm] [-n iterations] [-l max_bytes] [-w max_search_bits]
+ *              [-o all.csv] input
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+
+#include <Benchmark.hpp>
+
+using namespace std;
+
+/**
+ * @class Point
+ * @brief Measures of a setting.
+ */
+struct Point {
+  Benchmark::Level level;
+  Benchmark::Result result;
+  double ratio;
+
+  /** Whether this point is at least as good as p in every measure and better in one. */
+  bool dominates(const Point& p) const
+  {
+    bool ge = ratio >= p.ratio && result.compress_speed >= p.result.compress_speed &&
+      result.peak_memory <= p.result.peak_memory;
+    bool gt = ratio > p.ratio || result.compress_speed > p.result.compress_speed ||
+      result.peak_memory < p.result.peak_memory;
+    return ge && gt;
+  }
+
+  /** Orders the points by ratio. */
+  bool operator < (const Point& p) const
+  { return ratio > p.ratio; }
+};
+
+/** Writes a point as a CSV row. */
+static void writePoint(ostream& os, const Point& p)
+{
+  os << p.level.algorithm << "," << (int)p.level.param1 << "," << (int)p.level.param2 << ","
+     << fixed << setprecision(4) << p.ratio << "," << setprecision(2)
+     << p.result.compress_speed << "," << p.result.decompress_speed << ","
+     << p.result.peak_memory << endl;
+}
+
+int main(int argc, char ** argv)
+{
+  string algorithm, output;
+  unsigned iterations = 1;
+  size_t max_bytes = 0;
+  int max_search_bits = 14, c;
+  while ( (c = getopt(argc, argv, "a:n:l:w:o:")) != -1 ) {
+    switch ( c ) {
+    case 'a': algorithm = optarg; break;
+    case 'n': iterations = atoi(optarg); break;
+    case 'l': max_bytes = atol(optarg); break;
+    case 'w': max_search_bits = min(atoi(optarg), 29); break;
+    case 'o': output = optarg; break;
+    default: optind = argc+1; break;
+    }
+  }
+  if ( optind != argc-1 ) {
+    cerr << "Usage: " << argv[0] << " [-a algorithm] [-n iterations] [-l max_bytes]"
+	 << " [-w max_search_bits] [-o all.csv] input" << endl;
+    return 1;
+  }
+
+  ifstream in(argv[optind], ios::binary);
+  if ( !in.is_open() ) {
+    cerr << "File " << argv[optind] << " could not been opened!" << endl;
+    return 1;
+  }
+  vector<char> data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  if ( max_bytes > 0 && data.size() > max_bytes ) data.resize(max_bytes);
+  if ( data.empty() ) {
+    cerr << "The input is empty!" << endl;
+    return 1;
+  }
+
+  /* Grid of every algorithm. */
+  vector<Benchmark::Level> grid;
+  Benchmark::Level huf = { "huf", 0, FramedCompressor::HUFFMAN, 0, 0 };
+  grid.push_back(huf);
+  for(int sb = 2; sb <= max_search_bits; ++sb)
+    for(int lb = 1; lb < sb; ++lb) {
+      Benchmark::Level l = { "lz77", 0, FramedCompressor::LZ77, (uint8_t)sb, (uint8_t)lb };
+      grid.push_back(l);
+    }
+  for(int db = 4; db <= 20; ++db)
+    for(int bb = 4; bb <= 20; ++bb) {
+      Benchmark::Level l = { "lz78", 0, FramedCompressor::LZ78, (uint8_t)db, (uint8_t)bb };
+      grid.push_back(l);
+    }
+  for(int db = 8; db <= 20; ++db)
+    for(int bb = 4; bb <= 20; ++bb) {
+      Benchmark::Level l = { "lzw", 0, FramedCompressor::LZW, (uint8_t)db, (uint8_t)bb };
+      grid.push_back(l);
+    }
+
+  ofstream csv;
+  if ( !output.empty() ) {
+    csv.open(output.c_str());
+    csv << "algorithm,param1,param2,ratio,compress_mbs,decompress_mbs,peak_kib" << endl;
+  }
+
+  Benchmark bench(&data[0], data.size(), iterations);
+  vector<Point> points;
+  for(size_t i = 0; i < grid.size(); ++i) {
+    if ( !algorithm.empty() && algorithm != grid[i].algorithm ) continue;
+    Point p;
+    p.level = grid[i];
+    if ( !bench.run(p.level, p.result) ) {
+      cerr << p.level.algorithm << " " << (int)p.level.param1 << "," << (int)p.level.param2
+	   << " failed the round trip!" << endl;
+      continue;
+    }
+    p.ratio = (double)data.size()/p.result.compressed_size;
+    if ( csv.is_open() ) writePoint(csv, p);
+    points.push_back(p);
+  }
+
+  vector<Point> front;
+  for(size_t i = 0; i < points.size(); ++i) {
+    bool dominated = false;
+    for(size_t j = 0; j < points.size() && !dominated; ++j)
+      dominated = points[j].dominates(points[i]);
+    if ( !dominated ) front.push_back(points[i]);
+  }
+  sort(front.begin(), front.end());
+
+  cout << "Pareto-optimal settings on " << argv[optind] << " (" << data.size() << " bytes, "
+       << points.size() << " settings):" << endl;
+  cout << "algorithm,param1,param2,ratio,compress_mbs,decompress_mbs,peak_kib" << endl;
+  for(size_t i = 0; i < front.size(); ++i) writePoint(cout, front[i]);
+  return 0;
+}
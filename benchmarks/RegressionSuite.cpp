@@ -0,0 +1,302 @@
+/**
+ * @file RegressionSuite.cpp
+ * @brief Ratio and throughput regression suite on a synthetic corpus.
+ *
+ * The corpus is generated deterministically, so no data needs to be shipped:
+ * text-like, log-like, binary numeric, random and highly repetitive data, each
+ * one in several sizes. Every compressor is run end to end on every file
+ * (compression, decompression and check) with the Benchmark class, and the
+ * results are written as CSV. When a baseline is given, the results are
+ * compared against it and the program fails if any of them regressed more
+ * than the tolerance. Only the ratios are compared unless a speed tolerance
+ * is given, since the speeds are only comparable on the machine that wrote
+ * the baseline.
+ *
+ * Usage: regression [-n iterations] [-o results.csv] [-b baseline.csv]
+ *                   [-r ratio_tolerance] [-s speed_tolerance] [-c corpus_dir]
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <Benchmark.hpp>
+
+using namespace std;
+
+/**
+ * @class Random
+ * @brief Deterministic pseudo-random generator (xorshift32).
+ */
+class Random {
+private:
+  uint32_t x;
+public:
+  Random(uint32_t seed) : x(seed ? seed : 1) { }
+  uint32_t next() { x ^= x << 13; x ^= x >> 17; x ^= x << 5; return x; }
+  uint32_t below(uint32_t n) { return next() % n; }
+};
+
+/** Generates text made of words with a skewed distribution. */
+static string generateText(size_t n, Random& rnd)
+{
+  static const char * words[] = {
+    "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was",
+    "with", "be", "by", "on", "not", "he", "this", "are", "or", "his", "from",
+    "at", "which", "but", "have", "an", "had", "they", "you", "were", "their",
+    "one", "all", "we", "can", "her", "has", "there", "been", "if", "more",
+    "when", "will", "would", "who", "so", "no", "compression", "algorithm"
+  };
+  const size_t nwords = sizeof(words)/sizeof(words[0]);
+  string s;
+  while ( s.size() < n ) {
+    /* Picking the minimum of two draws favours the first words. */
+    size_t w = min(rnd.below(nwords), rnd.below(nwords));
+    s += words[w];
+    uint32_t p = rnd.below(20);
+    s += (p == 0 ? ".\n" : p == 1 ? ", " : " ");
+  }
+  s.resize(n);
+  return s;
+}
+
+/** Generates log lines with timestamps, levels, addresses and counters. */
+static string generateLog(size_t n, Random& rnd)
+{
+  static const char * levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+  static const char * messages[] = {
+    "request served", "connection opened", "connection closed",
+    "cache miss for key", "retrying operation", "timeout waiting for reply"
+  };
+  string s;
+  unsigned long t = 1300000000;
+  while ( s.size() < n ) {
+    t += rnd.below(3);
+    ostringstream line;
+    line << t << "." << setw(3) << setfill('0') << rnd.below(1000) << " "
+	 << levels[rnd.below(6)] << " [worker-" << rnd.below(8) << "] "
+	 << messages[rnd.below(6)] << " client=10.0." << rnd.below(4) << "." << rnd.below(256)
+	 << " bytes=" << rnd.below(65536) << "\n";
+    s += line.str();
+  }
+  s.resize(n);
+  return s;
+}
+
+/** Generates little-endian 32 bits integers of a slowly changing series. */
+static string generateNumeric(size_t n, Random& rnd)
+{
+  string s;
+  int32_t v = 100000;
+  while ( s.size() < n ) {
+    v += (int32_t)rnd.below(201)-100;
+    for(int i = 0; i < 4; ++i) s += (char)((v >> (8*i)) & 0xFF);
+  }
+  s.resize(n);
+  return s;
+}
+
+/** Generates random bytes. */
+static string generateRandom(size_t n, Random& rnd)
+{
+  string s(n, 0);
+  for(size_t i = 0; i < n; ++i) s[i] = (char)(rnd.next() >> 24);
+  return s;
+}
+
+/** Generates a few records repeated many times. */
+static string generateRepetitive(size_t n, Random& rnd)
+{
+  vector<string> records;
+  for(int i = 0; i < 16; ++i) records.push_back(generateRandom(32+rnd.below(64), rnd));
+  string s;
+  while ( s.size() < n ) s += records[rnd.below(records.size())];
+  s.resize(n);
+  return s;
+}
+
+/**
+ * @class CorpusFile
+ * @brief File of the synthetic corpus.
+ */
+struct CorpusFile {
+  /** Name of the file. */
+  string name;
+  /** Content of the file. */
+  string data;
+};
+
+/** Generates the whole corpus. */
+static vector<CorpusFile> generateCorpus()
+{
+  typedef string (*Generator)(size_t, Random&);
+  static const struct { const char * name; Generator generate; } kinds[] = {
+    { "text", generateText }, { "log", generateLog }, { "numeric", generateNumeric },
+    { "random", generateRandom }, { "repetitive", generateRepetitive }
+  };
+  static const struct { const char * name; size_t size; } sizes[] = {
+    { "16k", 1 << 14 }, { "256k", 1 << 18 }, { "1m", 1 << 20 }
+  };
+
+  vector<CorpusFile> corpus;
+  for(size_t k = 0; k < sizeof(kinds)/sizeof(kinds[0]); ++k)
+    for(size_t z = 0; z < sizeof(sizes)/sizeof(sizes[0]); ++z) {
+      Random rnd(2011 + 97*k + z);
+      CorpusFile f = { string(kinds[k].name) + "-" + sizes[z].name,
+		       kinds[k].generate(sizes[z].size, rnd) };
+      corpus.push_back(f);
+    }
+  return corpus;
+}
+
+/**
+ * @class Row
+ * @brief Result of a compressor on a file.
+ */
+struct Row {
+  string file, algorithm;
+  int level;
+  size_t size;
+  double ratio, compress_speed, decompress_speed;
+
+  string key() const
+  { return file + "," + algorithm + "," + to_string(level); }
+};
+
+/** Reads a CSV file written by writeRows(). */
+static bool readRows(const string& filename, map<string,Row>& rows)
+{
+  ifstream in(filename.c_str());
+  if ( !in.is_open() ) return false;
+  string line;
+  getline(in, line); /* header */
+  while ( getline(in, line) ) {
+    istringstream ls(line);
+    Row r;
+    string level, size, ratio, cs, ds;
+    if ( !getline(ls, r.file, ',') || !getline(ls, r.algorithm, ',') || !getline(ls, level, ',') ||
+	 !getline(ls, size, ',') || !getline(ls, ratio, ',') || !getline(ls, cs, ',') ||
+	 !getline(ls, ds, ',') )
+      return false;
+    r.level = atoi(level.c_str()); r.size = atol(size.c_str());
+    r.ratio = atof(ratio.c_str());
+    r.compress_speed = atof(cs.c_str()); r.decompress_speed = atof(ds.c_str());
+    rows[r.key()] = r;
+  }
+  return true;
+}
+
+/** Writes the results as CSV. */
+static void writeRows(ostream& os, const vector<Row>& rows)
+{
+  os << "file,algorithm,level,size,ratio,compress_mbs,decompress_mbs" << endl;
+  for(size_t i = 0; i < rows.size(); ++i) {
+    const Row& r = rows[i];
+    os << r.file << "," << r.algorithm << "," << r.level << "," << r.size << ","
+       << fixed << setprecision(4) << r.ratio << "," << setprecision(2)
+       << r.compress_speed << "," << r.decompress_speed << endl;
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  unsigned iterations = 3;
+  string output, baseline, corpus_dir;
+  /* A negative speed tolerance disables the speed checks. */
+  double ratio_tolerance = 0.001, speed_tolerance = -1;
+  int c;
+  while ( (c = getopt(argc, argv, "n:o:b:r:s:c:")) != -1 ) {
+    switch ( c ) {
+    case 'n': iterations = atoi(optarg); break;
+    case 'o': output = optarg; break;
+    case 'b': baseline = optarg; break;
+    case 'r': ratio_tolerance = atof(optarg); break;
+    case 's': speed_tolerance = atof(optarg); break;
+    case 'c': corpus_dir = optarg; break;
+    default:
+      cerr << "Usage: " << argv[0] << " [-n iterations] [-o results.csv] [-b baseline.csv]"
+	   << " [-r ratio_tolerance] [-s speed_tolerance] [-c corpus_dir]" << endl;
+      return 1;
+    }
+  }
+
+  /* The default level of every algorithm. */
+  static const struct { const char * algorithm; int level; } levels[] = {
+    { "huf", 1 }, { "lz77", 1 }, { "lz78", 2 }, { "lzw", 2 }
+  };
+
+  vector<CorpusFile> corpus = generateCorpus();
+  vector<Row> rows;
+  bool ok = true;
+  for(size_t f = 0; f < corpus.size(); ++f) {
+    const CorpusFile& file = corpus[f];
+    if ( !corpus_dir.empty() ) {
+      ofstream out((corpus_dir + "/" + file.name).c_str(), ios::binary);
+      out.write(file.data.data(), file.data.size());
+      if ( !out.good() ) { cerr << "Error writing " << file.name << endl; return 1; }
+    }
+
+    Benchmark bench(file.data.data(), file.data.size(), iterations);
+    for(size_t l = 0; l < sizeof(levels)/sizeof(levels[0]); ++l)
+      for(size_t i = 0; i < Benchmark::NUM_LEVELS; ++i) {
+	const Benchmark::Level& level = Benchmark::LEVELS[i];
+	if ( strcmp(level.algorithm, levels[l].algorithm) || level.level != levels[l].level )
+	  continue;
+	Benchmark::Result res;
+	if ( !bench.run(level, res) ) {
+	  cerr << file.name << ": " << level.algorithm << " failed the round trip!" << endl;
+	  ok = false;
+	}
+	Row r = { file.name, level.algorithm, level.level, file.data.size(),
+		  (double)file.data.size()/res.compressed_size,
+		  res.compress_speed, res.decompress_speed };
+	rows.push_back(r);
+      }
+  }
+
+  if ( output.empty() || output == "-" ) writeRows(cout, rows);
+  else {
+    ofstream out(output.c_str());
+    writeRows(out, rows);
+    if ( !out.good() ) { cerr << "Error writing " << output << endl; return 1; }
+  }
+
+  if ( !baseline.empty() ) {
+    map<string,Row> base;
+    if ( !readRows(baseline, base) ) {
+      cerr << "Baseline " << baseline << " could not been read!" << endl;
+      return 1;
+    }
+    size_t regressions = 0;
+    for(size_t i = 0; i < rows.size(); ++i) {
+      const Row& r = rows[i];
+      map<string,Row>::const_iterator b = base.find(r.key());
+      if ( b == base.end() ) continue;
+      const char * what = 0;
+      double was = 0, now = 0;
+      if ( r.ratio < b->second.ratio*(1-ratio_tolerance) )
+	{ what = "ratio"; was = b->second.ratio; now = r.ratio; }
+      else if ( speed_tolerance >= 0 &&
+		r.compress_speed < b->second.compress_speed*(1-speed_tolerance) )
+	{ what = "compress MB/s"; was = b->second.compress_speed; now = r.compress_speed; }
+      else if ( speed_tolerance >= 0 &&
+		r.decompress_speed < b->second.decompress_speed*(1-speed_tolerance) )
+	{ what = "decompress MB/s"; was = b->second.decompress_speed; now = r.decompress_speed; }
+      if ( what ) {
+	cerr << "REGRESSION " << r.key() << ": " << what << " " << was << " -> " << now << endl;
+	++regressions;
+      }
+    }
+    cerr << regressions << " regressions against " << baseline << endl;
+    if ( regressions > 0 ) ok = false;
+  }
+
+  return (ok ? 0 : 1);
+}
@@ -0,0 +1,392 @@
+/**
+ * @file AsyncCompressor.hpp
+ * @brief File including the implementation of AsyncCompressor class.
+ */
+
+#ifndef __ASYNCCOMPRESSOR_HPP__
+#define __ASYNCCOMPRESSOR_HPP__
+
+#include <vector>
+#include <map>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+
+#include <FramedCompressor.hpp>
+#include <MagicNumber.hpp>
+#include <BoundedQueue.hpp>
+#include <Trace.hpp>
+
+/**
+ * @class AsyncCompressor
+ * @brief Compresses and decompresses buffers on a pool of worker threads.
+ *
+ * Jobs are queued in a bounded queue and run by the workers, so the CPU-heavy
+ * work stays off the threads that submit them (i.e. the I/O threads of an
+ * event loop). The completion is notified through a std::future or through a
+ * callback, which runs on the worker thread. When the queue is full,
+ * compress() and decompress() wait for a free slot (backpressure), while
+ * tryCompress() and tryDecompress() return false at once, so that an event
+ * loop never blocks.
+ *
+ * The data is compressed with FramedCompressor and starts with its magic
+ * number, like the output of scompressor_compress() and of the command line
+ * tool, so they can decompress each other's data (the magic numbers of the
+ * single compressors are recognized too). Every worker keeps its own
+ * compressors for the parameters it has seen, so their memory is reused
+ * between jobs. The input buffers must stay valid until the job completes.
+ * The size of the decompressed data is limited (see the constructor), since
+ * the size written in the compressed data cannot be trusted.
+ *
+ * @code
+ * AsyncCompressor async(4, 64);
+ * std::future<AsyncCompressor::Result> f = async.compress(src, n);
+ * ...
+ * AsyncCompressor::Result r = f.get();
+ * if ( r.ok ) send(r.data.data(), r.data.size());
+ * @endcode
+ */
+class AsyncCompressor {
+public:
+  /**
+   * @class Parameters
+   * @brief Parameters of a compression.
+   */
+  struct Parameters {
+    /** Method used to compress the frames (see FramedCompressor). */
+    uint8_t method;
+    /** Whether the frame and content checksums are written. */
+    bool checksums;
+    /** Size of the frames, in bytes. */
+    size_t frame_size;
+
+    Parameters(uint8_t m = FramedCompressor::LZW, bool c = false,
+	       size_t f = FramedCompressor::DEFAULT_FRAME_SIZE)
+      : method(m), checksums(c), frame_size(f)
+    { }
+
+    bool operator < (const Parameters& p) const
+    {
+      if ( method != p.method ) return method < p.method;
+      if ( checksums != p.checksums ) return checksums < p.checksums;
+      return frame_size < p.frame_size;
+    }
+  };
+
+  /**
+   * @class Result
+   * @brief Result of a job.
+   */
+  struct Result {
+    /** Whether the job succeeded. */
+    bool ok;
+    /** Compressed or decompressed data. */
+    std::vector<char> data;
+
+    Result() : ok(false) { }
+  };
+
+  /** Function called on the worker thread when a job completes. */
+  typedef std::function<void (Result&)> Callback;
+
+private:
+  /**
+   * @class Job
+   * @brief Job in the queue.
+   */
+  struct Job {
+    bool compress;
+    const void * src;
+    size_t n;
+    Parameters params;
+    Callback done;
+  };
+
+  /** Jobs waiting for a worker. */
+  BoundedQueue<Job> jobs;
+  /** Worker threads. */
+  std::vector<std::thread> workers;
+  /** Number of jobs submitted and not completed yet. */
+  size_t outstanding;
+  /** Maximum size of the decompressed data, in bytes. */
+  size_t max_size;
+  std::mutex mutex;
+  std::condition_variable idle;
+
+  /** Non-copyable. */
+  AsyncCompressor(const AsyncCompressor&);
+  /** Non-copyable. */
+  AsyncCompressor& operator = (const AsyncCompressor&);
+
+  /**
+   * @class LimitedBuffer
+   * @brief Stream buffer that appends to a vector, failing beyond a size.
+   */
+  class LimitedBuffer : public std::streambuf {
+  private:
+    std::vector<char>& data;
+    size_t limit;
+  protected:
+    std::streamsize xsputn(const char * s, std::streamsize n)
+    {
+      if ( (size_t)n > limit - data.size() ) return 0;
+      data.insert(data.end(), s, s+n);
+      return n;
+    }
+
+    int_type overflow(int_type c)
+    {
+      if ( traits_type::eq_int_type(c, traits_type::eof()) ) return traits_type::not_eof(c);
+      char ch = traits_type::to_char_type(c);
+      return (xsputn(&ch, 1) == 1 ? c : traits_type::eof());
+    }
+  public:
+    LimitedBuffer(std::vector<char>& d, size_t l) : data(d), limit(l) { }
+  };
+
+  /**
+   * @brief Decompresses data of unknown size, frame by frame, into a growing buffer.
+   * @return size of the data, or BUFFER_ERROR if it is not valid or too large.
+   */
+  static size_t decompressGrowing(GenericCompressor * compr, const void * src, size_t n,
+				  size_t limit, Result& result)
+  {
+    LimitedBuffer buffer(result.data, limit);
+    std::ostream os(&buffer);
+    if ( !compr->decompress(src, n, os) ) return GenericCompressor::BUFFER_ERROR;
+    return result.data.size();
+  }
+
+  /**
+   * @brief Runs a job with the compressors of a worker.
+   */
+  static void run(const Job& job, std::map<Parameters, FramedCompressor *>& compressors,
+		  size_t limit, Result& result)
+  {
+    if ( job.compress && (job.params.method > FramedCompressor::AUTO || job.params.frame_size == 0 ||
+			  job.params.frame_size > FramedCompressor::MAX_FRAME_SIZE) ) return;
+    if ( !job.compress && job.n < MAGIC_NUMBER_SIZE ) return;
+    const char * src = (const char *)job.src;
+    uint16_t magicnum = (job.compress ? FRAMED_MAGIC_NUMBER : readMagicNumber(src));
+
+    size_t n;
+    if ( magicnum != FRAMED_MAGIC_NUMBER ) {
+      /* Written by a single compressor: the size is not known in advance. */
+      std::unique_ptr<GenericCompressor> compr(createDecompressor(magicnum));
+      if ( !compr ) return;
+      SCOMPRESSOR_TRACE("decompress job", "async");
+      n = decompressGrowing(compr.get(), src+MAGIC_NUMBER_SIZE, job.n-MAGIC_NUMBER_SIZE,
+			    limit, result);
+    } else {
+      FramedCompressor *& compr = compressors[job.compress ? job.params : Parameters()];
+      if ( compr == 0 )
+	compr = new FramedCompressor(job.params.method, job.params.checksums, job.params.frame_size);
+
+      if ( job.compress ) {
+	SCOMPRESSOR_TRACE("compress job", "async");
+	result.data.resize(MAGIC_NUMBER_SIZE + compr->getCompressBound(job.n));
+	writeMagicNumber(result.data.data(), FRAMED_MAGIC_NUMBER);
+	n = compr->compress(job.src, job.n, result.data.data()+MAGIC_NUMBER_SIZE,
+			    result.data.size()-MAGIC_NUMBER_SIZE);
+	if ( n != GenericCompressor::BUFFER_ERROR ) n += MAGIC_NUMBER_SIZE;
+      } else if ( compr->getDecompressedSize(src+MAGIC_NUMBER_SIZE, job.n-MAGIC_NUMBER_SIZE, n) ) {
+	SCOMPRESSOR_TRACE("decompress job", "async");
+	if ( n > limit ) return;
+	result.data.resize(n);
+	n = compr->decompress(src+MAGIC_NUMBER_SIZE, job.n-MAGIC_NUMBER_SIZE,
+			      result.data.data(), result.data.size());
+      } else {
+	/* Compressed from a stream: the size is not known in advance. */
+	SCOMPRESSOR_TRACE("decompress job", "async");
+	n = decompressGrowing(compr, src+MAGIC_NUMBER_SIZE, job.n-MAGIC_NUMBER_SIZE,
+			      limit, result);
+      }
+    }
+    result.ok = (n != GenericCompressor::BUFFER_ERROR);
+    result.data.resize(result.ok ? n : 0);
+  }
+
+  /**
+   * @brief Body of the worker threads.
+   */
+  void work()
+  {
+    Trace::setThreadName("async worker");
+    std::map<Parameters, FramedCompressor *> compressors;
+    Job job;
+    while ( jobs.pop(job) ) {
+      Result result;
+      try {
+	run(job, compressors, max_size, result);
+      } catch ( ... ) {
+	/* i.e. std::bad_alloc */
+	result.ok = false;
+	result.data.clear();
+      }
+      try {
+	job.done(result);
+      } catch ( ... ) { }
+      job.done = Callback();
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if ( --outstanding == 0 ) idle.notify_all();
+    }
+    for(std::map<Parameters, FramedCompressor *>::iterator it = compressors.begin();
+	it != compressors.end(); ++it)
+      delete it->second;
+  }
+
+  /**
+   * @brief Queues a job.
+   * @param wait whether to wait while the queue is full.
+   * @return false if the queue is full (and wait is false), true otherwise.
+   */
+  bool submit(const Job& job, bool wait)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++outstanding;
+    }
+    if ( wait ? jobs.push(job) : jobs.try_push(job) ) return true;
+    std::lock_guard<std::mutex> lock(mutex);
+    if ( --outstanding == 0 ) idle.notify_all();
+    return false;
+  }
+
+  /** Creates a job. */
+  static Job makeJob(bool compress, const void * src, size_t n, const Parameters& p,
+		     const Callback& done)
+  {
+    Job job = { compress, src, n, p, done };
+    return job;
+  }
+
+  /** Creates a callback that sets the value of a promise. */
+  static Callback promiseCallback(const std::shared_ptr<std::promise<Result> >& promise)
+  {
+    return [promise](Result& r) { promise->set_value(std::move(r)); };
+  }
+
+public:
+  /** Default maximum size of the decompressed data (1 GiB). */
+  static const size_t DEFAULT_MAX_SIZE = 1 << 30;
+
+  /**
+   * @brief Constructor. The workers are started.
+   * @param threads number of workers (0 for one per hardware thread).
+   * @param queue_size maximum number of jobs waiting for a worker.
+   * @param max maximum size of the decompressed data, in bytes. The
+   * decompression jobs of larger data fail.
+   */
+  explicit AsyncCompressor(unsigned threads = 0, size_t queue_size = 64,
+			   size_t max = DEFAULT_MAX_SIZE)
+    : jobs(queue_size), outstanding(0), max_size(max)
+  {
+    if ( threads == 0 ) threads = std::max(1u, std::thread::hardware_concurrency());
+    for(unsigned i = 0; i < threads; ++i)
+      workers.push_back(std::thread(&AsyncCompressor::work, this));
+  }
+
+  /**
+   * @brief Destructor. The jobs already queued are completed before the
+   * workers are stopped.
+   */
+  ~AsyncCompressor()
+  {
+    jobs.close();
+    for(size_t i = 0; i < workers.size(); ++i) workers[i].join();
+  }
+
+  /**
+   * @brief Compresses a buffer, waiting while the queue is full.
+   * @param src data to be compressed. It must be valid until the job completes.
+   * @param n size of the data, in bytes.
+   * @param p parameters of the compression.
+   * @return future result.
+   */
+  std::future<Result> compress(const void * src, size_t n, const Parameters& p = Parameters())
+  {
+    std::shared_ptr<std::promise<Result> > promise(new std::promise<Result>());
+    std::future<Result> f = promise->get_future();
+    submit(makeJob(true, src, n, p, promiseCallback(promise)), true);
+    return f;
+  }
+
+  /**
+   * @brief Decompresses a buffer, waiting while the queue is full.
+   * @param src data to be decompressed. It must be valid until the job completes.
+   * @param n size of the data, in bytes.
+   * @return future result.
+   */
+  std::future<Result> decompress(const void * src, size_t n)
+  {
+    std::shared_ptr<std::promise<Result> > promise(new std::promise<Result>());
+    std::future<Result> f = promise->get_future();
+    submit(makeJob(false, src, n, Parameters(), promiseCallback(promise)), true);
+    return f;
+  }
+
+  /**
+   * @brief Compresses a buffer, waiting while the queue is full.
+   * @param src data to be compressed. It must be valid until the job completes.
+   * @param n size of the data, in bytes.
+   * @param p parameters of the compression.
+   * @param done function called on the worker thread with the result.
+   */
+  void compress(const void * src, size_t n, const Parameters& p, const Callback& done)
+  { submit(makeJob(true, src, n, p, done), true); }
+
+  /**
+   * @brief Decompresses a buffer, waiting while the queue is full.
+   * @param src data to be decompressed. It must be valid until the job completes.
+   * @param n size of the data, in bytes.
+   * @param done function called on the worker thread with the result.
+   */
+  void decompress(const void * src, size_t n, const Callback& done)
+  { submit(makeJob(false, src, n, Parameters(), done), true); }
+
+  /**
+   * @brief Compresses a buffer if there is room in the queue.
+   * @return false if the queue is full (done will not be called), true otherwise.
+   */
+  bool tryCompress(const void * src, size_t n, const Parameters& p, const Callback& done)
+  { return submit(makeJob(true, src, n, p, done), false); }
+
+  /**
+   * @brief Decompresses a buffer if there is room in the queue.
+   * @return false if the queue is full (done will not be called), true otherwise.
+   */
+  bool tryDecompress(const void * src, size_t n, const Callback& done)
+  { return submit(makeJob(false, src, n, Parameters(), done), false); }
+
+  /**
+   * @brief Waits until all the jobs submitted so far are completed.
+   */
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while ( outstanding > 0 ) idle.wait(lock);
+  }
+
+  /**
+   * @brief Returns the number of jobs submitted and not completed yet.
+   */
+  size_t pending()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return outstanding;
+  }
+
+  /**
+   * @brief Returns the number of workers.
+   */
+  size_t threads() const
+  { return workers.size(); }
+};
+
+#endif
@@ -0,0 +1,575 @@
+/**
+ * @file AsyncFile.hpp
+ * @brief File including the implementation of AsyncFileReader and AsyncFileWriter classes.
+ */
+
+#ifndef __ASYNCFILE_HPP__
+#define __ASYNCFILE_HPP__
+
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <IoUring.hpp>
+#include <Trace.hpp>
+
+/**
+ * @class AsyncFileBackend
+ * @brief Keeps several block reads or writes of a file in flight.
+ *
+ * The blocks are registered as fixed buffers of an io_uring instance, and every
+ * block has at most one request in flight. The requests are queued and handed
+ * to the kernel in batches (when half the blocks have a request queued, or when
+ * a request must be waited for), so the refills of several blocks share a single
+ * system call. When io_uring is not available, each request is served
+ * synchronously with pread()/pwrite() when it is submitted, so the users of
+ * this class do not need to care about the backend in use.
+ */
+class AsyncFileBackend {
+private:
+  /** Parameters of a request. */
+  struct Request {
+    /** Whether it is a write (or a read). */
+    bool write;
+    /** Number of bytes. */
+    size_t len;
+    /** Position in the file. */
+    off_t offset;
+  };
+
+  /** io_uring instance. */
+  IoUring ring;
+  /** Whether io_uring is used. */
+  bool uring;
+  /** Whether each block has a request in flight. */
+  std::vector<bool> pending;
+  /** Result of the last request of each block. */
+  std::vector<ssize_t> results;
+  /** Last request of each block. */
+  std::vector<Request> requests;
+  /** Blocks whose requests are queued but not submitted yet, in order. */
+  std::vector<size_t> queued;
+
+  /**
+   * @brief Serves the request of a block synchronously.
+   * @param i block index.
+   * @return result of the request, as returned by pread()/pwrite().
+   */
+  ssize_t serve(size_t i)
+  {
+    const Request& q = requests[i];
+    return (q.write ? pwrite(fd, block(i), q.len, q.offset) :
+	    pread(fd, block(i), q.len, q.offset));
+  }
+
+  /**
+   * @brief Queues the request of a block, or serves it if it cannot be queued.
+   * @param i block index.
+   */
+  void request(size_t i)
+  {
+    const Request& q = requests[i];
+    if ( uring && (q.write ? ring.write(fd, block(i), q.len, q.offset, i, i) :
+		   ring.read(fd, block(i), q.len, q.offset, i, i)) ) {
+      pending[i] = true;
+      queued.push_back(i);
+      if ( 2*queued.size() >= nblocks ) flush();
+    } else {
+      /* From now on, the requests are served synchronously. */
+      uring = false;
+      results[i] = serve(i);
+    }
+  }
+
+protected:
+  /** File descriptor. */
+  int fd;
+  /** Size of each block, in bytes. */
+  size_t block_size;
+  /** Number of blocks. */
+  size_t nblocks;
+  /** Storage of all the blocks. */
+  std::vector<char> storage;
+
+  /**
+   * @brief Constructor.
+   * @param bsize size of each block, in bytes.
+   * @param n number of blocks.
+   */
+  AsyncFileBackend(size_t bsize, size_t n)
+    : uring(false), pending(n, false), results(n, 0), requests(n),
+      fd(-1), block_size(bsize), nblocks(n), storage(bsize*n)
+  { }
+
+  /**
+   * @brief Sets up the backend for the current file descriptor.
+   */
+  void setup()
+  {
+    uring = ring.init(nblocks);
+    if ( uring ) {
+      std::vector<struct iovec> iov(nblocks);
+      for(size_t i = 0; i < nblocks; ++i) {
+	iov[i].iov_base = block(i);
+	iov[i].iov_len = block_size;
+      }
+      ring.registerBuffers(&iov[0], nblocks);
+    }
+  }
+
+  /**
+   * @brief Returns the memory of a block.
+   * @param i block index.
+   * @return pointer to the block.
+   */
+  inline char * block(size_t i)
+  { return &storage[i*block_size]; }
+
+  /**
+   * @brief Starts reading a block from the file.
+   * @param i block index.
+   * @param offset position in the file.
+   */
+  void submitRead(size_t i, off_t offset)
+  {
+    requests[i].write = false;
+    requests[i].len = block_size;
+    requests[i].offset = offset;
+    request(i);
+  }
+
+  /**
+   * @brief Starts writing a block to the file.
+   * @param i block index.
+   * @param len number of bytes of the block to be written.
+   * @param offset position in the file.
+   */
+  void submitWrite(size_t i, size_t len, off_t offset)
+  {
+    requests[i].write = true;
+    requests[i].len = len;
+    requests[i].offset = offset;
+    request(i);
+  }
+
+  /**
+   * @brief Hands the queued requests to the kernel.
+   * @param wait whether to wait for a completion in the same system call.
+   */
+  void flush(bool wait = false)
+  {
+    if ( queued.empty() ) return;
+    size_t done = ring.submit(wait);
+    for(size_t k = done; k < queued.size(); ++k) {
+      /* The kernel did not take it: from now on, the requests are served synchronously. */
+      size_t i = queued[k];
+      uring = false;
+      pending[i] = false;
+      results[i] = serve(i);
+    }
+    queued.clear();
+  }
+
+  /**
+   * @brief Waits for the request of a block to complete.
+   * @param i block index.
+   * @return result of the request, as returned by pread()/pwrite().
+   */
+  ssize_t complete(size_t i)
+  {
+    uint64_t j; int res;
+    while ( pending[i] && ring.peek(j, res) ) {
+      pending[j] = false;
+      results[j] = res;
+    }
+    if ( !pending[i] ) return results[i];
+    SCOMPRESSOR_TRACE("wait io", "wait");
+    flush(true);
+    while ( pending[i] ) {
+      if ( !ring.wait(j, res) ) { pending[i] = false; results[i] = -1; break; }
+      pending[j] = false;
+      results[j] = res;
+    }
+    return results[i];
+  }
+
+  /**
+   * @brief Waits for all the requests in flight.
+   */
+  void drain()
+  {
+    for(size_t i = 0; i < nblocks; ++i) complete(i);
+  }
+
+  /**
+   * @brief Closes the file and the ring.
+   */
+  void closeFile()
+  {
+    drain();
+    ring.close();
+    uring = false;
+    if ( fd >= 0 ) ::close(fd);
+    fd = -1;
+  }
+
+public:
+  /**
+   * @brief Returns whether io_uring is in use.
+   * @return true if io_uring is used, false if pread()/pwrite() are used.
+   */
+  bool usingIoUring() const
+  { return uring; }
+};
+
+/**
+ * @class AsyncFileInputBuffer
+ * @brief Stream buffer that reads a file ahead, keeping several block reads in flight.
+ *
+ * Seeking to an absolute position is supported (Huffman needs to read its input twice);
+ * the reads in flight are discarded and the read ahead starts again from that position.
+ */
+class AsyncFileInputBuffer : public std::streambuf, public AsyncFileBackend {
+private:
+  /** Position in the file of each block. */
+  std::vector<off_t> offsets;
+  /** Position in the file of the next block to be requested. */
+  off_t next_offset;
+  /** Block being consumed (or the next one, if none is in use). */
+  size_t current;
+  /** Whether the current block is in use. */
+  bool in_use;
+  /** Whether the end of file was reached. */
+  bool finished;
+  /** Size of the file when it was opened. */
+  off_t file_size;
+  /** Stream using this buffer, whose state reports read errors. */
+  std::ios * owner;
+
+  /**
+   * @brief Discards the blocks in flight and restarts reading from a position.
+   * @param pos position in the file.
+   */
+  void restart(off_t pos)
+  {
+    drain();
+    next_offset = pos;
+    for(size_t i = 0; i < nblocks; ++i) {
+      offsets[i] = next_offset;
+      submitRead(i, next_offset);
+      next_offset += block_size;
+    }
+    flush();
+    current = 0; in_use = false; finished = false;
+    setg(0, 0, 0);
+  }
+
+protected:
+  int_type underflow()
+  {
+    if ( gptr() < egptr() ) return traits_type::to_int_type(*gptr());
+    if ( finished ) return traits_type::eof();
+    if ( in_use ) {
+      /* The consumed block is requested again, after the last one in flight. */
+      offsets[current] = next_offset;
+      submitRead(current, next_offset);
+      next_offset += block_size;
+      current = (current+1) % nblocks;
+    }
+    in_use = true;
+    ssize_t r = complete(current);
+    /* A short read before the end of the file is completed synchronously. */
+    while ( r >= 0 && (size_t)r < block_size && offsets[current]+r < file_size ) {
+      ssize_t n = pread(fd, block(current)+r, block_size-r, offsets[current]+r);
+      if ( n < 0 ) r = n;
+      else if ( n == 0 ) break;
+      else r += n;
+    }
+    if ( r < 0 ) {
+      finished = true;
+      setg(0, 0, 0);
+      if ( owner ) owner->setstate(std::ios::badbit);
+      return traits_type::eof();
+    }
+    if ( (size_t)r < block_size ) finished = true;
+    if ( r == 0 ) return traits_type::eof();
+    setg(block(current), block(current), block(current)+r);
+    return traits_type::to_int_type(*gptr());
+  }
+
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+  {
+    if ( fd < 0 || !(which & std::ios_base::in) ) return pos_type(off_type(-1));
+    if ( dir == std::ios_base::cur ) {
+      off_type base = (in_use ? offsets[current] + (gptr()-eback()) : offsets[current]);
+      off += base;
+    } else if ( dir != std::ios_base::beg ) return pos_type(off_type(-1));
+    return seekpos(pos_type(off), which);
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which)
+  {
+    if ( fd < 0 || !(which & std::ios_base::in) || off_type(pos) < 0 )
+      return pos_type(off_type(-1));
+    restart(off_type(pos));
+    return pos;
+  }
+
+public:
+  /**
+   * @brief Constructor.
+   * @param bsize size of each block, in bytes.
+   * @param n number of blocks in flight.
+   * @param o stream whose badbit is set on read errors (may be null).
+   */
+  AsyncFileInputBuffer(size_t bsize, size_t n, std::ios * o = 0)
+    : AsyncFileBackend(bsize, n), offsets(n, 0), next_offset(0),
+      current(0), in_use(false), finished(true), file_size(0), owner(o)
+  { }
+
+  /**
+   * @brief Destructor.
+   */
+  ~AsyncFileInputBuffer()
+  { close(); }
+
+  /**
+   * @brief Opens a file and starts reading it ahead.
+   * @param filename name of the file.
+   * @return true if the file was opened, false otherwise.
+   */
+  bool open(const std::string& filename)
+  {
+    close();
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if ( fd < 0 ) return false;
+    struct stat st;
+    file_size = (fstat(fd, &st) == 0 ? st.st_size : 0);
+    setup();
+    restart(0);
+    return true;
+  }
+
+  /**
+   * @brief Closes the file.
+   */
+  void close()
+  {
+    closeFile();
+    finished = true;
+    setg(0, 0, 0);
+  }
+};
+
+/**
+ * @class AsyncFileOutputBuffer
+ * @brief Stream buffer that writes a file behind, keeping several block writes in flight.
+ */
+class AsyncFileOutputBuffer : public std::streambuf, public AsyncFileBackend {
+private:
+  /** Number of bytes requested to be written of each block. */
+  std::vector<size_t> lengths;
+  /** Position in the file of each block. */
+  std::vector<off_t> offsets;
+  /** Position in the file of the next block. */
+  off_t next_offset;
+  /** Block being filled. */
+  size_t current;
+  /** Whether any write failed. */
+  bool failed;
+
+  /**
+   * @brief Waits for the write of a block and completes it if it was short.
+   * @param i block index.
+   */
+  void finish(size_t i)
+  {
+    ssize_t r = complete(i);
+    if ( lengths[i] == 0 ) return;
+    size_t done = (r > 0 ? r : 0);
+    if ( r < 0 ) failed = true;
+    while ( !failed && done < lengths[i] ) {
+      r = pwrite(fd, block(i)+done, lengths[i]-done, offsets[i]+done);
+      if ( r <= 0 ) failed = true;
+      else done += r;
+    }
+    lengths[i] = 0;
+  }
+
+  /**
+   * @brief Starts writing the current block and takes the next one.
+   * @return false if any write failed, true otherwise.
+   */
+  bool submit()
+  {
+    if ( pptr() > pbase() ) {
+      lengths[current] = pptr()-pbase();
+      offsets[current] = next_offset;
+      submitWrite(current, lengths[current], next_offset);
+      next_offset += lengths[current];
+      current = (current+1) % nblocks;
+      finish(current);
+      setp(block(current), block(current)+block_size);
+    }
+    return !failed;
+  }
+
+protected:
+  int_type overflow(int_type c)
+  {
+    if ( fd < 0 || !submit() ) return traits_type::eof();
+    if ( !traits_type::eq_int_type(c, traits_type::eof()) ) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync()
+  {
+    return (fd >= 0 && submit() ? 0 : -1);
+  }
+
+public:
+  /**
+   * @brief Constructor.
+   * @param bsize size of each block, in bytes.
+   * @param n number of blocks in flight.
+   */
+  AsyncFileOutputBuffer(size_t bsize, size_t n)
+    : AsyncFileBackend(bsize, n), lengths(n, 0), offsets(n, 0), next_offset(0),
+      current(0), failed(false)
+  { }
+
+  /**
+   * @brief Destructor.
+   */
+  ~AsyncFileOutputBuffer()
+  { close(); }
+
+  /**
+   * @brief Creates (or truncates) a file to be written.
+   * @param filename name of the file.
+   * @return true if the file was opened, false otherwise.
+   */
+  bool open(const std::string& filename)
+  {
+    close();
+    fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if ( fd < 0 ) return false;
+    setup();
+    next_offset = 0; current = 0; failed = false;
+    setp(block(current), block(current)+block_size);
+    return true;
+  }
+
+  /**
+   * @brief Writes the pending data and closes the file.
+   * @return true if all the data was written, false otherwise.
+   */
+  bool close()
+  {
+    if ( fd < 0 ) return !failed;
+    submit();
+    for(size_t i = 0; i < nblocks; ++i) finish(i);
+    closeFile();
+    setp(0, 0);
+    return !failed;
+  }
+};
+
+/**
+ * @class AsyncFileReader
+ * @brief Input file stream that reads ahead using io_uring (or pread() as a fallback).
+ * @see AsyncFileInputBuffer
+ */
+class AsyncFileReader : public std::istream {
+private:
+  /** Stream buffer. */
+  AsyncFileInputBuffer buffer;
+public:
+  /**
+   * @brief Constructor.
+   * @param bsize size of each block, in bytes (default: 64 KiB).
+   * @param nblocks number of blocks in flight (default: 8).
+   */
+  AsyncFileReader(size_t bsize = 65536, size_t nblocks = 8)
+    : std::istream(0), buffer(bsize, nblocks, this)
+  { rdbuf(&buffer); }
+
+  /**
+   * @brief Opens a file.
+   * @param filename name of the file.
+   * @return true if the file was opened, false otherwise.
+   */
+  bool open(const std::string& filename)
+  {
+    bool ok = buffer.open(filename);
+    if ( ok ) clear(); else setstate(std::ios::failbit);
+    return ok;
+  }
+
+  /**
+   * @brief Returns whether io_uring is in use.
+   * @return true if io_uring is used, false if pread() is used.
+   */
+  bool usingIoUring() const
+  { return buffer.usingIoUring(); }
+};
+
+/**
+ * @class AsyncFileWriter
+ * @brief Output file stream that writes behind using io_uring (or pwrite() as a fallback).
+ * @see AsyncFileOutputBuffer
+ */
+class AsyncFileWriter : public std::ostream {
+private:
+  /** Stream buffer. */
+  AsyncFileOutputBuffer buffer;
+public:
+  /**
+   * @brief Constructor.
+   * @param bsize size of each block, in bytes (default: 64 KiB).
+   * @param nblocks number of blocks in flight (default: 8).
+   */
+  AsyncFileWriter(size_t bsize = 65536, size_t nblocks = 8)
+    : std::ostream(0), buffer(bsize, nblocks)
+  { rdbuf(&buffer); }
+
+  /**
+   * @brief Creates (or truncates) a file.
+   * @param filename name of the file.
+   * @return true if the file was opened, false otherwise.
+   */
+  bool open(const std::string& filename)
+  {
+    bool ok = buffer.open(filename);
+    if ( ok ) clear(); else setstate(std::ios::failbit);
+    return ok;
+  }
+
+  /**
+   * @brief Writes the pending data and closes the file.
+   * @return true if all the data was written, false otherwise.
+   */
+  bool close()
+  {
+    bool ok = buffer.close();
+    if ( !ok ) setstate(std::ios::badbit);
+    return ok;
+  }
+
+  /**
+   * @brief Returns whether io_uring is in use.
+   * @return true if io_uring is used, false if pwrite() is used.
+   */
+  bool usingIoUring() const
+  { return buffer.usingIoUring(); }
+};
+
+#endif
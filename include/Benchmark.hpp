@@ -0,0 +1,331 @@
+/**
+ * @file Benchmark.hpp
+ * @brief File including the implementation of Benchmark class.
+ */
+
+#ifndef __BENCHMARK_HPP__
+#define __BENCHMARK_HPP__
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+
+#include <GenericCompressor.hpp>
+#include <HuffmanCompressor.hpp>
+#include <LZ77Compressor.hpp>
+#include <LZ78Compressor.hpp>
+#include <LZWCompressor.hpp>
+#include <FramedCompressor.hpp>
+#include <CompressorPool.hpp>
+#include <PerfCounters.hpp>
+
+/**
+ * @class Benchmark
+ * @brief Measures the compressors on data already loaded in memory.
+ *
+ * Every level is run a number of times on the same buffers, and the best time
+ * is reported, so that the results do not depend on the disk or on the cache
+ * of the operating system. Each run checks that the data is decompressed back.
+ *
+ * Optionally, hardware performance counters are read around every compress
+ * and decompress call, and reported per MB of uncompressed data, so that one
+ * can tell whether a compressor is bound by branches or by memory.
+ */
+class Benchmark {
+public:
+  /**
+   * @class Level
+   * @brief Compressor and parameters measured together.
+   */
+  struct Level {
+    /** Name of the algorithm, as given to -a. */
+    const char * algorithm;
+    /** Level number, from the fastest to the strongest. */
+    int level;
+    /** Compression method (FramedCompressor::FrameMethod). */
+    uint8_t method;
+    /** First parameter (search bits or dictionary bits, 0 if there are none). */
+    uint8_t param1;
+    /** Second parameter (look-ahead bits or block bits, 0 if there are none). */
+    uint8_t param2;
+  };
+
+  /**
+   * @class Result
+   * @brief Measures of a level.
+   */
+  struct Result {
+    /** Size of the compressed data, in bytes. */
+    size_t compressed_size;
+    /** Best compression speed, in MB/s. */
+    double compress_speed;
+    /** Best decompression speed, in MB/s. */
+    double decompress_speed;
+    /** Maximum memory allocated by the compressor at the same time in a run, in KiB. */
+    long peak_memory;
+    /** Whether every run decompressed the original data. */
+    bool verified;
+    /** Hardware events per MB during the compression (-1 if not counted). */
+    double compress_events[PerfCounters::NUM_EVENTS];
+    /** Hardware events per MB during the decompression (-1 if not counted). */
+    double decompress_events[PerfCounters::NUM_EVENTS];
+  };
+
+  /** Levels of every algorithm. */
+  static const Level LEVELS[];
+  /** Number of levels. */
+  static const size_t NUM_LEVELS;
+
+private:
+  /** Data being compressed. */
+  const char * data;
+  /** Size of the data, in bytes. */
+  size_t size;
+  /** Number of runs of every level. */
+  unsigned iterations;
+  /** Buffer for the compressed data. */
+  std::vector<char> compressed;
+  /** Buffer for the decompressed data. */
+  std::vector<char> decompressed;
+  /** Hardware counters of the compression and decompression (NULL if disabled). */
+  PerfCounters * ccounters, * dcounters;
+
+  /**
+   * @brief Creates the compressor of a level.
+   * @param level level.
+   * @return compressor.
+   */
+  static GenericCompressor * create(const Level& level)
+  { return CompressorPool::create(level.method); }
+
+  /**
+   * @brief Compresses the data with the parameters of a level.
+   * @return size of the compressed data, or BUFFER_ERROR.
+   */
+  size_t compress(const Level& level, GenericCompressor * compr)
+  {
+    char * dst = &compressed[0];
+    size_t cap = compressed.size();
+    switch ( level.method ) {
+    case FramedCompressor::LZ77:
+      return static_cast<LZ77Compressor *>(compr)->compress(data, size, dst, cap,
+							    level.param1, level.param2);
+    case FramedCompressor::LZ78:
+      return static_cast<LZ78Compressor *>(compr)->compress(data, size, dst, cap,
+							    level.param1, level.param2);
+    case FramedCompressor::LZW:
+      return static_cast<LZWCompressor *>(compr)->compress(data, size, dst, cap,
+							   level.param1, level.param2);
+    default:
+      return compr->compress(data, size, dst, cap);
+    }
+  }
+
+  /**
+   * @brief Returns the maximum size of the compressed data of a level.
+   */
+  size_t bound(const Level& level, GenericCompressor * compr) const
+  {
+    switch ( level.method ) {
+    case FramedCompressor::LZ77: return LZ77Compressor::compressBound(size, level.param1, level.param2);
+    case FramedCompressor::LZ78: return LZ78Compressor::compressBound(size, level.param1, level.param2);
+    case FramedCompressor::LZW: return LZWCompressor::compressBound(size, level.param1, level.param2);
+    default: return compr->getCompressBound(size);
+    }
+  }
+
+  /**
+   * @brief Converts the accumulated values of the counters to events per MB.
+   * @param counters hardware counters.
+   * @param mb MB of uncompressed data processed.
+   * @param[out] events events per MB (-1 if not counted).
+   */
+  static void perMegabyte(const PerfCounters * counters, double mb, double * events)
+  {
+    for(int e = 0; e < PerfCounters::NUM_EVENTS; ++e)
+      events[e] = (counters != 0 && counters->available((PerfCounters::Event)e) ?
+		   counters->get((PerfCounters::Event)e)/std::max(mb, 1e-9) : -1.0);
+  }
+
+  /**
+   * @brief Writes the events per MB of a phase of a level.
+   */
+  static void writeEvents(std::ostream& os, const Level& l, const char * phase,
+			  const double * events)
+  {
+    os << std::left << std::setw(10) << l.algorithm << std::right << std::setw(5) << l.level
+       << " " << std::left << std::setw(11) << phase << std::right;
+    for(int e = 0; e < PerfCounters::NUM_EVENTS; ++e) {
+      if ( events[e] < 0 ) os << std::setw(14) << "-";
+      else os << std::setw(14) << std::setprecision(1) << events[e]/1e3;
+    }
+    if ( events[PerfCounters::CYCLES] > 0 && events[PerfCounters::INSTRUCTIONS] >= 0 )
+      os << std::setw(7) << std::setprecision(2)
+	 << events[PerfCounters::INSTRUCTIONS]/events[PerfCounters::CYCLES];
+    else os << std::setw(7) << "-";
+    os << std::endl;
+  }
+
+  /**
+   * @brief Returns the elapsed time since start, in seconds.
+   */
+  static double elapsed(std::chrono::steady_clock::time_point start)
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  }
+
+public:
+  /**
+   * @brief Constructor.
+   * @param d data to be compressed. It must be kept alive by the caller.
+   * @param n size of the data, in bytes.
+   * @param iter number of runs of every level.
+   */
+  Benchmark(const char * d, size_t n, unsigned iter)
+    : data(d), size(n), iterations(iter > 0 ? iter : 1),
+      decompressed(n+1), ccounters(0), dcounters(0)
+  { }
+
+  /**
+   * @brief Destructor.
+   */
+  ~Benchmark()
+  {
+    delete ccounters;
+    delete dcounters;
+  }
+
+  /**
+   * @brief Enables the hardware performance counters.
+   * @param os output stream where a warning is written if they are not available.
+   * @return true if at least one of them is available, false otherwise.
+   */
+  bool enablePerfCounters(std::ostream& os)
+  {
+    if ( ccounters == 0 ) { ccounters = new PerfCounters(); dcounters = new PerfCounters(); }
+    if ( ccounters->open() && dcounters->open() ) return true;
+    os << "Hardware counters are not available (" << ccounters->errorMessage()
+       << "), check /proc/sys/kernel/perf_event_paranoid." << std::endl;
+    delete ccounters; delete dcounters;
+    ccounters = dcounters = 0;
+    return false;
+  }
+
+  /**
+   * @brief Runs a level.
+   * @param level level.
+   * @param[out] result measures.
+   * @return true if the data was compressed and decompressed, false otherwise.
+   */
+  bool run(const Level& level, Result& result)
+  {
+    GenericCompressor * compr = create(level);
+    compressed.assign(bound(level, compr), 0);
+    std::fill(decompressed.begin(), decompressed.end(), 0);
+    uint64_t peak = 0;
+
+    double ctime = 0.0, dtime = 0.0;
+    unsigned runs = 0;
+    if ( ccounters != 0 ) { ccounters->reset(); dcounters->reset(); }
+    result.verified = true;
+    for(unsigned i = 0; i < iterations && result.verified; ++i, ++runs) {
+      /* The memory kept between runs (i.e. the LZ77 window) is counted in every run. */
+      compr->resetStats();
+      if ( ccounters != 0 ) ccounters->start();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      size_t c = compress(level, compr);
+      double t = elapsed(start);
+      if ( ccounters != 0 ) ccounters->stop();
+      if ( i == 0 || t < ctime ) ctime = t;
+
+      if ( dcounters != 0 ) dcounters->start();
+      start = std::chrono::steady_clock::now();
+      size_t d = (c == GenericCompressor::BUFFER_ERROR ? GenericCompressor::BUFFER_ERROR :
+		  compr->decompress(&compressed[0], c, &decompressed[0], decompressed.size()));
+      t = elapsed(start);
+      if ( dcounters != 0 ) dcounters->stop();
+      if ( i == 0 || t < dtime ) dtime = t;
+
+      result.compressed_size = c;
+      result.verified = (d == size && memcmp(data, &decompressed[0], size) == 0);
+      peak = std::max(peak, compr->getStats().getMemoryPeak());
+    }
+
+    result.peak_memory = (long)((peak+1023)/1024);
+    result.compress_speed = size/1e6/std::max(ctime, 1e-9);
+    result.decompress_speed = size/1e6/std::max(dtime, 1e-9);
+    perMegabyte(ccounters, size/1e6*runs, result.compress_events);
+    perMegabyte(dcounters, size/1e6*runs, result.decompress_events);
+    delete compr;
+    return result.verified;
+  }
+
+  /**
+   * @brief Runs the levels of an algorithm (or of all of them) and writes a table.
+   * @param algorithm name of the algorithm, or NULL to run all the levels.
+   * @param os output stream of the table.
+   * @return true if every level was verified, false otherwise.
+   */
+  bool runAll(const char * algorithm, std::ostream& os)
+  {
+    bool ok = true;
+    std::vector<const Level *> levels;
+    std::vector<Result> results;
+    os << "algorithm level params     ratio   comp MB/s decomp MB/s  peak KiB  check" << std::endl;
+    for(size_t i = 0; i < NUM_LEVELS; ++i) {
+      const Level& l = LEVELS[i];
+      if ( algorithm ? strcmp(algorithm, l.algorithm) != 0 : l.method == FramedCompressor::AUTO )
+	continue;
+      Result r;
+      ok = run(l, r) && ok;
+      levels.push_back(&l);
+      results.push_back(r);
+
+      std::string params = "-";
+      if ( l.param1 != 0 )
+	params = std::to_string((int)l.param1) + "," + std::to_string((int)l.param2);
+      os << std::left << std::setw(10) << l.algorithm << std::right << std::setw(5) << l.level
+	 << " " << std::left << std::setw(8) << params << std::right << std::fixed
+	 << std::setw(8) << std::setprecision(3)
+	 << (r.verified && size > 0 ? (double)size/r.compressed_size : 0.0)
+	 << std::setw(12) << std::setprecision(2) << r.compress_speed
+	 << std::setw(12) << r.decompress_speed
+	 << std::setw(10) << r.peak_memory
+	 << "  " << (r.verified ? "ok" : "FAILED") << std::endl;
+    }
+
+    if ( ccounters != 0 ) {
+      os << std::endl << "Hardware events per MB of uncompressed data (thousands):" << std::endl
+	 << "algorithm level phase      ";
+      for(int e = 0; e < PerfCounters::NUM_EVENTS; ++e)
+	os << std::setw(14) << PerfCounters::name((PerfCounters::Event)e);
+      os << std::setw(7) << "IPC" << std::endl;
+      for(size_t i = 0; i < results.size(); ++i) {
+	writeEvents(os, *levels[i], "compress", results[i].compress_events);
+	writeEvents(os, *levels[i], "decompress", results[i].decompress_events);
+      }
+    }
+    return ok;
+  }
+};
+
+const Benchmark::Level Benchmark::LEVELS[] = {
+  { "huf",  1, FramedCompressor::HUFFMAN, 0, 0 },
+  { "lz77", 1, FramedCompressor::LZ77, 9, 5 },
+  { "lz77", 2, FramedCompressor::LZ77, 11, 6 },
+  { "lz77", 3, FramedCompressor::LZ77, 12, 8 },
+  { "lz78", 1, FramedCompressor::LZ78, 12, 5 },
+  { "lz78", 2, FramedCompressor::LZ78, 14, 5 },
+  { "lz78", 3, FramedCompressor::LZ78, 16, 5 },
+  { "lzw",  1, FramedCompressor::LZW, 12, 6 },
+  { "lzw",  2, FramedCompressor::LZW, 13, 6 },
+  { "lzw",  3, FramedCompressor::LZW, 16, 6 },
+  { "auto", 1, FramedCompressor::AUTO, 0, 0 }
+};
+
+const size_t Benchmark::NUM_LEVELS = sizeof(Benchmark::LEVELS)/sizeof(Benchmark::LEVELS[0]);
+
+#endif
@@ -0,0 +1,21 @@
+/**
+ * @file BitBufferReader.hpp
+ * @brief File including the definition of BitBufferReader type.
+ */
+
+#ifndef __BITBUFFERREADER_HPP__
+#define __BITBUFFERREADER_HPP__
+
+#include <BitReader.hpp>
+#include <ByteSource.hpp>
+
+/**
+ * @brief Bit reader from a caller-provided buffer.
+ *
+ * Trying to read past the end of the buffer sets the eof state and good()
+ * returns false.
+ * @see BitReader
+ */
+typedef BitReader<SpanSource> BitBufferReader;
+
+#endif
@@ -0,0 +1,21 @@
+/**
+ * @file BitBufferWriter.hpp
+ * @brief File including the definition of BitBufferWriter type.
+ */
+
+#ifndef __BITBUFFERWRITER_HPP__
+#define __BITBUFFERWRITER_HPP__
+
+#include <BitWriter.hpp>
+#include <ByteSink.hpp>
+
+/**
+ * @brief Bit writer to a caller-provided buffer of fixed capacity.
+ *
+ * When the buffer runs out of space, the writer enters a failed state and
+ * good() returns false.
+ * @see BitWriter
+ */
+typedef BitWriter<SpanSink> BitBufferWriter;
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * @file BitReader.hpp
+ * @brief File including the implementation of BitReader class.
+ */
+
+#ifndef __BITREADER_HPP__
+#define __BITREADER_HPP__
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <utility>
+#include <Bit.hpp>
+#include <ByteSource.hpp>
+
+/**
+ * @class BitReader
+ * @brief This class implements a bit reader from a byte source.
+ *
+ * It provides the same interface as BitStreamReader, but it has no virtual
+ * methods: the source (see ByteSource.hpp) is a template parameter, so the
+ * decompressors instantiated with it inline the whole input path, whether the
+ * bits come from a memory buffer or a mapped file (SpanSource), a file
+ * descriptor (FdSource) or a std::istream (StreamSource). Trying to read past
+ * the end of the source sets the eof state and good() returns false.
+ * @see BitStreamReader
+ */
+template <typename Source>
+class BitReader {
+private:
+  /** Origin of the bytes. */
+  Source source;
+  /** Bit buffer. The next bit to read is the most significant one. */
+  uint64_t bit_buffer;
+  /** Number of bits not read yet in the bit buffer. */
+  unsigned bits_left;
+  /** Number of read symbols since the last input operation. */
+  size_t last_read;
+  /** Whether the end of the source was reached. */
+  bool end;
+
+  /** Non-copyable. */
+  BitReader(const BitReader&);
+  /** Non-copyable. */
+  BitReader& operator = (const BitReader&);
+
+  /**
+   * @brief Loads whole bytes from the source into the bit buffer, so that it
+   * holds at least 57 bits (unless the source ends).
+   *
+   * Away from the end of the source, 8 bytes are loaded at once as a
+   * big-endian word. The bits of the word that do not fit in a whole byte are
+   * or'ed in too, but they are the same bits the next refill will load.
+   */
+  void refill()
+  {
+    while ( source.available() < 8 && source.fill() ) { }
+    const char * p = source.data();
+    if ( source.available() >= 8 ) {
+      uint64_t v;
+      memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      v = __builtin_bswap64(v);
+#endif
+      bit_buffer |= v >> bits_left;
+      unsigned bytes = (64-bits_left) >> 3;
+      source.consume(bytes);
+      bits_left += bytes*8;
+    } else {
+      size_t i = 0, n = source.available();
+      for(; bits_left <= 56 && i < n; ++i) {
+	bit_buffer |= (uint64_t)(unsigned char)p[i] << (56-bits_left);
+	bits_left += 8;
+      }
+      source.consume(i);
+    }
+  }
+
+  /**
+   * @brief Reads a given number of bits when the bit buffer does not hold
+   * them, refilling it.
+   * @see get(unsigned char)
+   */
+  size_t getSlow(unsigned char bits)
+  {
+    if ( bits > 56 ) {
+      /* More bits than a refill guarantees. */
+      size_t high = get(bits-32);
+      if ( end ) return (uint64_t)high << 32;
+      return ((uint64_t)high << 32) | get(32);
+    }
+    if ( end ) return 0;
+
+    refill();
+    if ( bits_left < bits ) {
+      size_t res = (bits_left > 0 ? (size_t)(bit_buffer >> (64-bits_left)) << (bits-bits_left) : 0);
+      bit_buffer = 0;
+      bits_left = 0;
+      last_read = 0;
+      end = true;
+      return res;
+    }
+    return get(bits);
+  }
+
+public:
+  /**
+   * @brief Constructor.
+   * The arguments are passed to the constructor of the source, i.e.
+   * BitReader<SpanSource> bis(src, n) or BitReader<StreamSource> bis(input).
+   */
+  template <typename... Args>
+  explicit BitReader(Args&&... args)
+    : source(std::forward<Args>(args)...), bit_buffer(0), bits_left(0), last_read(0), end(false)
+  { }
+
+  /**
+   * @brief Reads a single bit.
+   * @return read bit.
+   * @see BitStreamReader::get()
+   */
+  Bit get()
+  {
+    last_read = 0;
+    if ( bits_left == 0 ) {
+      refill();
+      if ( bits_left == 0 ) { end = true; return 0; }
+    }
+
+    Bit v((char)(bit_buffer >> 63));
+    bit_buffer <<= 1;
+    --bits_left;
+    last_read = 1;
+    return v;
+  }
+
+  /**
+   * @brief Reads a given number of bits. The read chunk of bits is
+   * interpreted as a size_t unsigned number.
+   *
+   * If the source ends in the middle, the bits read are returned in their
+   * possitions and the rest are zero.
+   * @param bits number of bits to read.
+   * @return read value.
+   * @see get()
+   */
+  size_t get(unsigned char bits)
+  {
+    assert(bits >= 1 && (unsigned)bits <= BYTES2BITS(sizeof(size_t)));
+    if ( bits_left >= bits && bits < 64 ) {
+      size_t res = (size_t)(bit_buffer >> (64-bits));
+      bit_buffer <<= bits;
+      bits_left -= bits;
+      last_read = 1;
+      return res;
+    }
+    return getSlow(bits);
+  }
+
+  /**
+   * @brief Determines whether all the input operations were successful.
+   * @return false if the end of the source was reached, true otherwise.
+   */
+  bool good() const
+  { return !end; }
+
+  /**
+   * @brief Determines whether the end of the source was reached.
+   * @return true if a read past the end of the source was attempted.
+   */
+  bool eof() const
+  { return end; }
+
+  /**
+   * @brief Retrieves the number of read bits in the last input operation.
+   * @return number of read bits in the last input operation.
+   */
+  size_t gcount() const
+  { return last_read; }
+
+  /**
+   * @brief Returns the number of bytes consumed from the source.
+   * @return number of bytes consumed.
+   */
+  size_t tell() const
+  { return source.tell() - bits_left/8; }
+
+  /**
+   * @brief Returns the source.
+   */
+  Source& getSource()
+  { return source; }
+};
+
+#endif
@@ -81,8 +81,8 @@ public:
   {
     assert(bits >= 1 && (unsigned)bits <= BYTES2BITS(sizeof(size_t)));
     size_t res = 0x00;
-    for(--bits; bits >= 0 && good(); --bits)
-      res |= (get() << bits);
+    for(int b = bits-1; b >= 0 && good(); --b)
+      res |= ((size_t)get() << b);
     return res;
   }
 
@@ -0,0 +1,184 @@
+/**
+ * @file BitWriter.hpp
+ * @brief File including the implementation of BitWriter class.
+ */
+
+#ifndef __BITWRITER_HPP__
+#define __BITWRITER_HPP__
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <utility>
+#include <Bit.hpp>
+#include <ByteSink.hpp>
+
+/**
+ * @class BitWriter
+ * @brief This class implements a bit writer to a byte sink.
+ *
+ * It provides the same interface as BitStreamWriter, but it has no virtual
+ * methods: the sink (see ByteSink.hpp) is a template parameter, so the
+ * compressors instantiated with it inline the whole output path, whether the
+ * bits go to a memory buffer (SpanSink), a growable vector (VectorSink), a
+ * file descriptor (FdSink) or a std::ostream (StreamSink).
+ *
+ * The bits are gathered in a 64-bit buffer and handed to the sink 32 at a
+ * time. When the sink fails, i.e. a SpanSink runs out of space, good()
+ * returns false.
+ * @see BitStreamWriter
+ */
+template <typename Sink>
+class BitWriter {
+private:
+  /** Definition of byte. */
+  typedef char byte;
+  /** Destination of the bytes. */
+  Sink sink;
+  /** Bit buffer. The last bits_used bits are pending, the oldest one first. */
+  uint64_t bit_buffer;
+  /** Number of bits pending in the bit buffer (less than 32 between calls). */
+  unsigned bits_used;
+
+  /** Non-copyable. */
+  BitWriter(const BitWriter&);
+  /** Non-copyable. */
+  BitWriter& operator = (const BitWriter&);
+
+  /** Hands the oldest 32 bits of the bit buffer to the sink. */
+  void putWord()
+  {
+    uint32_t w = (uint32_t)(bit_buffer >> (bits_used-32));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    w = __builtin_bswap32(w);
+#endif
+    byte b[4];
+    memcpy(b, &w, 4);
+    sink.write(b, 4);
+    bits_used -= 32;
+  }
+
+public:
+  /**
+   * @brief Constructor.
+   * The arguments are passed to the constructor of the sink, i.e.
+   * BitWriter<SpanSink> bos(dst, cap) or BitWriter<StreamSink> bos(output).
+   */
+  template <typename... Args>
+  explicit BitWriter(Args&&... args)
+    : sink(std::forward<Args>(args)...), bit_buffer(0), bits_used(0)
+  { }
+
+  /**
+   * @brief Writes a bit.
+   *
+   * WARNING: It is important to use the flush() method to ensure that all bits
+   * are written after the last output operation.
+   * @param d bit to be written.
+   * @return This method returns *this.
+   * @see flush()
+   */
+  BitWriter& put(const Bit& d)
+  {
+    bit_buffer = (bit_buffer << 1) | (char)d;
+    if ( ++bits_used == 32 ) putWord();
+    return *this;
+  }
+
+  /**
+   * @brief Writes a size_t number using a given number of bits.
+   * @param val value to be written.
+   * @param bits number of bits to use.
+   * @return This method returns *this.
+   * @see put()
+   * @see flush()
+   */
+  BitWriter& put(const size_t val, int8_t bits)
+  {
+    assert(bits >= 1 && (unsigned)bits <= BYTES2BITS(sizeof(size_t)));
+    if ( bits > 32 ) {
+      put((size_t)((uint64_t)val >> 32), bits-32);
+      bits = 32;
+    }
+    bit_buffer = (bit_buffer << bits) | ((uint64_t)val & (~(uint64_t)0 >> (64-bits)));
+    bits_used += bits;
+    if ( bits_used >= 32 ) putWord();
+    return *this;
+  }
+
+  /**
+   * @brief Writes a sequence of bits.
+   * @param vec bits sequence to be written.
+   * @param n number of bits in the sequence.
+   * @return This method returns *this.
+   * @see put()
+   * @see flush()
+   */
+  BitWriter& write(const Bit * vec, size_t n)
+  {
+    for(size_t i = 0; i < n; ++i)
+      put(vec[i]);
+    return *this;
+  }
+
+  /**
+   * @brief Writes a sequence of bytes.
+   * @param vec bytes sequence to be written.
+   * @param n number of bytes in the sequence.
+   * @return This method returns *this.
+   * @see put()
+   * @see flush()
+   */
+  BitWriter& write(const byte * vec, size_t n)
+  {
+    for(size_t i = 0; i < n; ++i)
+      put((unsigned char)vec[i], 8);
+    return *this;
+  }
+
+  /**
+   * @brief Forces the pending bits to be written and flushes the sink.
+   *
+   * As in BitStreamWriter::flush(), the last byte is padded, here with zeros.
+   * @return This method returns *this.
+   */
+  BitWriter& flush(void)
+  {
+    for(; bits_used >= 8; bits_used -= 8) {
+      byte b = (byte)(bit_buffer >> (bits_used-8));
+      sink.write(&b, 1);
+    }
+    if ( bits_used > 0 ) {
+      byte b = (byte)(bit_buffer << (8-bits_used));
+      sink.write(&b, 1);
+      bits_used = 0;
+    }
+    bit_buffer = 0;
+    sink.flush();
+    return *this;
+  }
+
+  /**
+   * @brief Determines whether all the output operations were successful.
+   * @return false if the sink failed (i.e. the buffer ran out of space), true otherwise.
+   */
+  bool good() const
+  { return sink.good(); }
+
+  /**
+   * @brief Returns the number of bytes handed to the sink. Up to 3 bytes
+   * are pending until flush() is called.
+   * @return number of bytes written.
+   */
+  size_t size() const
+  { return sink.size(); }
+
+  /**
+   * @brief Returns the sink.
+   */
+  Sink& getSink()
+  { return sink; }
+};
+
+#endif
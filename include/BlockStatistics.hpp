@@ -0,0 +1,100 @@
+/**
+ * @file BlockStatistics.hpp
+ * @brief File including the implementation of BlockStatistics class.
+ */
+
+#ifndef __BLOCKSTATISTICS_HPP__
+#define __BLOCKSTATISTICS_HPP__
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+#include <CpuDispatch.hpp>
+
+/**
+ * @class BlockStatistics
+ * @brief Cheap statistics of a block of data, estimated from a sample.
+ *
+ * They are used to guess which compressor will perform best on the block
+ * without compressing it with every compressor.
+ */
+class BlockStatistics {
+public:
+  /** Size of each sampled chunk, in bytes. */
+  static const size_t CHUNK_SIZE = (1 << 14);
+  /** Number of chunks sampled from big blocks. */
+  static const size_t NUM_CHUNKS = 4;
+
+  /** Order-0 entropy of the sample, in bits per byte. */
+  double entropy;
+  /** Fraction of positions of the sample where a 4-byte match was found. */
+  double match_density;
+
+private:
+  /** Number of bits of the hash table used to find matches. */
+  static const int HASH_BITS = 12;
+
+  /**
+   * @brief Adds a chunk to the statistics.
+   * @param p chunk.
+   * @param n size of the chunk, in bytes.
+   * @param histogram histogram of bytes.
+   * @param matches number of positions where a match was found.
+   * @param probes number of probed positions.
+   */
+  static void addChunk(const unsigned char * p, size_t n, size_t * histogram,
+		       size_t& matches, size_t& probes)
+  {
+    CpuDispatch::histogram(p, n, histogram);
+
+    /* Every position is looked up in a hash table of the last position where
+       its next 4 bytes were seen. A hit is a match an LZ compressor could use. */
+    uint32_t last[1 << HASH_BITS];
+    memset(last, 0xFF, sizeof(last));
+    for(size_t i = 0; i+4 <= n; ++i) {
+      uint32_t v;
+      memcpy(&v, p+i, 4);
+      uint32_t h = (v*2654435761u) >> (32-HASH_BITS);
+      if ( last[h] != 0xFFFFFFFF && !memcmp(p+last[h], p+i, 4) ) matches++;
+      last[h] = i;
+    }
+    if ( n >= 4 ) probes += n-3;
+  }
+
+public:
+  /**
+   * @brief Estimates the statistics of a block.
+   *
+   * Small blocks are analyzed completely. From big blocks only NUM_CHUNKS
+   * chunks, evenly spaced, are analyzed.
+   * @param data block.
+   * @param n size of the block, in bytes.
+   */
+  BlockStatistics(const void * data, size_t n)
+  {
+    const unsigned char * p = (const unsigned char *)data;
+    size_t histogram[256] = { 0 };
+    size_t matches = 0, probes = 0, sampled = 0;
+
+    if ( n <= NUM_CHUNKS*CHUNK_SIZE ) {
+      addChunk(p, n, histogram, matches, probes);
+      sampled = n;
+    } else {
+      size_t step = (n-CHUNK_SIZE)/(NUM_CHUNKS-1);
+      for(size_t i = 0; i < NUM_CHUNKS; ++i)
+	addChunk(p+i*step, CHUNK_SIZE, histogram, matches, probes);
+      sampled = NUM_CHUNKS*CHUNK_SIZE;
+    }
+
+    entropy = 0.0;
+    for(int i = 0; i < 256; ++i) {
+      if ( histogram[i] == 0 ) continue;
+      double q = (double)histogram[i]/sampled;
+      entropy -= q*std::log2(q);
+    }
+    match_density = (probes > 0 ? (double)matches/probes : 0.0);
+  }
+};
+
+#endif
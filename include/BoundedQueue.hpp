@@ -0,0 +1,117 @@
+/**
+ * @file BoundedQueue.hpp
+ * @brief File including the implementation of BoundedQueue class.
+ */
+
+#ifndef __BOUNDEDQUEUE_HPP__
+#define __BOUNDEDQUEUE_HPP__
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * @class BoundedQueue
+ * @brief Bounded blocking queue for several producers and consumers.
+ *
+ * Unlike SPSCQueue, the threads sleep on condition variables while the queue
+ * is full or empty, which suits queues of jobs that may stay idle for long.
+ * A full queue blocks the producers, so it provides backpressure. Once the
+ * queue is closed, nothing else can be pushed and the consumers get the
+ * elements left until it is empty.
+ */
+template <typename T>
+class BoundedQueue {
+private:
+  /** Elements of the queue. */
+  std::deque<T> items;
+  /** Maximum number of elements. */
+  size_t capacity;
+  /** Whether the queue is closed. */
+  bool closed;
+  std::mutex mutex;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+
+  /** Non-copyable. */
+  BoundedQueue(const BoundedQueue&);
+  /** Non-copyable. */
+  BoundedQueue& operator = (const BoundedQueue&);
+
+public:
+  /**
+   * @brief Constructor.
+   * @param cap maximum number of elements in the queue (at least 1).
+   */
+  explicit BoundedQueue(size_t cap)
+    : capacity(cap > 0 ? cap : 1), closed(false)
+  { }
+
+  /**
+   * @brief Adds an element at the end of the queue, waiting while it is full.
+   * @param v element to be added.
+   * @return false if the queue is closed, true otherwise.
+   */
+  bool push(const T& v)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while ( !closed && items.size() >= capacity ) not_full.wait(lock);
+    if ( closed ) return false;
+    items.push_back(v);
+    not_empty.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Tries to add an element at the end of the queue.
+   * @param v element to be added.
+   * @return false if the queue is full or closed, true otherwise.
+   */
+  bool try_push(const T& v)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if ( closed || items.size() >= capacity ) return false;
+    items.push_back(v);
+    not_empty.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Removes the element at the front of the queue, waiting while it is empty.
+   * @param[out] v removed element.
+   * @return false if the queue is closed and empty, true otherwise.
+   */
+  bool pop(T& v)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while ( !closed && items.empty() ) not_empty.wait(lock);
+    if ( items.empty() ) return false;
+    v = items.front();
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Closes the queue and wakes up all the threads waiting on it.
+   */
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+
+  /**
+   * @brief Returns the number of elements in the queue.
+   */
+  size_t size()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return items.size();
+  }
+};
+
+#endif
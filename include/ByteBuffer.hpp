@@ -0,0 +1,171 @@
+/**
+ * @file ByteBuffer.hpp
+ * @brief File including the implementation of ByteBufferReader and ByteBufferWriter classes.
+ */
+
+#ifndef __BYTEBUFFER_HPP__
+#define __BYTEBUFFER_HPP__
+
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+
+/**
+ * @class ByteBufferReader
+ * @brief This class reads bytes from a memory buffer.
+ *
+ * It mimics the subset of std::istream used by the compressors (read(),
+ * gcount() and good()), so that the same compression code can be used to
+ * read from a stream or directly from a buffer. As with a stream, good()
+ * becomes false after a read operation could not be completely satisfied.
+ */
+class ByteBufferReader {
+private:
+  /** Source buffer. */
+  const char * buffer;
+  /** Size of the source buffer. */
+  size_t length;
+  /** Possition of the next byte to read. */
+  size_t pos;
+  /** Number of bytes read in the last input operation. */
+  size_t last_read;
+  /** Whether the end of the buffer was reached. */
+  bool end;
+
+public:
+  /**
+   * @brief Constructor.
+   * @param src source buffer.
+   * @param n size of the source buffer, in bytes.
+   */
+  ByteBufferReader(const void * src, size_t n)
+    : buffer((const char *)src), length(n), pos(0), last_read(0), end(false)
+  { }
+
+  /**
+   * @brief Reads a block of bytes from the buffer.
+   * @param vec destination of the read bytes.
+   * @param n number of bytes to read.
+   * @return This method returns *this.
+   */
+  ByteBufferReader& read(char * vec, size_t n)
+  {
+    last_read = std::min(n, length-pos);
+    memcpy(vec, buffer+pos, last_read);
+    pos += last_read;
+    if ( last_read < n ) end = true;
+    return *this;
+  }
+
+  /**
+   * @brief Takes a block of bytes from the buffer, without copying them.
+   * @param n number of bytes to take.
+   * @return pointer to the bytes in the buffer; gcount() returns how many there are.
+   */
+  const char * take(size_t n)
+  {
+    const char * p = buffer+pos;
+    last_read = std::min(n, length-pos);
+    pos += last_read;
+    if ( last_read < n ) end = true;
+    return p;
+  }
+
+  /**
+   * @brief Retrieves the number of bytes read in the last input operation.
+   * @return number of bytes read.
+   */
+  size_t gcount() const
+  { return last_read; }
+
+  /**
+   * @brief Determines whether all the input operations were successful.
+   * @return false if a read operation reached the end of the buffer.
+   */
+  bool good() const
+  { return !end; }
+};
+
+/**
+ * @class ByteBufferWriter
+ * @brief This class writes bytes to a memory buffer of fixed capacity.
+ *
+ * It mimics the subset of std::ostream used by the decompressors (put(),
+ * write() and good()). When the buffer runs out of space, the writer enters
+ * a failed state and good() returns false.
+ */
+class ByteBufferWriter {
+private:
+  /** Destination buffer. */
+  char * buffer;
+  /** Capacity of the destination buffer. */
+  size_t capacity;
+  /** Number of bytes written. */
+  size_t written;
+  /** Whether all the output operations were successful. */
+  bool ok;
+
+public:
+  /**
+   * @brief Constructor.
+   * @param dst destination buffer.
+   * @param cap capacity of the destination buffer, in bytes.
+   */
+  ByteBufferWriter(void * dst, size_t cap)
+    : buffer((char *)dst), capacity(cap), written(0), ok(true)
+  { }
+
+  /**
+   * @brief Writes a byte to the buffer.
+   * @param c byte to be written.
+   * @return This method returns *this.
+   */
+  inline ByteBufferWriter& put(char c)
+  {
+    if ( written < capacity ) buffer[written++] = c;
+    else ok = false;
+    return *this;
+  }
+
+  /**
+   * @brief Writes a block of bytes to the buffer.
+   * @param vec bytes to be written.
+   * @param n number of bytes to be written.
+   * @return This method returns *this.
+   */
+  inline ByteBufferWriter& write(const char * vec, size_t n)
+  {
+    if ( n > capacity-written ) { ok = false; return *this; }
+    memcpy(buffer+written, vec, n);
+    written += n;
+    return *this;
+  }
+
+  /**
+   * @brief Reserves space at the end of the buffer, to be written in place.
+   * @param n number of bytes to reserve.
+   * @return pointer to the reserved space, or NULL if the buffer ran out of space.
+   */
+  inline char * append(size_t n)
+  {
+    if ( n > capacity-written ) { ok = false; return 0; }
+    written += n;
+    return buffer+written-n;
+  }
+
+  /**
+   * @brief Determines whether all the output operations were successful.
+   * @return false if the buffer ran out of space, true otherwise.
+   */
+  bool good() const
+  { return ok; }
+
+  /**
+   * @brief Returns the number of bytes written to the buffer.
+   * @return number of bytes written.
+   */
+  size_t size() const
+  { return written; }
+};
+
+#endif
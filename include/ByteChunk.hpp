@@ -11,6 +11,8 @@
 #include <cstring>
 #include <cassert>
 
+#include <MemoryAccount.hpp>
+
 /**
  * @class ByteChunk
  * @brief This class manages a chunk of bytes. This is a personalized
@@ -26,12 +28,13 @@ class ByteChunk {
 
   /**
    * @brief This allocates the space for the chunk.
+   * std::bad_alloc is thrown if there is no memory.
    * @param capacity number of bytes to be allocated.
    */
   inline void _allocate ( size_t capacity )
   {
     if ( capacity > 0 )
-      assert ( (_chunk = new char [(_capacity = capacity)]) != NULL );
+      _chunk = (char *)MemoryAccount::allocate((_capacity = capacity));
   }
 
   /**
@@ -172,7 +175,7 @@ public:
    * @brief Frees memory allocated.
    */
   inline void clear ( )
-  { if ( _capacity > 0 ) { delete [] _chunk; _size = _capacity = 0; } }
+  { if ( _capacity > 0 ) { MemoryAccount::deallocate(_chunk); _size = _capacity = 0; } }
 
   /**
    * @brief Changes the chunk size.
@@ -191,7 +194,7 @@ public:
       _allocate(n);
       _copy(old_chunk, _capacity);
       memset(_chunk+_capacity, 0x00, n-_capacity);
-      delete [] old_chunk;
+      MemoryAccount::deallocate(old_chunk);
     }
   }
 
@@ -210,7 +213,7 @@ public:
       char * old_chunk = _chunk;
       _allocate(n);
       _copy(old_chunk, _capacity);
-      delete [] old_chunk;
+      MemoryAccount::deallocate(old_chunk);
     } else _size = std::min(_size,n);
   }
 
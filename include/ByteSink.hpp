@@ -0,0 +1,250 @@
+/**
+ * @file ByteSink.hpp
+ * @brief File including the implementation of the byte sinks of BitWriter.
+ */
+
+#ifndef __BYTESINK_HPP__
+#define __BYTESINK_HPP__
+
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <unistd.h>
+
+/*
+ * A sink receives the bytes of a BitWriter. It is a plain class, so that the
+ * writer can be instantiated with it and the whole output path inlined:
+ *
+ *   bool write(const char * p, size_t n);  appends n bytes.
+ *   bool flush();                          delivers the buffered bytes, if any.
+ *   bool good() const;                     whether every write succeeded.
+ *   size_t size() const;                   number of bytes written so far.
+ */
+
+/**
+ * @class SpanSink
+ * @brief Writes the bytes to a memory buffer of fixed capacity.
+ *
+ * When the buffer runs out of space the sink enters a failed state.
+ */
+class SpanSink {
+private:
+  /** Destination buffer. */
+  char * buffer;
+  /** Capacity of the destination buffer, in bytes. */
+  size_t capacity;
+  /** Number of bytes written to the destination buffer. */
+  size_t written;
+  /** Whether all the output operations were successful. */
+  bool ok;
+
+public:
+  /**
+   * @brief Constructor.
+   * @param dst destination buffer.
+   * @param cap capacity of the destination buffer, in bytes.
+   */
+  SpanSink(void * dst, size_t cap)
+    : buffer((char *)dst), capacity(cap), written(0), ok(true)
+  { }
+
+  bool write(const char * p, size_t n)
+  {
+    if ( capacity - written < n ) return (ok = false);
+    memcpy(buffer+written, p, n);
+    written += n;
+    return true;
+  }
+
+  bool flush()
+  { return ok; }
+
+  bool good() const
+  { return ok; }
+
+  size_t size() const
+  { return written; }
+};
+
+/**
+ * @class VectorSink
+ * @brief Appends the bytes to a std::vector, which grows as needed.
+ */
+class VectorSink {
+private:
+  /** Destination vector. */
+  std::vector<char>& vec;
+  /** Size of the vector when the sink was created. */
+  size_t start;
+
+public:
+  /**
+   * @brief Constructor.
+   * @param v vector the bytes are appended to.
+   */
+  explicit VectorSink(std::vector<char>& v)
+    : vec(v), start(v.size())
+  { }
+
+  bool write(const char * p, size_t n)
+  {
+    vec.insert(vec.end(), p, p+n);
+    return true;
+  }
+
+  bool flush()
+  { return true; }
+
+  bool good() const
+  { return true; }
+
+  size_t size() const
+  { return vec.size() - start; }
+};
+
+/**
+ * @class FdSink
+ * @brief Writes the bytes to a file descriptor through a buffer.
+ *
+ * The buffer is written with write() when it fills up and on flush(), which
+ * must be called after the last output operation.
+ */
+class FdSink {
+private:
+  /** File descriptor. */
+  int fd;
+  /** Buffer. */
+  std::vector<char> buffer;
+  /** Number of bytes in the buffer. */
+  size_t used;
+  /** Number of bytes delivered to the file descriptor. */
+  size_t written;
+  /** Whether all the output operations were successful. */
+  bool ok;
+
+  /** Writes the whole buffer to the file descriptor. */
+  bool drain()
+  {
+    size_t done = 0;
+    while ( ok && done < used ) {
+      ssize_t r = ::write(fd, &buffer[done], used-done);
+      if ( r < 0 && errno == EINTR ) continue;
+      if ( r <= 0 ) ok = false;
+      else done += r;
+    }
+    written += done;
+    used = 0;
+    return ok;
+  }
+
+public:
+  /**
+   * @brief Constructor.
+   * @param d file descriptor, open for writing. It is not closed.
+   * @param buffer_size size of the buffer, in bytes.
+   */
+  explicit FdSink(int d, size_t buffer_size = 1 << 16)
+    : fd(d), buffer(buffer_size > 0 ? buffer_size : 1), used(0), written(0), ok(true)
+  { }
+
+  bool write(const char * p, size_t n)
+  {
+    if ( buffer.size() - used >= n ) {
+      memcpy(&buffer[used], p, n);
+      used += n;
+      return ok;
+    }
+    while ( n > 0 && ok ) {
+      size_t c = std::min(n, buffer.size() - used);
+      memcpy(&buffer[used], p, c);
+      used += c; p += c; n -= c;
+      if ( used == buffer.size() ) drain();
+    }
+    return ok;
+  }
+
+  bool flush()
+  { return drain(); }
+
+  bool good() const
+  { return ok; }
+
+  size_t size() const
+  { return written + used; }
+};
+
+/**
+ * @class StreamSink
+ * @brief Writes the bytes to a std::ostream through a buffer.
+ *
+ * The bytes are handed to the stream buffer in blocks, so the sentry and the
+ * virtual calls of the stream are paid once per block instead of once per
+ * byte. As with BitStreamWriter, the state of the stream itself is not
+ * changed; flush() must be called after the last output operation.
+ */
+class StreamSink {
+private:
+  /** Stream buffer of the output stream. */
+  std::streambuf * sb;
+  /** Buffer. */
+  std::vector<char> buffer;
+  /** Number of bytes in the buffer. */
+  size_t used;
+  /** Number of bytes delivered to the stream. */
+  size_t written;
+  /** Whether all the output operations were successful. */
+  bool ok;
+
+  /** Writes the whole buffer to the stream. */
+  bool drain()
+  {
+    if ( ok && used > 0 && sb->sputn(&buffer[0], used) != (std::streamsize)used ) ok = false;
+    written += used;
+    used = 0;
+    return ok;
+  }
+
+public:
+  /**
+   * @brief Constructor.
+   * @param out output stream.
+   * @param buffer_size size of the buffer, in bytes.
+   */
+  explicit StreamSink(std::ostream& out, size_t buffer_size = 1 << 16)
+    : sb(out.rdbuf()), buffer(buffer_size > 0 ? buffer_size : 1), used(0), written(0),
+      ok(sb != 0)
+  { }
+
+  bool write(const char * p, size_t n)
+  {
+    if ( buffer.size() - used >= n ) {
+      memcpy(&buffer[used], p, n);
+      used += n;
+      return ok;
+    }
+    while ( n > 0 && ok ) {
+      size_t c = std::min(n, buffer.size() - used);
+      memcpy(&buffer[used], p, c);
+      used += c; p += c; n -= c;
+      if ( used == buffer.size() ) drain();
+    }
+    return ok;
+  }
+
+  bool flush()
+  {
+    if ( drain() && sb->pubsync() == -1 ) ok = false;
+    return ok;
+  }
+
+  bool good() const
+  { return ok; }
+
+  size_t size() const
+  { return written + used; }
+};
+
+#endif
@@ -0,0 +1,183 @@
+/**
+ * @file ByteSource.hpp
+ * @brief File including the implementation of the byte sources of BitReader.
+ */
+
+#ifndef __BYTESOURCE_HPP__
+#define __BYTESOURCE_HPP__
+
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <istream>
+#include <unistd.h>
+
+/*
+ * A source provides the bytes of a BitReader. The reader takes them straight
+ * from a window of bytes the source already holds, so a plain memory buffer
+ * costs no copy:
+ *
+ *   const char * data() const;  next bytes not consumed yet.
+ *   size_t available() const;   number of bytes at data().
+ *   void consume(size_t n);     n bytes (at most available()) were read.
+ *   bool fill();                makes more bytes available; false at the end.
+ *   size_t tell() const;        number of bytes consumed so far.
+ */
+
+/**
+ * @class SpanSource
+ * @brief Reads the bytes from a memory buffer (i.e. a mapped file).
+ */
+class SpanSource {
+private:
+  /** Source buffer. */
+  const char * buffer;
+  /** Size of the source buffer, in bytes. */
+  size_t length;
+  /** Possition of the next byte to read. */
+  size_t pos;
+
+public:
+  /**
+   * @brief Constructor.
+   * @param src source buffer.
+   * @param n size of the source buffer, in bytes.
+   */
+  SpanSource(const void * src, size_t n)
+    : buffer((const char *)src), length(n), pos(0)
+  { }
+
+  const char * data() const
+  { return buffer + pos; }
+
+  size_t available() const
+  { return length - pos; }
+
+  void consume(size_t n)
+  { pos += n; }
+
+  bool fill()
+  { return false; }
+
+  size_t tell() const
+  { return pos; }
+};
+
+/**
+ * @class FdSource
+ * @brief Reads the bytes from a file descriptor through a buffer.
+ *
+ * The data is read ahead in blocks, so the file descriptor is left past the
+ * bytes consumed by the reader.
+ */
+class FdSource {
+private:
+  /** File descriptor. */
+  int fd;
+  /** Buffer. */
+  std::vector<char> buffer;
+  /** Possition of the next byte to read in the buffer. */
+  size_t pos;
+  /** Number of bytes in the buffer. */
+  size_t end;
+  /** Number of bytes consumed before the beginning of the buffer. */
+  size_t consumed;
+
+public:
+  /**
+   * @brief Constructor.
+   * @param d file descriptor, open for reading. It is not closed.
+   * @param buffer_size size of the buffer, in bytes.
+   */
+  explicit FdSource(int d, size_t buffer_size = 1 << 16)
+    : fd(d), buffer(buffer_size > 8 ? buffer_size : 8), pos(0), end(0), consumed(0)
+  { }
+
+  const char * data() const
+  { return &buffer[pos]; }
+
+  size_t available() const
+  { return end - pos; }
+
+  void consume(size_t n)
+  { pos += n; }
+
+  bool fill()
+  {
+    /* The bytes not consumed yet are moved to the beginning. */
+    memmove(&buffer[0], &buffer[pos], end-pos);
+    consumed += pos;
+    end -= pos;
+    pos = 0;
+    ssize_t r;
+    do r = ::read(fd, &buffer[end], buffer.size()-end);
+    while ( r < 0 && errno == EINTR );
+    if ( r <= 0 ) return false;
+    end += r;
+    return true;
+  }
+
+  size_t tell() const
+  { return consumed + pos; }
+};
+
+/**
+ * @class StreamSource
+ * @brief Reads the bytes from a std::istream through a buffer.
+ *
+ * The bytes are taken from the stream buffer in blocks, so the sentry and the
+ * virtual calls of the stream are paid once per block instead of once per
+ * byte. As with BitStreamReader, the state of the stream itself is not
+ * changed, but the stream is left past the bytes consumed by the reader.
+ */
+class StreamSource {
+private:
+  /** Stream buffer of the input stream. */
+  std::streambuf * sb;
+  /** Buffer. */
+  std::vector<char> buffer;
+  /** Possition of the next byte to read in the buffer. */
+  size_t pos;
+  /** Number of bytes in the buffer. */
+  size_t end;
+  /** Number of bytes consumed before the beginning of the buffer. */
+  size_t consumed;
+
+public:
+  /**
+   * @brief Constructor.
+   * @param in input stream.
+   * @param buffer_size size of the buffer, in bytes.
+   */
+  explicit StreamSource(std::istream& in, size_t buffer_size = 1 << 16)
+    : sb(in.rdbuf()), buffer(buffer_size > 8 ? buffer_size : 8), pos(0), end(0), consumed(0)
+  { }
+
+  const char * data() const
+  { return &buffer[pos]; }
+
+  size_t available() const
+  { return end - pos; }
+
+  void consume(size_t n)
+  { pos += n; }
+
+  bool fill()
+  {
+    if ( sb == 0 ) return false;
+    memmove(&buffer[0], &buffer[pos], end-pos);
+    consumed += pos;
+    end -= pos;
+    pos = 0;
+    std::streamsize r = sb->sgetn(&buffer[end], buffer.size()-end);
+    if ( r <= 0 ) return false;
+    end += r;
+    return true;
+  }
+
+  size_t tell() const
+  { return consumed + pos; }
+};
+
+#endif
@@ -0,0 +1,134 @@
+/**
+ * @file Checksum.hpp
+ * @brief File including the implementation of CRC32C class.
+ */
+
+#ifndef __CHECKSUM_HPP__
+#define __CHECKSUM_HPP__
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+#include <CpuDispatch.hpp>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define SCOMPRESSOR_HAVE_HW_CRC32C 1
+#endif
+
+/**
+ * @class CRC32C
+ * @brief Computes CRC-32C (Castagnoli) checksums.
+ *
+ * When the processor supports SSE4.2, the crc32 instruction is used to process
+ * 8 bytes per instruction. Otherwise, or when a lower level is forced (see
+ * CpuDispatch), a table-driven implementation is used. Both implementations
+ * give the same results.
+ */
+class CRC32C {
+private:
+  /**
+   * @class Table
+   * @brief Lookup table used by the software implementation.
+   */
+  struct Table {
+    /** Entries of the table. */
+    uint32_t v[256];
+    /** Builds the table. */
+    Table()
+    {
+      for(uint32_t i = 0; i < 256; ++i) {
+	uint32_t c = i;
+	for(int k = 0; k < 8; ++k)
+	  c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : (c >> 1);
+	v[i] = c;
+      }
+    }
+  };
+
+  /**
+   * @brief Software implementation.
+   * @param crc internal (non-inverted) state.
+   * @param p data.
+   * @param n size of the data, in bytes.
+   * @return new internal state.
+   */
+  static uint32_t updateSoftware(uint32_t crc, const unsigned char * p, size_t n)
+  {
+    static const Table table;
+    const uint32_t * t = table.v;
+    for(size_t i = 0; i < n; ++i)
+      crc = t[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+  }
+
+#ifdef SCOMPRESSOR_HAVE_HW_CRC32C
+  /**
+   * @brief Hardware implementation, using the SSE4.2 crc32 instruction.
+   * @param crc internal (non-inverted) state.
+   * @param p data.
+   * @param n size of the data, in bytes.
+   * @return new internal state.
+   */
+  __attribute__((target("sse4.2")))
+  static uint32_t updateHardware(uint32_t crc, const unsigned char * p, size_t n)
+  {
+    uint64_t c = crc;
+    for(; n >= 8; n -= 8, p += 8) {
+      uint64_t v;
+      memcpy(&v, p, 8);
+      c = _mm_crc32_u64(c, v);
+    }
+    uint32_t c32 = (uint32_t)c;
+    for(; n > 0; --n, ++p)
+      c32 = _mm_crc32_u8(c32, *p);
+    return c32;
+  }
+#endif
+
+public:
+  /**
+   * @brief Returns whether the hardware implementation is used.
+   * @return true if SSE4.2 is available and not disabled, false otherwise.
+   */
+  static bool hardware()
+  {
+#ifdef SCOMPRESSOR_HAVE_HW_CRC32C
+    return CpuDispatch::level() >= CpuDispatch::SSE42;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Extends a checksum with more data.
+   *
+   * compute(a+b) == update(compute(a), b).
+   * @param crc checksum of the previous data (0 if there is no previous data).
+   * @param data data.
+   * @param n size of the data, in bytes.
+   * @return checksum of the previous data followed by the new data.
+   */
+  static uint32_t update(uint32_t crc, const void * data, size_t n)
+  {
+    const unsigned char * p = (const unsigned char *)data;
+#ifdef SCOMPRESSOR_HAVE_HW_CRC32C
+    if ( hardware() ) return ~updateHardware(~crc, p, n);
+#endif
+    return ~updateSoftware(~crc, p, n);
+  }
+
+  /**
+   * @brief Computes the checksum of a block of data.
+   * @param data data.
+   * @param n size of the data, in bytes.
+   * @return checksum.
+   */
+  static uint32_t compute(const void * data, size_t n)
+  {
+    return update(0, data, n);
+  }
+};
+
+#endif
@@ -0,0 +1,198 @@
+/**
+ * @file CompressorPool.hpp
+ * @brief File including the implementation of CompressorPool class.
+ */
+
+#ifndef __COMPRESSORPOOL_HPP__
+#define __COMPRESSORPOOL_HPP__
+
+#include <vector>
+#include <mutex>
+#include <functional>
+
+#include <GenericCompressor.hpp>
+#include <HuffmanCompressor.hpp>
+#include <LZ77Compressor.hpp>
+#include <LZ78Compressor.hpp>
+#include <LZWCompressor.hpp>
+#include <FramedCompressor.hpp>
+
+/**
+ * @class CompressorPool
+ * @brief Thread-safe pool of compressors ready to be reused.
+ *
+ * The compressors keep their windows, buffers and dictionaries between
+ * calls, so a worker that takes a compressor from the pool, compresses a
+ * message and gives it back does not allocate them again. A compressor is
+ * used by a single thread at a time; only taking and giving back compressors
+ * is synchronized.
+ *
+ * @code
+ * CompressorPool pool(FramedCompressor::LZW);
+ * ...
+ * CompressorPool::Lease compr(pool);   // in any worker thread
+ * size_t n = compr->compress(src, size, dst, cap);
+ * @endcode
+ */
+class CompressorPool {
+public:
+  /** Function that creates the compressors of the pool. */
+  typedef std::function<GenericCompressor * ()> Factory;
+
+  /**
+   * @class Lease
+   * @brief Takes a compressor from a pool and gives it back when it is destroyed.
+   */
+  class Lease {
+  private:
+    CompressorPool& pool;
+    GenericCompressor * compr;
+
+    Lease(const Lease&);
+    Lease& operator = (const Lease&);
+
+  public:
+    /**
+     * @brief Constructor.
+     * @param p pool the compressor is taken from.
+     */
+    Lease(CompressorPool& p) : pool(p), compr(p.acquire()) { }
+
+    /**
+     * @brief Destructor. The compressor is given back to the pool.
+     */
+    ~Lease()
+    { pool.release(compr); }
+
+    GenericCompressor * get() const
+    { return compr; }
+
+    GenericCompressor * operator -> () const
+    { return compr; }
+
+    GenericCompressor& operator * () const
+    { return *compr; }
+  };
+
+private:
+  /** Creates the compressors. */
+  Factory factory;
+  /** Maximum number of idle compressors kept (0 for no limit). */
+  size_t max_idle;
+  /** Resource of the memory of the compressors (NULL for the default one). */
+  MemoryResource * resource;
+  /** Idle compressors. */
+  std::vector<GenericCompressor *> idle;
+  /** Mutex of the idle compressors. */
+  std::mutex mutex;
+
+  CompressorPool(const CompressorPool&);
+  CompressorPool& operator = (const CompressorPool&);
+
+public:
+  /**
+   * @brief Creates a compressor.
+   * @param method FramedCompressor::HUFFMAN, LZ77, LZ78 or LZW for the plain
+   * compressors, or FramedCompressor::AUTO for the framed container.
+   * @return compressor.
+   */
+  static GenericCompressor * create(uint8_t method)
+  {
+    switch ( method ) {
+    case FramedCompressor::HUFFMAN: return new HuffmanCompressor();
+    case FramedCompressor::LZ77: return new LZ77Compressor();
+    case FramedCompressor::LZ78: return new LZ78Compressor();
+    case FramedCompressor::LZW: return new LZWCompressor();
+    default: return new FramedCompressor(method);
+    }
+  }
+
+  /**
+   * @brief Constructor.
+   * @param method method of the compressors (see create()).
+   * @param max number of idle compressors kept (0 for no limit). The
+   * compressors given back when there are already max idle are destroyed.
+   * @param r resource of the memory of the compressors (NULL for the default one).
+   */
+  CompressorPool(uint8_t method, size_t max = 0, MemoryResource * r = 0)
+    : factory(std::bind(&CompressorPool::create, method)), max_idle(max), resource(r)
+  { }
+
+  /**
+   * @brief Constructor.
+   * @param f function that creates the compressors (i.e. with other parameters).
+   * @param max number of idle compressors kept (0 for no limit).
+   * @param r resource of the memory of the compressors (NULL for the default one).
+   */
+  CompressorPool(const Factory& f, size_t max = 0, MemoryResource * r = 0)
+    : factory(f), max_idle(max), resource(r)
+  { }
+
+  /**
+   * @brief Destructor. The idle compressors are destroyed; the ones in use
+   * must have been given back.
+   */
+  ~CompressorPool()
+  { clear(); }
+
+  /**
+   * @brief Takes a compressor from the pool, or creates one if there is
+   * none idle.
+   * @return compressor. It must be given back with release().
+   */
+  GenericCompressor * acquire()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if ( !idle.empty() ) {
+	GenericCompressor * compr = idle.back();
+	idle.pop_back();
+	return compr;
+      }
+    }
+    GenericCompressor * compr = factory();
+    if ( resource != 0 ) compr->setMemoryResource(resource);
+    return compr;
+  }
+
+  /**
+   * @brief Gives back a compressor taken with acquire().
+   * @param compr compressor (it may be NULL).
+   */
+  void release(GenericCompressor * compr)
+  {
+    if ( compr == 0 ) return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if ( max_idle == 0 || idle.size() < max_idle ) {
+	idle.push_back(compr);
+	return;
+      }
+    }
+    delete compr;
+  }
+
+  /**
+   * @brief Returns the number of idle compressors.
+   */
+  size_t size()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return idle.size();
+  }
+
+  /**
+   * @brief Destroys the idle compressors, freeing their memory.
+   */
+  void clear()
+  {
+    std::vector<GenericCompressor *> v;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      v.swap(idle);
+    }
+    for(size_t i = 0; i < v.size(); ++i) delete v[i];
+  }
+};
+
+#endif
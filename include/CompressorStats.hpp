@@ -0,0 +1,311 @@
+/**
+ * @file CompressorStats.hpp
+ * @brief File including the implementation of CompressorStats class.
+ */
+
+#ifndef __COMPRESSORSTATS_HPP__
+#define __COMPRESSORSTATS_HPP__
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @class CompressorStats
+ * @brief Per-phase timers and algorithm counters of a compressor.
+ *
+ * The compressors update them through the SCOMPRESSOR_STATS_* macros, which
+ * compile to nothing unless SCOMPRESSOR_STATS is defined. When it is defined,
+ * counters are always updated (they are just additions), but timers only run
+ * after enabled() is set, since reading the clocks is not free.
+ *
+ * Coarse phases (i.e. building a Huffman tree) measure wall and CPU time.
+ * Fine phases, timed once per token or per byte (i.e. a match search), only
+ * measure wall time, and they slow the compressor down while enabled.
+ *
+ * The memory usage is always reported, since it is kept by the MemoryAccount
+ * of the compressor anyway.
+ */
+class CompressorStats {
+public:
+  /** Phases of the compression and decompression. */
+  enum Phase { READ, HISTOGRAM, TREE_BUILD, MATCH_SEARCH, DICTIONARY_FILL, BIT_OUTPUT,
+	       DECODE, WRITE, NUM_PHASES };
+  /** Algorithm counters. */
+  enum Counter { LZ77_TOKENS, LZ77_LITERALS, LZ77_MATCHES, LZ77_MATCH_BYTES, LZ77_COMPARISONS,
+		 DICTIONARY_SIZE, DICTIONARY_HITS, DICTIONARY_MISSES, DICTIONARY_INSERTS,
+		 HUFFMAN_SYMBOLS, HUFFMAN_CODE_BITS, NUM_COUNTERS };
+
+private:
+  /** Value of the counters. */
+  uint64_t counters[NUM_COUNTERS];
+  /** Wall time of every phase, in nanoseconds. */
+  uint64_t wall_ns[NUM_PHASES];
+  /** CPU time of every phase, in nanoseconds. */
+  uint64_t cpu_ns[NUM_PHASES];
+  /** Number of times every phase was timed. */
+  uint64_t calls[NUM_PHASES];
+  /** Whether the CPU time of every phase was measured. */
+  bool cpu_measured[NUM_PHASES];
+  /** Bytes currently allocated. */
+  uint64_t memory_current;
+  /** Maximum number of bytes allocated at the same time. */
+  uint64_t memory_peak;
+  /** Number of allocations. */
+  uint64_t allocations;
+
+  /** Whether a counter keeps a maximum instead of a sum. */
+  static bool isMaximum(Counter c)
+  { return c == DICTIONARY_SIZE; }
+
+public:
+  /**
+   * @brief Returns the switch that enables the timers.
+   * @return reference to the switch (false by default).
+   */
+  static bool& enabled()
+  {
+    static bool on = false;
+    return on;
+  }
+
+  /**
+   * @brief Returns the CPU time of the calling thread, in nanoseconds.
+   */
+  static uint64_t cpuTime()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+  }
+
+  /**
+   * @brief Returns a monotonic wall time, in nanoseconds.
+   */
+  static uint64_t wallTime()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+      (std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /**
+   * @class Timer
+   * @brief Adds the time elapsed during its life to a phase.
+   */
+  class Timer {
+  private:
+    CompressorStats * stats;
+    Phase phase;
+    bool cpu;
+    uint64_t wall_start, cpu_start;
+  public:
+    /**
+     * @brief Constructor. It does nothing if the timers are not enabled.
+     * @param s statistics.
+     * @param p phase.
+     * @param measure_cpu whether the CPU time is measured too.
+     */
+    Timer(CompressorStats& s, Phase p, bool measure_cpu)
+      : stats(enabled() ? &s : 0), phase(p), cpu(measure_cpu), wall_start(0), cpu_start(0)
+    {
+      if ( stats == 0 ) return;
+      if ( cpu ) cpu_start = cpuTime();
+      wall_start = wallTime();
+    }
+
+    /**
+     * @brief Destructor. The elapsed time is added to the phase.
+     */
+    ~Timer()
+    {
+      if ( stats == 0 ) return;
+      uint64_t wall = wallTime()-wall_start;
+      stats->addTime(phase, wall, cpu ? cpuTime()-cpu_start : 0, cpu);
+    }
+  };
+
+  /**
+   * @brief Constructor.
+   */
+  CompressorStats()
+  { reset(); }
+
+  /**
+   * @brief Sets all the timers and counters to zero.
+   */
+  void reset()
+  {
+    std::fill(counters, counters+NUM_COUNTERS, 0);
+    std::fill(wall_ns, wall_ns+NUM_PHASES, 0);
+    std::fill(cpu_ns, cpu_ns+NUM_PHASES, 0);
+    std::fill(calls, calls+NUM_PHASES, 0);
+    std::fill(cpu_measured, cpu_measured+NUM_PHASES, false);
+    memory_current = memory_peak = allocations = 0;
+  }
+
+  /**
+   * @brief Adds a value to a counter.
+   */
+  inline void add(Counter c, uint64_t v)
+  { counters[c] += v; }
+
+  /**
+   * @brief Updates a counter that keeps a maximum.
+   */
+  inline void setMax(Counter c, uint64_t v)
+  { counters[c] = std::max(counters[c], v); }
+
+  /**
+   * @brief Returns the value of a counter.
+   */
+  uint64_t get(Counter c) const
+  { return counters[c]; }
+
+  /**
+   * @brief Sets the memory usage.
+   * @param current bytes currently allocated.
+   * @param peak maximum number of bytes allocated at the same time.
+   * @param n number of allocations.
+   */
+  void setMemory(uint64_t current, uint64_t peak, uint64_t n)
+  {
+    memory_current = current;
+    memory_peak = peak;
+    allocations = n;
+  }
+
+  /** Returns the bytes currently allocated. */
+  uint64_t getMemoryCurrent() const
+  { return memory_current; }
+
+  /** Returns the maximum number of bytes allocated at the same time. */
+  uint64_t getMemoryPeak() const
+  { return memory_peak; }
+
+  /** Returns the number of allocations. */
+  uint64_t getAllocations() const
+  { return allocations; }
+
+  /** Returns the wall time of a phase, in nanoseconds. */
+  uint64_t getWallTime(Phase p) const
+  { return wall_ns[p]; }
+
+  /** Returns the CPU time of a phase, in nanoseconds (0 if it was not measured). */
+  uint64_t getCpuTime(Phase p) const
+  { return cpu_ns[p]; }
+
+  /** Returns the number of times a phase was timed. */
+  uint64_t getCalls(Phase p) const
+  { return calls[p]; }
+
+  /**
+   * @brief Adds time to a phase.
+   * @param p phase.
+   * @param wall wall time, in nanoseconds.
+   * @param cpu CPU time, in nanoseconds.
+   * @param measured whether cpu was measured.
+   */
+  void addTime(Phase p, uint64_t wall, uint64_t cpu, bool measured)
+  {
+    wall_ns[p] += wall;
+    cpu_ns[p] += cpu;
+    cpu_measured[p] = cpu_measured[p] || measured;
+    ++calls[p];
+  }
+
+  /**
+   * @brief Adds the timers, counters and memory of other statistics to these.
+   *
+   * The peaks are added too, so the merged peak is an upper bound when the
+   * statistics belong to compressors that were not used at the same time.
+   */
+  void merge(const CompressorStats& s)
+  {
+    for(int c = 0; c < NUM_COUNTERS; ++c) {
+      if ( isMaximum((Counter)c) ) setMax((Counter)c, s.counters[c]);
+      else counters[c] += s.counters[c];
+    }
+    for(int p = 0; p < NUM_PHASES; ++p) {
+      wall_ns[p] += s.wall_ns[p];
+      cpu_ns[p] += s.cpu_ns[p];
+      calls[p] += s.calls[p];
+      cpu_measured[p] = cpu_measured[p] || s.cpu_measured[p];
+    }
+    memory_current += s.memory_current;
+    memory_peak += s.memory_peak;
+    allocations += s.allocations;
+  }
+
+  /**
+   * @brief Writes the phases and counters that were used.
+   * @param os output stream.
+   */
+  void report(std::ostream& os) const
+  {
+    static const char * phases[NUM_PHASES] = {
+      "read", "histogram", "tree build", "match search", "dictionary fill", "bit output",
+      "decode", "write"
+    };
+    std::ios::fmtflags flags = os.flags();
+    os << std::fixed << std::setprecision(3)
+       << std::left << std::setw(18) << "phase" << std::right
+       << std::setw(12) << "wall ms" << std::setw(12) << "cpu ms" << std::setw(12) << "calls"
+       << std::endl;
+    for(int p = 0; p < NUM_PHASES; ++p) {
+      if ( calls[p] == 0 ) continue;
+      os << std::left << std::setw(18) << phases[p] << std::right
+	 << std::setw(12) << wall_ns[p]/1e6;
+      if ( cpu_measured[p] ) os << std::setw(12) << cpu_ns[p]/1e6;
+      else os << std::setw(12) << "-";
+      os << std::setw(12) << calls[p] << std::endl;
+    }
+
+    const uint64_t * c = counters;
+    if ( c[LZ77_TOKENS] > 0 ) {
+      os << "lz77 tokens: " << c[LZ77_TOKENS]
+	 << ", literals: " << c[LZ77_LITERALS] << " (" << 100.0*c[LZ77_LITERALS]/c[LZ77_TOKENS] << "%)"
+	 << ", matches: " << c[LZ77_MATCHES] << std::endl
+	 << "lz77 average match length: "
+	 << (c[LZ77_MATCHES] > 0 ? (double)c[LZ77_MATCH_BYTES]/c[LZ77_MATCHES] : 0.0)
+	 << ", find_prefix comparisons: " << c[LZ77_COMPARISONS] << std::endl;
+    }
+    if ( c[DICTIONARY_HITS]+c[DICTIONARY_MISSES] > 0 ) {
+      os << "dictionary size: " << c[DICTIONARY_SIZE] << ", inserts: " << c[DICTIONARY_INSERTS]
+	 << ", hits: " << c[DICTIONARY_HITS] << ", misses: " << c[DICTIONARY_MISSES]
+	 << " (" << 100.0*c[DICTIONARY_HITS]/(c[DICTIONARY_HITS]+c[DICTIONARY_MISSES])
+	 << "% hits)" << std::endl;
+    }
+    if ( c[HUFFMAN_SYMBOLS] > 0 ) {
+      os << "huffman symbols: " << c[HUFFMAN_SYMBOLS] << ", average code length: "
+	 << (double)c[HUFFMAN_CODE_BITS]/c[HUFFMAN_SYMBOLS] << " bits" << std::endl;
+    }
+    if ( allocations > 0 || memory_current > 0 ) {
+      os << "memory: " << memory_current/1024.0 << " KiB allocated, peak "
+	 << memory_peak/1024.0 << " KiB, " << allocations << " allocations" << std::endl;
+    }
+    os.flags(flags);
+  }
+};
+
+#ifdef SCOMPRESSOR_STATS
+/** Adds a value to a counter of stats. */
+#define SCOMPRESSOR_STATS_ADD(stats, counter, v) ((stats).add(CompressorStats::counter, (v)))
+/** Updates a counter of stats that keeps a maximum. */
+#define SCOMPRESSOR_STATS_MAX(stats, counter, v) ((stats).setMax(CompressorStats::counter, (v)))
+/** Times the rest of the scope as a coarse phase (wall and CPU time). */
+#define SCOMPRESSOR_STATS_PHASE(stats, phase)				\
+  CompressorStats::Timer stats_timer_##phase((stats), CompressorStats::phase, true)
+/** Times the rest of the scope as a fine phase (wall time only). */
+#define SCOMPRESSOR_STATS_FINE_PHASE(stats, phase)			\
+  CompressorStats::Timer stats_timer_##phase((stats), CompressorStats::phase, false)
+#else
+#define SCOMPRESSOR_STATS_ADD(stats, counter, v) ((void)0)
+#define SCOMPRESSOR_STATS_MAX(stats, counter, v) ((void)0)
+#define SCOMPRESSOR_STATS_PHASE(stats, phase) ((void)0)
+#define SCOMPRESSOR_STATS_FINE_PHASE(stats, phase) ((void)0)
+#endif
+
+#endif
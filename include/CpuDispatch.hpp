@@ -0,0 +1,296 @@
+/**
+ * @file CpuDispatch.hpp
+ * @brief File including the implementation of CpuDispatch class.
+ */
+
+#ifndef __CPUDISPATCH_HPP__
+#define __CPUDISPATCH_HPP__
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SCOMPRESSOR_HAVE_X86_KERNELS 1
+#endif
+
+/**
+ * @class CpuDispatch
+ * @brief Selects at run time the implementation of the hot kernels.
+ *
+ * The binaries are built for the baseline instruction set, so they run on any
+ * processor of the architecture. The kernels that benefit from wider
+ * instructions have several implementations, compiled with the target
+ * attribute, and the best one the processor supports is chosen the first
+ * time they are used (with cpuid, through __builtin_cpu_supports()).
+ *
+ * The level can be forced to a lower one, i.e. to test the scalar
+ * implementations on a machine with AVX2, with the environment variable
+ * SCOMPRESSOR_CPU (scalar, sse4.2 or avx2) or with force(). Every level
+ * gives exactly the same results.
+ */
+class CpuDispatch {
+public:
+  /** Instruction set levels, from the lowest to the highest. */
+  enum Level {
+    /** Portable C++, for any processor. */
+    SCALAR = 0,
+    /** x86-64 with SSE4.2 (and the SSE2 of the baseline). */
+    SSE42,
+    /** x86-64 with AVX2. */
+    AVX2,
+    NUM_LEVELS
+  };
+
+  /**
+   * @class Kernels
+   * @brief Implementations of the kernels for a level.
+   */
+  struct Kernels {
+    /**
+     * Number of equal bytes at the beginning of a and b, at most n.
+     */
+    size_t (*matchLength)(const char * a, const char * b, size_t n);
+    /**
+     * Copies n bytes from src to dst, one after the other, so that the
+     * bytes of an overlapping match are repeated (as in LZ77).
+     */
+    void (*copyMatch)(char * dst, const char * src, size_t n);
+  };
+
+private:
+  /**
+   * @class State
+   * @brief Level and kernels in use.
+   */
+  struct State {
+    Level level;
+    Kernels kernels;
+
+    State()
+    {
+      level = detect();
+      const char * env = getenv("SCOMPRESSOR_CPU");
+      Level forced;
+      if ( env != 0 && parse(env, forced) && forced < level ) level = forced;
+      kernels = kernelsOf(level);
+    }
+  };
+
+  static State& state()
+  {
+    static State s;
+    return s;
+  }
+
+  static size_t matchLengthScalar(const char * a, const char * b, size_t n)
+  {
+    size_t i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /* 8 bytes at a time; the first different byte is the lowest one of the xor. */
+    for(; i+8 <= n; i += 8) {
+      uint64_t x, y;
+      memcpy(&x, a+i, 8);
+      memcpy(&y, b+i, 8);
+      if ( x != y ) return i + (__builtin_ctzll(x ^ y) >> 3);
+    }
+#endif
+    while ( i < n && a[i] == b[i] ) ++i;
+    return i;
+  }
+
+  static void copyMatchScalar(char * dst, const char * src, size_t n)
+  {
+    size_t i = 0;
+    /* A word can be copied at once when it does not overlap the bytes it
+       should repeat. */
+    if ( src >= dst || (size_t)(dst-src) >= 8 ) {
+      for(; i+8 <= n; i += 8) {
+	uint64_t v;
+	memcpy(&v, src+i, 8);
+	memcpy(dst+i, &v, 8);
+      }
+    }
+    for(; i < n; ++i) dst[i] = src[i];
+  }
+
+#ifdef SCOMPRESSOR_HAVE_X86_KERNELS
+  static size_t matchLengthSSE2(const char * a, const char * b, size_t n)
+  {
+    size_t i = 0;
+    if ( n >= 8 ) {
+      uint64_t x, y;
+      memcpy(&x, a, 8);
+      memcpy(&y, b, 8);
+      if ( x != y ) return __builtin_ctzll(x ^ y) >> 3;
+      i = 8;
+    }
+    for(; i+16 <= n; i += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(a+i));
+      __m128i y = _mm_loadu_si128((const __m128i *)(b+i));
+      unsigned diff = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xFFFF;
+      if ( diff != 0 ) return i + __builtin_ctz(diff);
+    }
+    return i + matchLengthScalar(a+i, b+i, n-i);
+  }
+
+  static void copyMatchSSE2(char * dst, const char * src, size_t n)
+  {
+    size_t i = 0;
+    if ( src >= dst || (size_t)(dst-src) >= 16 ) {
+      for(; i+16 <= n; i += 16)
+	_mm_storeu_si128((__m128i *)(dst+i), _mm_loadu_si128((const __m128i *)(src+i)));
+    }
+    copyMatchScalar(dst+i, src+i, n-i);
+  }
+
+  __attribute__((target("avx2")))
+  static size_t matchLengthAVX2(const char * a, const char * b, size_t n)
+  {
+    size_t i = 0;
+    if ( n >= 8 ) {
+      uint64_t x, y;
+      memcpy(&x, a, 8);
+      memcpy(&y, b, 8);
+      if ( x != y ) return __builtin_ctzll(x ^ y) >> 3;
+      i = 8;
+    }
+    for(; i+32 <= n; i += 32) {
+      __m256i x = _mm256_loadu_si256((const __m256i *)(a+i));
+      __m256i y = _mm256_loadu_si256((const __m256i *)(b+i));
+      unsigned diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+      if ( diff != 0 ) return i + __builtin_ctz(diff);
+    }
+    return i + matchLengthSSE2(a+i, b+i, n-i);
+  }
+
+  __attribute__((target("avx2")))
+  static void copyMatchAVX2(char * dst, const char * src, size_t n)
+  {
+    size_t i = 0;
+    if ( src >= dst || (size_t)(dst-src) >= 32 ) {
+      for(; i+32 <= n; i += 32)
+	_mm256_storeu_si256((__m256i *)(dst+i), _mm256_loadu_si256((const __m256i *)(src+i)));
+    }
+    copyMatchSSE2(dst+i, src+i, n-i);
+  }
+#endif
+
+public:
+  /**
+   * @brief Determines whether the processor supports a level.
+   */
+  static bool supported(Level l)
+  {
+    switch ( l ) {
+    case SCALAR: return true;
+#ifdef SCOMPRESSOR_HAVE_X86_KERNELS
+    case SSE42: return __builtin_cpu_supports("sse4.2");
+    case AVX2: return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("avx2");
+#endif
+    default: return false;
+    }
+  }
+
+  /**
+   * @brief Returns the highest level supported by the processor.
+   */
+  static Level detect()
+  {
+    Level l = SCALAR;
+    while ( l+1 < NUM_LEVELS && supported(Level(l+1)) ) l = Level(l+1);
+    return l;
+  }
+
+  /**
+   * @brief Returns the implementations of the kernels for a level.
+   *
+   * The level must be supported by the processor.
+   */
+  static Kernels kernelsOf(Level l)
+  {
+    Kernels k = { matchLengthScalar, copyMatchScalar };
+#ifdef SCOMPRESSOR_HAVE_X86_KERNELS
+    if ( l >= SSE42 ) { k.matchLength = matchLengthSSE2; k.copyMatch = copyMatchSSE2; }
+    if ( l >= AVX2 ) { k.matchLength = matchLengthAVX2; k.copyMatch = copyMatchAVX2; }
+#endif
+    return k;
+  }
+
+  /**
+   * @brief Returns the level in use.
+   */
+  static Level level()
+  { return state().level; }
+
+  /**
+   * @brief Returns the kernels in use.
+   */
+  static const Kernels& kernels()
+  { return state().kernels; }
+
+  /**
+   * @brief Forces a level, i.e. to test the lower ones.
+   *
+   * It must not be called while other threads are compressing.
+   * @return false if the processor does not support the level, true otherwise.
+   */
+  static bool force(Level l)
+  {
+    if ( l >= NUM_LEVELS || !supported(l) ) return false;
+    State& s = state();
+    s.level = l;
+    s.kernels = kernelsOf(l);
+    return true;
+  }
+
+  /**
+   * @brief Returns the name of a level.
+   */
+  static const char * name(Level l)
+  {
+    static const char * names[NUM_LEVELS] = { "scalar", "sse4.2", "avx2" };
+    return (l < NUM_LEVELS ? names[l] : "unknown");
+  }
+
+  /**
+   * @brief Gets a level from its name.
+   * @return false if the name is not known, true otherwise.
+   */
+  static bool parse(const char * s, Level& l)
+  {
+    for(int i = 0; i < NUM_LEVELS; ++i)
+      if ( !strcmp(s, name(Level(i))) ) { l = Level(i); return true; }
+    return false;
+  }
+
+  /**
+   * @brief Adds the number of times every byte appears in p to counts.
+   *
+   * The bytes are counted in four tables, so that repeated bytes do not wait
+   * for the previous increment of the same counter. It has no SIMD
+   * implementations: the scattered increments do not vectorize with SSE or
+   * AVX2.
+   * @param p data.
+   * @param n size of the data, in bytes.
+   * @param[in,out] counts 256 counters.
+   */
+  static void histogram(const unsigned char * p, size_t n, size_t * counts)
+  {
+    size_t c[4][256];
+    memset(c, 0, sizeof(c));
+    size_t i = 0;
+    for(; i+4 <= n; i += 4) {
+      c[0][p[i]]++;
+      c[1][p[i+1]]++;
+      c[2][p[i+2]]++;
+      c[3][p[i+3]]++;
+    }
+    for(; i < n; ++i) c[0][p[i]]++;
+    for(int s = 0; s < 256; ++s) counts[s] += c[0][s] + c[1][s] + c[2][s] + c[3][s];
+  }
+};
+
+#endif
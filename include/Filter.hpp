@@ -0,0 +1,451 @@
+/**
+ * @file Filter.hpp
+ * @brief File including the implementation of Filter and FilterChain classes.
+ */
+
+#ifndef __FILTER_HPP__
+#define __FILTER_HPP__
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <CpuDispatch.hpp>
+
+/**
+ * @class Filter
+ * @brief Reversible transform applied to the data before it is compressed.
+ *
+ * Arrays of fixed-width numbers (metrics, samples, sensor dumps) look like
+ * high-entropy bytes to the compressors, although neighbouring values are
+ * close and their high bytes hardly change. The filters expose that:
+ *
+ * - DELTA: every byte is replaced by its difference (modulo 256) with the
+ *   byte stride positions before, so slowly changing values become runs of
+ *   small numbers.
+ * - SHUFFLE: the bytes of elements of a given size are regrouped by their
+ *   position in the element (first all the first bytes, then all the second
+ *   ones...), so the bytes that hardly change end up together. The bytes
+ *   after the last whole element are left as they are.
+ *
+ * Both filters keep the size of the data and are applied to every frame on
+ * its own. The kernels are written so that the compiler vectorizes them, and
+ * the AVX2 versions are used when CpuDispatch allows it.
+ */
+class Filter {
+public:
+  /** Types of filters. */
+  enum Type {
+    /** Byte-wise difference with the byte param positions before. */
+    DELTA = 1,
+    /** Byte planes of elements of param bytes. */
+    SHUFFLE = 2
+  };
+
+  /** Type of the filter. */
+  uint8_t type;
+  /** Stride (DELTA) or element size (SHUFFLE), in bytes. */
+  uint8_t param;
+
+  /**
+   * @brief Determines whether a filter is valid.
+   */
+  bool valid() const
+  {
+    return (type == DELTA && param >= 1) || (type == SHUFFLE && param >= 2);
+  }
+
+  /**
+   * @brief Applies the filter.
+   * @param src data.
+   * @param dst filtered data (it must not overlap src).
+   * @param n size of the data, in bytes.
+   */
+  void encode(const char * src, char * dst, size_t n) const
+  {
+    if ( type == DELTA ) deltaEncode(src, dst, n, param);
+    else shuffle(src, dst, n, param);
+  }
+
+  /**
+   * @brief Reverts the filter.
+   * @param[in,out] p filtered data; DELTA is reverted in place.
+   * @param tmp buffer of n bytes; SHUFFLE leaves the data there.
+   * @param n size of the data, in bytes.
+   * @return p or tmp, where the data is left.
+   */
+  char * decode(char * p, char * tmp, size_t n) const
+  {
+    if ( type == DELTA ) { deltaDecode(p, n, param); return p; }
+    unshuffle(p, tmp, n, param);
+    return tmp;
+  }
+
+private:
+  /* The bodies of the kernels are inlined into a baseline and an AVX2
+     version of every kernel, and the compiler vectorizes each one with the
+     instructions of its target. */
+
+  __attribute__((always_inline))
+  static inline void deltaEncodeBody(const char * __restrict src, char * __restrict dst,
+				     size_t n, size_t stride)
+  {
+    size_t i = 0;
+    for(; i < n && i < stride; ++i) dst[i] = src[i];
+    for(; i < n; ++i) dst[i] = src[i] - src[i-stride];
+  }
+
+  template <size_t K>
+  __attribute__((always_inline))
+  static inline void shuffleBody(const char * __restrict src, char * __restrict dst, size_t m)
+  {
+    for(size_t i = 0; i < m; ++i)
+      for(size_t j = 0; j < K; ++j)
+	dst[j*m+i] = src[i*K+j];
+  }
+
+  template <size_t K>
+  __attribute__((always_inline))
+  static inline void unshuffleBody(const char * __restrict src, char * __restrict dst, size_t m)
+  {
+    for(size_t i = 0; i < m; ++i)
+      for(size_t j = 0; j < K; ++j)
+	dst[i*K+j] = src[j*m+i];
+  }
+
+  static void deltaEncodeBaseline(const char * src, char * dst, size_t n, size_t stride)
+  { deltaEncodeBody(src, dst, n, stride); }
+
+  template <size_t K>
+  static void shuffleBaseline(const char * src, char * dst, size_t m)
+  { shuffleBody<K>(src, dst, m); }
+
+  template <size_t K>
+  static void unshuffleBaseline(const char * src, char * dst, size_t m)
+  { unshuffleBody<K>(src, dst, m); }
+
+#ifdef SCOMPRESSOR_HAVE_X86_KERNELS
+  __attribute__((target("avx2")))
+  static void deltaEncodeAVX2(const char * src, char * dst, size_t n, size_t stride)
+  { deltaEncodeBody(src, dst, n, stride); }
+
+  template <size_t K>
+  __attribute__((target("avx2")))
+  static void shuffleAVX2(const char * src, char * dst, size_t m)
+  { shuffleBody<K>(src, dst, m); }
+
+  template <size_t K>
+  __attribute__((target("avx2")))
+  static void unshuffleAVX2(const char * src, char * dst, size_t m)
+  { unshuffleBody<K>(src, dst, m); }
+
+  /**
+   * Prefix sums of stride S (a divisor of 16) over 16 bytes at a time: the
+   * sums inside a vector take log2(16/S) shifted additions, and the last S
+   * bytes of the previous vector, repeated, are carried to the next one.
+   */
+  template <int S>
+  static size_t deltaDecodeSSE2(char * p, size_t n)
+  {
+    __m128i carry = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i+16 <= n; i += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(p+i));
+      if ( S <= 1 ) x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+      if ( S <= 2 ) x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+      if ( S <= 4 ) x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+      x = _mm_add_epi8(x, carry);
+      _mm_storeu_si128((__m128i *)(p+i), x);
+      carry = _mm_srli_si128(x, 16-S);
+      if ( S <= 1 ) carry = _mm_or_si128(carry, _mm_slli_si128(carry, 1));
+      if ( S <= 2 ) carry = _mm_or_si128(carry, _mm_slli_si128(carry, 2));
+      if ( S <= 4 ) carry = _mm_or_si128(carry, _mm_slli_si128(carry, 4));
+      carry = _mm_or_si128(carry, _mm_slli_si128(carry, 8));
+    }
+    return i;
+  }
+#endif
+
+  /** Whether the AVX2 versions can be used. */
+  static bool useAVX2()
+  {
+#ifdef SCOMPRESSOR_HAVE_X86_KERNELS
+    return CpuDispatch::level() >= CpuDispatch::AVX2;
+#else
+    return false;
+#endif
+  }
+
+public:
+  /**
+   * @brief Delta filter: dst[i] = src[i] - src[i-stride].
+   */
+  static void deltaEncode(const char * src, char * dst, size_t n, size_t stride)
+  {
+#ifdef SCOMPRESSOR_HAVE_X86_KERNELS
+    if ( useAVX2() ) { deltaEncodeAVX2(src, dst, n, stride); return; }
+#endif
+    deltaEncodeBaseline(src, dst, n, stride);
+  }
+
+  /**
+   * @brief Reverts the delta filter in place: p[i] += p[i-stride].
+   */
+  static void deltaDecode(char * p, size_t n, size_t stride)
+  {
+    size_t i = 0;
+#ifdef SCOMPRESSOR_HAVE_X86_KERNELS
+    switch ( stride ) {
+    case 1: i = deltaDecodeSSE2<1>(p, n); break;
+    case 2: i = deltaDecodeSSE2<2>(p, n); break;
+    case 4: i = deltaDecodeSSE2<4>(p, n); break;
+    case 8: i = deltaDecodeSSE2<8>(p, n); break;
+    }
+#endif
+    for(i = std::max(i, stride); i < n; ++i) p[i] += p[i-stride];
+  }
+
+  /**
+   * @brief Shuffle filter: byte j of element i goes to dst[j*m+i], where m
+   * is the number of whole elements.
+   */
+  static void shuffle(const char * src, char * dst, size_t n, size_t size)
+  {
+    size_t m = n / size;
+    bool avx2 = useAVX2();
+    switch ( size ) {
+#ifdef SCOMPRESSOR_HAVE_X86_KERNELS
+    case 2: (avx2 ? shuffleAVX2<2> : shuffleBaseline<2>)(src, dst, m); break;
+    case 4: (avx2 ? shuffleAVX2<4> : shuffleBaseline<4>)(src, dst, m); break;
+    case 8: (avx2 ? shuffleAVX2<8> : shuffleBaseline<8>)(src, dst, m); break;
+#else
+    case 2: shuffleBaseline<2>(src, dst, m); break;
+    case 4: shuffleBaseline<4>(src, dst, m); break;
+    case 8: shuffleBaseline<8>(src, dst, m); break;
+#endif
+    default:
+      for(size_t i = 0; i < m; ++i)
+	for(size_t j = 0; j < size; ++j)
+	  dst[j*m+i] = src[i*size+j];
+    }
+    (void)avx2;
+    memcpy(dst+m*size, src+m*size, n-m*size);
+  }
+
+  /**
+   * @brief Reverts the shuffle filter.
+   */
+  static void unshuffle(const char * src, char * dst, size_t n, size_t size)
+  {
+    size_t m = n / size;
+    bool avx2 = useAVX2();
+    switch ( size ) {
+#ifdef SCOMPRESSOR_HAVE_X86_KERNELS
+    case 2: (avx2 ? unshuffleAVX2<2> : unshuffleBaseline<2>)(src, dst, m); break;
+    case 4: (avx2 ? unshuffleAVX2<4> : unshuffleBaseline<4>)(src, dst, m); break;
+    case 8: (avx2 ? unshuffleAVX2<8> : unshuffleBaseline<8>)(src, dst, m); break;
+#else
+    case 2: unshuffleBaseline<2>(src, dst, m); break;
+    case 4: unshuffleBaseline<4>(src, dst, m); break;
+    case 8: unshuffleBaseline<8>(src, dst, m); break;
+#endif
+    default:
+      for(size_t i = 0; i < m; ++i)
+	for(size_t j = 0; j < size; ++j)
+	  dst[i*size+j] = src[j*m+i];
+    }
+    (void)avx2;
+    memcpy(dst+m*size, src+m*size, n-m*size);
+  }
+};
+
+/**
+ * @class FilterChain
+ * @brief Sequence of filters applied to the data before it is compressed.
+ *
+ * The filters are applied in order when compressing and reverted in the
+ * reverse order when decompressing. A chain is written as a comma-separated
+ * list, i.e. "delta:4,shuffle:4" (differences of 32-bit integers, then their
+ * byte planes), and serialized as its length followed by the type and the
+ * parameter of every filter (one byte each).
+ */
+class FilterChain {
+public:
+  /** Maximum number of filters. */
+  static const size_t MAX_FILTERS = 4;
+  /** Maximum size of a serialized chain, in bytes. */
+  static const size_t MAX_SERIALIZED_SIZE = 1 + 2*MAX_FILTERS;
+
+private:
+  /** Filters, in the order they are applied. */
+  std::vector<Filter> filters;
+
+public:
+  /**
+   * @brief Parses a chain such as "delta:4,shuffle:4". The empty string is
+   * the empty chain.
+   * @return false if the chain is not valid (it is left unchanged), true otherwise.
+   */
+  bool parse(const std::string& s)
+  {
+    std::vector<Filter> parsed;
+    size_t start = 0;
+    while ( start < s.size() ) {
+      size_t end = s.find(',', start);
+      if ( end == std::string::npos ) end = s.size();
+      std::string item = s.substr(start, end-start);
+      size_t colon = item.find(':');
+      std::string name = item.substr(0, colon);
+      Filter f;
+      if ( name == "delta" ) f.type = Filter::DELTA;
+      else if ( name == "shuffle" ) f.type = Filter::SHUFFLE;
+      else return false;
+      if ( colon == std::string::npos ) return false;
+      const char * arg = item.c_str()+colon+1;
+      char * endp;
+      long v = strtol(arg, &endp, 10);
+      if ( *arg == 0 || *endp != 0 || v < 0 || v > 255 ) return false;
+      f.param = (uint8_t)v;
+      if ( !f.valid() || parsed.size() == MAX_FILTERS ) return false;
+      parsed.push_back(f);
+      start = end+1;
+    }
+    filters.swap(parsed);
+    return true;
+  }
+
+  /**
+   * @brief Returns the chain as it is parsed by parse().
+   */
+  std::string toString() const
+  {
+    std::string s;
+    for(size_t i = 0; i < filters.size(); ++i) {
+      if ( i > 0 ) s += ",";
+      s += (filters[i].type == Filter::DELTA ? "delta:" : "shuffle:");
+      s += std::to_string((unsigned)filters[i].param);
+    }
+    return s;
+  }
+
+  /**
+   * @brief Adds a filter at the end.
+   * @return false if it is not valid or the chain is full, true otherwise.
+   */
+  bool add(uint8_t type, uint8_t param)
+  {
+    Filter f = { type, param };
+    if ( !f.valid() || filters.size() == MAX_FILTERS ) return false;
+    filters.push_back(f);
+    return true;
+  }
+
+  /** Determines whether the chain has no filters. */
+  bool empty() const
+  { return filters.empty(); }
+
+  /**
+   * @brief Determines whether the chain moves bytes around (SHUFFLE), so that
+   * the start of the filtered data is not a sample of the whole.
+   */
+  bool reorders() const
+  {
+    for(size_t i = 0; i < filters.size(); ++i)
+      if ( filters[i].type == Filter::SHUFFLE ) return true;
+    return false;
+  }
+
+  /** Returns the number of filters. */
+  size_t size() const
+  { return filters.size(); }
+
+  /** Returns a filter. */
+  const Filter& operator [] (size_t i) const
+  { return filters[i]; }
+
+  /**
+   * @brief Writes the chain.
+   * @param p buffer of at least serializedSize() bytes.
+   * @return number of bytes written.
+   */
+  size_t serialize(char * p) const
+  {
+    p[0] = (char)filters.size();
+    for(size_t i = 0; i < filters.size(); ++i) {
+      p[1+2*i] = (char)filters[i].type;
+      p[2+2*i] = (char)filters[i].param;
+    }
+    return serializedSize();
+  }
+
+  /** Returns the size of the serialized chain, in bytes. */
+  size_t serializedSize() const
+  { return 1 + 2*filters.size(); }
+
+  /**
+   * @brief Reads the filters of a serialized chain.
+   * @param p serialized filters (2 bytes each).
+   * @param count number of filters.
+   * @return false if any filter is not valid, true otherwise.
+   */
+  bool deserialize(const char * p, size_t count)
+  {
+    if ( count > MAX_FILTERS ) return false;
+    std::vector<Filter> read(count);
+    for(size_t i = 0; i < count; ++i) {
+      read[i].type = p[2*i];
+      read[i].param = p[2*i+1];
+      if ( !read[i].valid() ) return false;
+    }
+    filters.swap(read);
+    return true;
+  }
+
+  /**
+   * @brief Applies the filters.
+   * @param p data.
+   * @param n size of the data, in bytes.
+   * @param a,b buffers used for the filtered data.
+   * @return the filtered data (p if the chain is empty, otherwise a or b).
+   */
+  template <typename Buffer>
+  const char * encode(const char * p, size_t n, Buffer& a, Buffer& b) const
+  {
+    if ( filters.empty() || n == 0 ) return p;
+    if ( a.size() < n ) a.resize(n);
+    if ( b.size() < n ) b.resize(n);
+    char * out = &a[0], * other = &b[0];
+    for(size_t i = 0; i < filters.size(); ++i) {
+      filters[i].encode(p, out, n);
+      p = out;
+      std::swap(out, other);
+    }
+    return p;
+  }
+
+  /**
+   * @brief Reverts the filters in place.
+   * @param p filtered data.
+   * @param n size of the data, in bytes.
+   * @param tmp buffer for the filters that cannot be reverted in place.
+   */
+  template <typename Buffer>
+  void decode(char * p, size_t n, Buffer& tmp) const
+  {
+    if ( filters.empty() || n == 0 ) return;
+    if ( tmp.size() < n ) tmp.resize(n);
+    char * cur = p, * other = &tmp[0];
+    for(size_t i = filters.size(); i-- > 0;) {
+      char * res = filters[i].decode(cur, other, n);
+      if ( res != cur ) { other = cur; cur = res; }
+    }
+    if ( cur != p ) memcpy(p, cur, n);
+  }
+};
+
+#endif
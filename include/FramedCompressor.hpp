@@ -0,0 +1,1012 @@
+/**
+ * @file FramedCompressor.hpp
+ * @brief File including the implementation of FramedCompressor class.
+ */
+
+#ifndef __FRAMEDCOMPRESSOR_HPP__
+#define __FRAMEDCOMPRESSOR_HPP__
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <thread>
+#include <new>
+#include <stdint.h>
+
+#include <GenericCompressor.hpp>
+#include <HuffmanCompressor.hpp>
+#include <LZ77Compressor.hpp>
+#include <LZ78Compressor.hpp>
+#include <LZWCompressor.hpp>
+#include <ByteBuffer.hpp>
+#include <Checksum.hpp>
+#include <BlockStatistics.hpp>
+#include <Filter.hpp>
+#include <BoundedQueue.hpp>
+#include <Trace.hpp>
+
+/**
+ * @class FramedCompressor
+ * @brief Compressor that splits the data in frames, each one compressed independently
+ * with one of the other compressors.
+ *
+ * The format is the following (all the integers are big-endian):
+ *
+ * - Header: version (8 bits), flags (8 bits), if FLAG_CONTENT_SIZE is set,
+ *   the size of the uncompressed content (64 bits), if FLAG_FILTERS is set,
+ *   the filter chain (see FilterChain::serialize()) and, if FLAG_PIPELINE is
+ *   set, the number of stages of the pipeline (8 bits) and their methods (8
+ *   bits each), in the order they are applied.
+ * - Frames: method (8 bits), uncompressed size (32 bits), compressed size (32 bits),
+ *   the compressed data and, if FLAG_FRAME_CHECKSUM is set, the CRC-32C of the
+ *   uncompressed frame (32 bits). Frames that would not shrink are stored
+ *   with method FRAME_STORED, and their data is a copy of the input. Frames
+ *   compressed with the pipeline have method FRAME_PIPELINE, and their data
+ *   starts with the sizes of the output of every stage but the last one (32
+ *   bits each), followed by the output of the last one.
+ * - End mark: method FRAME_END (8 bits) and, if FLAG_CONTENT_CHECKSUM is set,
+ *   the CRC-32C of the whole uncompressed content (32 bits).
+ *
+ * The filters are applied to every frame before it is compressed (the checksums
+ * are of the data before the filters), and reverted after it is decompressed.
+ *
+ * In a pipeline (i.e. LZ77 then Huffman), the output of every stage is the
+ * input of the next one, and the decompression applies the stages in reverse
+ * order. The stages may run on threads of their own: the frames go from one
+ * stage to the next through bounded queues, so several frames are in flight
+ * at the same time, each one in a different stage.
+ *
+ * Since every frame is compressed in memory, any compressor can be used on streams
+ * (including Huffman, which needs to read its input twice), and the checksums are
+ * computed while the frame is still in the cache.
+ */
+class FramedCompressor : public GenericCompressor {
+public:
+  /** Format version. */
+  static const unsigned char FORMAT_VERSION = 1;
+  /** Flag: every frame is followed by its checksum. */
+  static const uint8_t FLAG_FRAME_CHECKSUM = 0x01;
+  /** Flag: the content is followed by its checksum. */
+  static const uint8_t FLAG_CONTENT_CHECKSUM = 0x02;
+  /** Flag: the header contains the size of the content. */
+  static const uint8_t FLAG_CONTENT_SIZE = 0x04;
+  /** Flag: the header contains a filter chain. */
+  static const uint8_t FLAG_FILTERS = 0x08;
+  /** Flag: the header contains a pipeline of compressors. */
+  static const uint8_t FLAG_PIPELINE = 0x10;
+  /** Flags known by this version. */
+  static const uint8_t KNOWN_FLAGS = 0x1F;
+
+  /** Frame methods. They match OptionsParser::CompressionMethod. AUTO is
+      not written in the frames: it chooses one of the others for each frame. */
+  enum FrameMethod { HUFFMAN = 0, LZ77 = 1, LZ78 = 2, LZW = 3, NUM_METHODS, AUTO = NUM_METHODS };
+  /** Method of the frames compressed with the pipeline of the header. */
+  static const uint8_t FRAME_PIPELINE = 0xFD;
+  /** Method of the frames stored without compression. */
+  static const uint8_t FRAME_STORED = 0xFE;
+  /** Method that marks the end of the frames. */
+  static const uint8_t FRAME_END = 0xFF;
+
+  /** Default size of the frames, in bytes. */
+  static const size_t DEFAULT_FRAME_SIZE = (1 << 20);
+  /** Maximum size of a frame accepted by the decompressor, in bytes. */
+  static const size_t MAX_FRAME_SIZE = (1 << 28);
+  /** Maximum number of stages of a pipeline. */
+  static const size_t MAX_STAGES = 4;
+
+private:
+  /** Size of the frame header, in bytes. */
+  static const size_t FRAME_HEADER_SIZE = 9;
+  /** Size of the sample used to detect incompressible frames, in bytes. */
+  static const size_t PROBE_SIZE = (1 << 16);
+  /** AUTO: below this match density, LZ compressors do not pay off. */
+  static constexpr double MIN_MATCH_DENSITY = 0.2;
+  /** AUTO: above this entropy (bits/byte), Huffman does not pay off. */
+  static constexpr double MAX_ENTROPY = 7.9;
+
+  /**
+   * @class FrameChoice
+   * @brief Compressor and parameters chosen for a frame.
+   */
+  struct FrameChoice {
+    /** Method of the frame (FRAME_STORED to skip the compression). */
+    uint8_t method;
+    /** Number of bits of the LZW dictionary (0 for the default). */
+    uint8_t dictionary_bits;
+  };
+
+  /** Method used to compress the frames. */
+  uint8_t method;
+  /** Size of the frames, in bytes. */
+  size_t frame_size;
+  /** Whether checksums are written. */
+  bool checksums;
+  /** Filters applied to the frames before compressing them. */
+  FilterChain filters;
+  /** Methods of the stages of the pipeline, in the order they are applied. */
+  uint8_t stages[MAX_STAGES];
+  /** Number of stages of the pipeline (0 if the frames use a single method). */
+  size_t num_stages;
+  /** Whether every stage of the pipeline runs on a thread of its own. */
+  bool stage_threads;
+  /** Compressors, created on demand. */
+  GenericCompressor * compressors[NUM_METHODS];
+  /** Compressors of the stages of the pipeline. Every stage has its own, so
+      that the stages can run at the same time. */
+  GenericCompressor * stage_compressors[MAX_STAGES];
+  /** Buffer charged to the memory account of the compressor. */
+  typedef std::vector<char, AccountedAllocator<char> > Buffer;
+  /** Buffer for the uncompressed frames. */
+  Buffer ubuffer;
+  /** Buffer for the compressed frames. */
+  Buffer cbuffer;
+  /** Buffers for the filtered frames. */
+  Buffer fbuffer[2];
+  /** Buffers for the output of the stages of a pipeline while decompressing. */
+  Buffer pbuffer[2];
+  /** Statistics of the container and the compressors, merged by getStats(). */
+  CompressorStats merged;
+
+  /** Non-copyable. */
+  FramedCompressor(const FramedCompressor&);
+  /** Non-copyable. */
+  FramedCompressor& operator = (const FramedCompressor&);
+
+  /** Writes a big-endian 32 bits integer. */
+  static inline void putU32(char * p, uint32_t v)
+  { for(int i = 3; i >= 0; --i, v >>= 8) p[i] = (char)(v & 0xFF); }
+
+  /** Reads a big-endian 32 bits integer. */
+  static inline uint32_t getU32(const char * p)
+  {
+    uint32_t v = 0;
+    for(int i = 0; i < 4; ++i) v = (v << 8) | (unsigned char)p[i];
+    return v;
+  }
+
+  /**
+   * @brief Creates a compressor of a valid method.
+   * @param m method.
+   * @return compressor, using the memory resource of this one.
+   */
+  GenericCompressor * newCompressor(uint8_t m)
+  {
+    GenericCompressor * compr;
+    switch ( m ) {
+    case HUFFMAN: compr = new HuffmanCompressor(); break;
+    case LZ77: compr = new LZ77Compressor(); break;
+    case LZ78: compr = new LZ78Compressor(); break;
+    default: compr = new LZWCompressor(); break;
+    }
+    compr->setMemoryResource(memory.getResource());
+    return compr;
+  }
+
+  /**
+   * @brief Returns the compressor of a method.
+   * @param m method.
+   * @return compressor, or NULL if the method is not valid.
+   */
+  GenericCompressor * getCompressor(uint8_t m)
+  {
+    if ( m >= NUM_METHODS ) return 0;
+    if ( compressors[m] == 0 ) compressors[m] = newCompressor(m);
+    return compressors[m];
+  }
+
+  /**
+   * @brief Chooses the compressor of a frame.
+   *
+   * With AUTO, a sample of the frame is analyzed: data without repeated
+   * strings is compressed with Huffman (or stored, if its entropy is too
+   * high), and the rest with LZW, whose dictionary grows with the frame.
+   * LZ77 is never chosen: its search is an order of magnitude slower than
+   * LZW and, with the window sizes that keep it usable, it compresses worse.
+   * LZ78 is dominated by LZW with the same dictionary size.
+   * @param p frame.
+   * @param n size of the frame, in bytes.
+   * @return compressor and parameters.
+   */
+  FrameChoice chooseMethod(const char * p, size_t n) const
+  {
+    FrameChoice choice = { method, 0 };
+    if ( method != AUTO ) return choice;
+
+    BlockStatistics stats(p, n);
+    if ( stats.match_density < MIN_MATCH_DENSITY ) {
+      choice.method = (stats.entropy > MAX_ENTROPY ? FRAME_STORED : HUFFMAN);
+    } else {
+      int bits = 0;
+      while ( ((size_t)1 << bits) < n ) ++bits;
+      choice.method = LZW;
+      choice.dictionary_bits = std::min(std::max(bits-2, 12), 16);
+    }
+    return choice;
+  }
+
+  /**
+   * @brief Compresses a frame.
+   * @param choice compressor and parameters.
+   * @param p frame.
+   * @param n size of the frame, in bytes.
+   * @param dst buffer for the compressed data.
+   * @param cap capacity of dst, in bytes.
+   * @return size of the compressed data, or BUFFER_ERROR if it does not fit.
+   */
+  size_t compressFrame(const FrameChoice& choice, const char * p, size_t n, char * dst, size_t cap)
+  {
+    GenericCompressor * compr = getCompressor(choice.method);
+    if ( compr == 0 ) return BUFFER_ERROR;
+    if ( choice.method == LZW && choice.dictionary_bits != 0 )
+      return static_cast<LZWCompressor *>(compr)->compress(p, n, dst, cap,
+							   choice.dictionary_bits, 6);
+    return compr->compress(p, n, dst, cap);
+  }
+
+  /**
+   * @class SpanFrames
+   * @brief Splits a memory buffer in frames, without copying it.
+   */
+  struct SpanFrames {
+    /** Data. */
+    const char * data;
+    /** Remaining bytes. */
+    size_t left;
+    /** Size of the frames. */
+    size_t frame_size;
+    /**
+     * @brief Returns the next frame.
+     * @param[out] p start of the frame.
+     * @return size of the frame (0 at the end).
+     */
+    size_t next(const char *& p)
+    {
+      size_t n = std::min(left, frame_size);
+      p = data; data += n; left -= n;
+      return n;
+    }
+    /** Whether the input failed. */
+    bool bad() const { return false; }
+  };
+
+  /**
+   * @class StreamFrames
+   * @brief Reads frames from a stream.
+   */
+  struct StreamFrames {
+    /** Input stream. */
+    std::istream& input;
+    /** Frame buffer. */
+    Buffer& buffer;
+    /**
+     * @brief Returns the next frame.
+     * @param[out] p start of the frame.
+     * @return size of the frame (0 at the end).
+     */
+    size_t next(const char *& p)
+    {
+      if ( !input.good() ) return 0;
+      input.read(&buffer[0], buffer.size());
+      p = &buffer[0];
+      return input.gcount();
+    }
+    /** Whether the input failed. */
+    bool bad() const { return input.bad(); }
+  };
+
+  /**
+   * @class SpanInput
+   * @brief Reads the compressed data from a memory buffer, without copying it.
+   */
+  struct SpanInput {
+    /** Data. */
+    const char * data;
+    /** Remaining bytes. */
+    size_t left;
+    /**
+     * @brief Reads a number of bytes.
+     * @param n number of bytes.
+     * @return pointer to the bytes, or NULL if there are not enough bytes.
+     */
+    const char * read(size_t n)
+    {
+      if ( n > left ) return 0;
+      const char * p = data; data += n; left -= n;
+      return p;
+    }
+  };
+
+  /**
+   * @class StreamInput
+   * @brief Reads the compressed data from a stream.
+   */
+  struct StreamInput {
+    /** Input stream. */
+    std::istream& input;
+    /** Buffer. */
+    Buffer& buffer;
+    /**
+     * @brief Reads a number of bytes.
+     * @param n number of bytes.
+     * @return pointer to the bytes (valid until the next call), or NULL if there
+     * are not enough bytes.
+     */
+    const char * read(size_t n)
+    {
+      if ( buffer.size() < n ) buffer.resize(n);
+      input.read(&buffer[0], n);
+      return ((size_t)input.gcount() == n ? &buffer[0] : 0);
+    }
+  };
+
+  /** Returns space for n bytes of uncompressed data written to a stream. */
+  char * outputSpace(std::ostream& output, size_t n)
+  {
+    if ( ubuffer.size() < n ) ubuffer.resize(n);
+    return &ubuffer[0];
+  }
+
+  /** Returns space for n bytes of uncompressed data written to a buffer. */
+  char * outputSpace(ByteBufferWriter& output, size_t n)
+  { return output.append(n); }
+
+  /** Writes the uncompressed data to a stream. */
+  bool commitOutput(std::ostream& output, const char * p, size_t n)
+  { return output.write(p, n).good(); }
+
+  /** The uncompressed data was written in place. */
+  bool commitOutput(ByteBufferWriter& output, const char * p, size_t n)
+  { return output.good(); }
+
+  /**
+   * @brief Writes the header.
+   * @param output output stream or buffer.
+   * @param content_size size of the content, if known.
+   * @param known_size whether the size of the content is known.
+   * @return true if it was successful, false otherwise.
+   */
+  template <typename Output>
+  bool writeHeader(Output& output, uint64_t content_size, bool known_size)
+  {
+    char h[10 + FilterChain::MAX_SERIALIZED_SIZE + 1 + MAX_STAGES];
+    size_t n = 2;
+    h[0] = FORMAT_VERSION;
+    h[1] = (checksums ? FLAG_FRAME_CHECKSUM | FLAG_CONTENT_CHECKSUM : 0) |
+      (known_size ? FLAG_CONTENT_SIZE : 0) | (filters.empty() ? 0 : FLAG_FILTERS) |
+      (num_stages > 0 ? FLAG_PIPELINE : 0);
+    if ( known_size ) {
+      putU32(h+2, (uint32_t)(content_size >> 32));
+      putU32(h+6, (uint32_t)content_size);
+      n = 10;
+    }
+    if ( !filters.empty() ) n += filters.serialize(h+n);
+    if ( num_stages > 0 ) {
+      h[n++] = (char)num_stages;
+      for(size_t k = 0; k < num_stages; ++k) h[n++] = stages[k];
+    }
+    return output.write(h, n).good();
+  }
+
+  /**
+   * @class PipelineFrame
+   * @brief Frame on its way through the stages of a pipeline.
+   */
+  struct PipelineFrame {
+    /** Frame, after the filters. */
+    const char * data;
+    /** Size of the frame, in bytes. */
+    size_t n;
+    /** CRC-32C of the frame, before the filters. */
+    uint32_t crc;
+    /** Whether the frame is stored, because a stage did not make it smaller. */
+    bool stored;
+    /** Buffers for the filtered frame, or a copy of it. */
+    Buffer filtered[2];
+    /** Output of every stage. */
+    Buffer output[MAX_STAGES];
+    /** Size of the output of every stage, in bytes. */
+    size_t sizes[MAX_STAGES];
+  };
+
+  /** Queue of frames between two stages of a pipeline. */
+  typedef BoundedQueue<PipelineFrame *> StageQueue;
+
+  /** Size of the sizes of the intermediate outputs in a pipeline frame, in bytes. */
+  size_t pipelineHeaderSize(size_t count) const
+  { return 4*(count-1); }
+
+  /**
+   * @brief Compresses a frame with a stage of the pipeline.
+   *
+   * Every stage must produce less bytes than the frame had; otherwise the
+   * frame is stored and the rest of the stages skip it.
+   * @param k stage.
+   * @param f frame.
+   */
+  void runStage(size_t k, PipelineFrame& f)
+  {
+    if ( f.stored ) return;
+    SCOMPRESSOR_TRACE("compress stage", "compress");
+    const char * src = (k == 0 ? f.data : &f.output[k-1][0]);
+    size_t len = (k == 0 ? f.n : f.sizes[k-1]);
+    size_t cap = f.n-1;
+    if ( k+1 == num_stages ) {
+      if ( f.n <= pipelineHeaderSize(num_stages)+1 ) { f.stored = true; return; }
+      cap -= pipelineHeaderSize(num_stages);
+    }
+    GenericCompressor * compr = stage_compressors[k];
+    char * dst = &f.output[k][0];
+    size_t c;
+    /* As with a single method, hopeless data is detected on a sample. */
+    if ( k == 0 && f.n >= 2*PROBE_SIZE && !filters.reorders() &&
+	 compr->compress(src, PROBE_SIZE, dst, PROBE_SIZE-1) == BUFFER_ERROR )
+      c = BUFFER_ERROR;
+    else c = compr->compress(src, len, dst, cap);
+    if ( c == BUFFER_ERROR ) f.stored = true;
+    else f.sizes[k] = c;
+  }
+
+  /**
+   * @brief Body of the thread of a stage of the pipeline: compresses the
+   * frames of its queue and passes them to the next one.
+   * @param k stage.
+   * @param in queue of the frames of the stage.
+   * @param out queue of the next stage.
+   */
+  void stageWork(size_t k, StageQueue * in, StageQueue * out)
+  {
+    Trace::setThreadName("stage");
+    PipelineFrame * f;
+    while ( in->pop(f) ) {
+      try {
+	runStage(k, *f);
+      } catch ( ... ) {
+	/* i.e. std::bad_alloc */
+	f->stored = true;
+      }
+      out->push(f);
+    }
+    out->close();
+  }
+
+  /**
+   * @brief Writes a frame that went through the pipeline.
+   * @param f frame.
+   * @param output output stream or buffer.
+   * @return true if it was successful, false otherwise.
+   */
+  template <typename Output>
+  bool writePipelineFrame(const PipelineFrame& f, Output& output)
+  {
+    SCOMPRESSOR_STATS_PHASE(stats, WRITE);
+    SCOMPRESSOR_TRACE("write frame", "io");
+    char h[FRAME_HEADER_SIZE + 4*MAX_STAGES];
+    size_t hsize = FRAME_HEADER_SIZE;
+    const char * data = f.data;
+    size_t c = f.n;
+    h[0] = FRAME_STORED;
+    if ( !f.stored ) {
+      h[0] = FRAME_PIPELINE;
+      for(size_t k = 0; k+1 < num_stages && k+1 < MAX_STAGES; ++k, hsize += 4)
+	putU32(h+hsize, f.sizes[k]);
+      data = &f.output[num_stages-1][0];
+      c = f.sizes[num_stages-1];
+    }
+    putU32(h+1, f.n);
+    putU32(h+5, c + hsize-FRAME_HEADER_SIZE);
+    if ( !output.write(h, hsize).good() || !output.write(data, c).good() ) return false;
+    if ( !checksums ) return true;
+    putU32(h, f.crc);
+    return output.write(h, 4).good();
+  }
+
+  /**
+   * @brief Compresses all the frames with the pipeline.
+   *
+   * The frames are read and written by the calling thread. Without stage
+   * threads, every frame goes through all the stages before the next one is
+   * read. With them, num_stages+1 frames are in flight, so that every stage
+   * has a frame to work on while the next one is read.
+   * @param frames source of frames.
+   * @param output output stream or buffer.
+   * @return true if it was successful, false otherwise.
+   */
+  template <typename Frames, typename Output>
+  bool compressPipeline(Frames& frames, Output& output)
+  {
+    std::vector<PipelineFrame> slots(stage_threads ? num_stages+1 : 1);
+    std::vector<PipelineFrame *> idle;
+    for(size_t i = 0; i < slots.size(); ++i) idle.push_back(&slots[i]);
+    /* queues[k] feeds the stage k, and queues[num_stages] the writer. They
+       can hold all the frames, so pushing never blocks. */
+    StageQueue * queues[MAX_STAGES+1];
+    std::vector<std::thread> workers;
+    if ( stage_threads ) {
+      for(size_t k = 0; k <= num_stages; ++k) queues[k] = new StageQueue(slots.size());
+      for(size_t k = 0; k < num_stages; ++k)
+	workers.push_back(std::thread(&FramedCompressor::stageWork, this, k, queues[k], queues[k+1]));
+    }
+
+    uint32_t content_crc = 0;
+    size_t in_flight = 0;
+    bool ok = true, end = false;
+    while ( ok ) {
+      PipelineFrame * f;
+      if ( !end && !idle.empty() ) {
+	const char * p = 0;
+	size_t n;
+	{
+	  SCOMPRESSOR_STATS_PHASE(stats, READ);
+	  SCOMPRESSOR_TRACE("read frame", "io");
+	  n = frames.next(p);
+	}
+	if ( n == 0 ) {
+	  end = true;
+	  if ( stage_threads ) queues[0]->close();
+	  continue;
+	}
+	f = idle.back();
+	idle.pop_back();
+	if ( checksums ) {
+	  f->crc = CRC32C::compute(p, n);
+	  content_crc = CRC32C::update(content_crc, p, n);
+	}
+	f->data = filters.encode(p, n, f->filtered[0], f->filtered[1]);
+	/* The frames of a stream are read to the same buffer, so the stages
+	   need a copy of their own. */
+	if ( stage_threads && f->data == p ) {
+	  if ( f->filtered[0].size() < n ) f->filtered[0].resize(n);
+	  memcpy(&f->filtered[0][0], p, n);
+	  f->data = &f->filtered[0][0];
+	}
+	f->n = n;
+	f->stored = false;
+	for(size_t k = 0; k < num_stages; ++k)
+	  if ( f->output[k].size() < n ) f->output[k].resize(n);
+	if ( stage_threads ) {
+	  queues[0]->push(f);
+	  ++in_flight;
+	  continue;
+	}
+	for(size_t k = 0; k < num_stages; ++k) runStage(k, *f);
+      } else if ( in_flight > 0 ) {
+	if ( !queues[num_stages]->pop(f) ) { ok = false; break; }
+	--in_flight;
+      } else break;
+      ok = writePipelineFrame(*f, output);
+      idle.push_back(f);
+    }
+
+    if ( stage_threads ) {
+      for(size_t k = 0; k <= num_stages; ++k) queues[k]->close();
+      for(size_t k = 0; k < workers.size(); ++k) workers[k].join();
+      for(size_t k = 0; k <= num_stages; ++k) delete queues[k];
+    }
+    if ( !ok || frames.bad() ) return false;
+
+    char e[5];
+    e[0] = FRAME_END;
+    putU32(e+1, content_crc);
+    return output.write(e, checksums ? 5 : 1).good();
+  }
+
+  /**
+   * @brief Compresses all the frames.
+   * @param frames source of frames.
+   * @param output output stream or buffer.
+   * @return true if it was successful, false otherwise.
+   */
+  template <typename Frames, typename Output>
+  bool compressFrames(Frames& frames, Output& output)
+  {
+    MemoryAccount::Scope scope(memory);
+    if ( num_stages > 0 ) return compressPipeline(frames, output);
+    if ( method > AUTO ) return false;
+    uint32_t content_crc = 0;
+    const char * p = 0;
+    size_t n;
+    for(;;) {
+      {
+	SCOMPRESSOR_STATS_PHASE(stats, READ);
+	SCOMPRESSOR_TRACE("read frame", "io");
+	n = frames.next(p);
+      }
+      if ( n == 0 ) break;
+      /* The checksums are computed on the frame as it was read. */
+      const char * orig = p;
+      p = filters.encode(p, n, fbuffer[0], fbuffer[1]);
+      /* The compressed frame must be smaller than the input; otherwise the
+	 compressor gives up as soon as it runs out of space and the frame
+	 is stored. */
+      if ( cbuffer.size() < FRAME_HEADER_SIZE+n+4 ) cbuffer.resize(FRAME_HEADER_SIZE+n+4);
+      char * frame = &cbuffer[0];
+      FrameChoice choice;
+      size_t c = BUFFER_ERROR;
+      {
+	SCOMPRESSOR_TRACE("compress frame", "compress");
+	choice = chooseMethod(p, n);
+	/* A sample from the start of big frames is compressed first, so that
+	   hopeless data (already compressed, encrypted...) is detected quickly.
+	   After a shuffle the start is a single byte plane, not a sample. */
+	if ( n < 2*PROBE_SIZE || filters.reorders() ||
+	     compressFrame(choice, p, PROBE_SIZE, frame+FRAME_HEADER_SIZE, PROBE_SIZE-1) != BUFFER_ERROR )
+	  c = compressFrame(choice, p, n, frame+FRAME_HEADER_SIZE, n-1);
+      }
+      uint8_t m = choice.method;
+      if ( c == BUFFER_ERROR ) {
+	m = FRAME_STORED;
+	c = n;
+	memcpy(frame+FRAME_HEADER_SIZE, p, n);
+      }
+
+      frame[0] = m;
+      putU32(frame+1, n);
+      putU32(frame+5, c);
+      c += FRAME_HEADER_SIZE;
+      if ( checksums ) {
+	uint32_t crc = CRC32C::compute(orig, n);
+	content_crc = CRC32C::update(content_crc, orig, n);
+	putU32(frame+c, crc);
+	c += 4;
+      }
+      SCOMPRESSOR_STATS_PHASE(stats, WRITE);
+      SCOMPRESSOR_TRACE("write frame", "io");
+      if ( !output.write(frame, c).good() ) return false;
+    }
+    if ( frames.bad() ) return false;
+
+    char end[5];
+    end[0] = FRAME_END;
+    putU32(end+1, content_crc);
+    return output.write(end, checksums ? 5 : 1).good();
+  }
+
+  /**
+   * @brief Decompresses a frame compressed with a pipeline, applying its
+   * stages in reverse order.
+   * @param chain methods of the stages.
+   * @param count number of stages.
+   * @param p compressed data of the frame.
+   * @param n size of the compressed data, in bytes.
+   * @param dst buffer for the uncompressed frame.
+   * @param usize size of the uncompressed frame, in bytes.
+   * @return true if it was successful, false otherwise.
+   */
+  bool decompressPipeline(const uint8_t * chain, size_t count, const char * p, size_t n,
+			  char * dst, size_t usize)
+  {
+    size_t hsize = pipelineHeaderSize(count);
+    if ( n < hsize ) return false;
+    const char * src = p+hsize;
+    size_t len = n-hsize;
+    for(size_t k = count; k-- > 0; ) {
+      size_t out = usize;
+      char * o = dst;
+      if ( k > 0 ) {
+	/* The stages only produce outputs smaller than the frame. */
+	out = getU32(p+4*(k-1));
+	if ( out >= usize ) return false;
+	Buffer& b = pbuffer[k & 1];
+	if ( b.size() < out+1 ) b.resize(out+1);
+	o = &b[0];
+      }
+      if ( getCompressor(chain[k])->decompress(src, len, o, out) != out ) return false;
+      src = o;
+      len = out;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Decompresses all the frames.
+   * @param input input stream or buffer.
+   * @param output output stream or buffer.
+   * @return true if it was successful, false otherwise.
+   */
+  template <typename Input, typename Output>
+  bool decompressFrames(Input& input, Output& output)
+  {
+    MemoryAccount::Scope scope(memory);
+    const char * h = input.read(2);
+    if ( h == 0 || (unsigned char)h[0] != FORMAT_VERSION ) return false;
+    uint8_t flags = h[1];
+    if ( flags & ~KNOWN_FLAGS ) return false;
+    uint64_t content_size = 0;
+    if ( flags & FLAG_CONTENT_SIZE ) {
+      if ( (h = input.read(8)) == 0 ) return false;
+      content_size = ((uint64_t)getU32(h) << 32) | getU32(h+4);
+    }
+    /* The filters of the data, which may differ from the ones set to compress. */
+    FilterChain chain;
+    if ( flags & FLAG_FILTERS ) {
+      if ( (h = input.read(1)) == 0 ) return false;
+      size_t count = (unsigned char)h[0];
+      if ( count > FilterChain::MAX_FILTERS || (h = input.read(2*count)) == 0 ||
+	   !chain.deserialize(h, count) ) return false;
+    }
+    /* The pipeline of the data. */
+    uint8_t pipeline[MAX_STAGES];
+    size_t pipeline_size = 0;
+    if ( flags & FLAG_PIPELINE ) {
+      if ( (h = input.read(1)) == 0 ) return false;
+      pipeline_size = (unsigned char)h[0];
+      if ( pipeline_size < 2 || pipeline_size > MAX_STAGES ||
+	   (h = input.read(pipeline_size)) == 0 ) return false;
+      for(size_t k = 0; k < pipeline_size; ++k)
+	if ( (pipeline[k] = h[k]) >= NUM_METHODS ) return false;
+    }
+
+    uint32_t content_crc = 0;
+    uint64_t total = 0;
+    for(;;) {
+      h = input.read(1);
+      if ( h == 0 ) return false;
+      uint8_t m = h[0];
+      if ( m == FRAME_END ) break;
+      if ( (h = input.read(8)) == 0 ) return false;
+      size_t usize = getU32(h), csize = getU32(h+4);
+      bool piped = (m == FRAME_PIPELINE && pipeline_size > 0);
+      GenericCompressor * compr = (m == FRAME_STORED || piped ? 0 : getCompressor(m));
+      if ( (compr == 0 && m != FRAME_STORED && !piped) || usize > MAX_FRAME_SIZE ||
+	   csize > MAX_FRAME_SIZE ) return false;
+      if ( m == FRAME_STORED && csize != usize ) return false;
+
+      const char * payload;
+      {
+	SCOMPRESSOR_TRACE("read frame", "io");
+	payload = input.read(csize);
+      }
+      if ( payload == 0 ) return false;
+      char * dst = outputSpace(output, usize);
+      if ( dst == 0 ) return false;
+      {
+	SCOMPRESSOR_TRACE("decompress frame", "decompress");
+	if ( piped ) {
+	  if ( !decompressPipeline(pipeline, pipeline_size, payload, csize, dst, usize) ) return false;
+	} else if ( compr == 0 ) memcpy(dst, payload, usize);
+	else if ( compr->decompress(payload, csize, dst, usize) != usize ) return false;
+	chain.decode(dst, usize, fbuffer[0]);
+      }
+
+      if ( flags & FLAG_FRAME_CHECKSUM ) {
+	if ( (h = input.read(4)) == 0 ) return false;
+	if ( getU32(h) != CRC32C::compute(dst, usize) ) return false;
+      }
+      if ( flags & FLAG_CONTENT_CHECKSUM )
+	content_crc = CRC32C::update(content_crc, dst, usize);
+      SCOMPRESSOR_STATS_PHASE(stats, WRITE);
+      SCOMPRESSOR_TRACE("write frame", "io");
+      if ( !commitOutput(output, dst, usize) ) return false;
+      total += usize;
+    }
+    if ( (flags & FLAG_CONTENT_SIZE) && total != content_size ) return false;
+
+    if ( flags & FLAG_CONTENT_CHECKSUM ) {
+      if ( (h = input.read(4)) == 0 ) return false;
+      if ( getU32(h) != content_crc ) return false;
+    }
+    return true;
+  }
+
+public:
+  /**
+   * @brief Constructor.
+   * @param m method used to compress the frames.
+   * @param checksum whether the frame and content checksums are written.
+   * @param fsize size of the frames, in bytes.
+   */
+  FramedCompressor(uint8_t m = LZW, bool checksum = false, size_t fsize = DEFAULT_FRAME_SIZE)
+    : method(m), frame_size(fsize), checksums(checksum), num_stages(0), stage_threads(false)
+  {
+    for(int i = 0; i < NUM_METHODS; ++i) compressors[i] = 0;
+    for(size_t k = 0; k < MAX_STAGES; ++k) stage_compressors[k] = 0;
+  }
+
+  /**
+   * @brief Sets the filters applied to the frames before compressing them.
+   * The decompression uses the filters written in the header.
+   */
+  void setFilters(const FilterChain& f)
+  { filters = f; }
+
+  /**
+   * @brief Returns the filters applied to the frames before compressing them.
+   */
+  const FilterChain& getFilters() const
+  { return filters; }
+
+  /**
+   * @brief Compresses the frames with a pipeline of compressors, the output
+   * of each one being the input of the next. The decompression uses the
+   * pipeline written in the header.
+   *
+   * With stage threads, the memory resource must be thread-safe, since the
+   * stages allocate from it at the same time.
+   * @param m methods of the stages, in the order they are applied. A single
+   * method is the same as the one of the constructor; AUTO is only valid alone.
+   * @param count number of stages (1 to MAX_STAGES).
+   * @param threads whether every stage runs on a thread of its own.
+   * @return false if the pipeline is not valid, true otherwise.
+   */
+  bool setPipeline(const uint8_t * m, size_t count, bool threads = false)
+  {
+    if ( count == 0 || count > MAX_STAGES ) return false;
+    for(size_t k = 0; k < count; ++k)
+      if ( m[k] > AUTO || (m[k] == AUTO && count > 1) ) return false;
+    for(size_t k = 0; k < MAX_STAGES; ++k) {
+      delete stage_compressors[k];
+      stage_compressors[k] = 0;
+    }
+    method = m[0];
+    num_stages = (count > 1 ? count : 0);
+    /* They are created here, out of the scope of the memory account of the
+       container, since the stage threads free the memory they allocate. */
+    for(size_t k = 0; k < num_stages; ++k) {
+      stages[k] = m[k];
+      stage_compressors[k] = newCompressor(m[k]);
+    }
+    stage_threads = threads;
+    return true;
+  }
+
+  /**
+   * @brief Returns the number of stages of the pipeline (0 if the frames are
+   * compressed with a single method).
+   */
+  size_t getPipelineSize() const
+  { return num_stages; }
+
+  /**
+   * @brief Destructor.
+   */
+  ~FramedCompressor()
+  {
+    for(int i = 0; i < NUM_METHODS; ++i) delete compressors[i];
+    for(size_t k = 0; k < MAX_STAGES; ++k) delete stage_compressors[k];
+  }
+
+  bool compress(std::istream& input, std::ostream& output)
+  {
+    if ( !writeHeader(output, 0, false) ) return false;
+    MemoryAccount::Scope scope(memory);
+    ubuffer.resize(frame_size);
+    StreamFrames frames = { input, ubuffer };
+    return compressFrames(frames, output);
+  }
+
+  bool compress(const void * src, size_t n, std::ostream& output)
+  {
+    if ( !writeHeader(output, n, true) ) return false;
+    SpanFrames frames = { (const char *)src, n, frame_size };
+    return compressFrames(frames, output);
+  }
+
+  size_t compress(const void * src, size_t n, void * dst, size_t cap)
+  {
+    ByteBufferWriter output(dst, cap);
+    if ( !writeHeader(output, n, true) ) return BUFFER_ERROR;
+    SpanFrames frames = { (const char *)src, n, frame_size };
+    if ( !compressFrames(frames, output) ) return BUFFER_ERROR;
+    return output.size();
+  }
+
+  /* The sizes of corrupt data may not fit in memory: the decompression
+     fails instead of throwing std::bad_alloc. */
+
+  bool decompress(std::istream& input, std::ostream& output)
+  {
+    StreamInput in = { input, cbuffer };
+    try {
+      return decompressFrames(in, output);
+    } catch ( std::bad_alloc& ) {
+      return false;
+    }
+  }
+
+  bool decompress(const void * src, size_t n, std::ostream& output)
+  {
+    SpanInput in = { (const char *)src, n };
+    try {
+      return decompressFrames(in, output);
+    } catch ( std::bad_alloc& ) {
+      return false;
+    }
+  }
+
+  size_t decompress(const void * src, size_t n, void * dst, size_t cap)
+  {
+    SpanInput in = { (const char *)src, n };
+    ByteBufferWriter output(dst, cap);
+    try {
+      if ( !decompressFrames(in, output) ) return BUFFER_ERROR;
+    } catch ( std::bad_alloc& ) {
+      return BUFFER_ERROR;
+    }
+    return output.size();
+  }
+
+  /**
+   * @brief Returns the size of the content, if it is stored in the header.
+   *
+   * The size is not trusted if the frames that fit in the compressed data
+   * could not hold it, since it has not been checked against them yet.
+   * @param src compressed data.
+   * @param n size of the compressed data, in bytes.
+   * @param[out] size size of the content, in bytes.
+   * @return true if the size is known, false otherwise.
+   */
+  bool getDecompressedSize(const void * src, size_t n, size_t& size) const
+  {
+    const char * h = (const char *)src;
+    if ( n < 10 || (unsigned char)h[0] != FORMAT_VERSION || !(h[1] & FLAG_CONTENT_SIZE) )
+      return false;
+    uint64_t s = ((uint64_t)getU32(h+2) << 32) | getU32(h+6);
+    if ( s != (size_t)s ) return false;
+    /* Every frame takes FRAME_HEADER_SIZE bytes at least and holds MAX_FRAME_SIZE at most. */
+    if ( s > (uint64_t)(n/FRAME_HEADER_SIZE)*MAX_FRAME_SIZE ) return false;
+    size = s;
+    return true;
+  }
+
+  /**
+   * @brief Returns the maximum size of the compressed data.
+   * @param n size of the uncompressed data, in bytes.
+   * @return maximum size of the compressed data, in bytes.
+   */
+  size_t getCompressBound(size_t n) const
+  {
+    size_t frames = (n+frame_size-1)/frame_size;
+    return 10 + FilterChain::MAX_SERIALIZED_SIZE + 1 + MAX_STAGES + 5 +
+      frames*(FRAME_HEADER_SIZE+4) + n;
+  }
+
+  /**
+   * @brief Returns the statistics of the container merged with the ones of
+   * the compressors used for the frames.
+   * @return statistics.
+   */
+  const CompressorStats& getStats()
+  {
+    merged = GenericCompressor::getStats();
+    for(int i = 0; i < NUM_METHODS; ++i)
+      if ( compressors[i] != 0 ) merged.merge(compressors[i]->getStats());
+    for(size_t k = 0; k < MAX_STAGES; ++k)
+      if ( stage_compressors[k] != 0 ) merged.merge(stage_compressors[k]->getStats());
+    return merged;
+  }
+
+  void setMemoryResource(MemoryResource * r)
+  {
+    releaseMemory();
+    memory.setResource(r);
+    for(int i = 0; i < NUM_METHODS; ++i)
+      if ( compressors[i] != 0 ) compressors[i]->setMemoryResource(r);
+    for(size_t k = 0; k < MAX_STAGES; ++k)
+      if ( stage_compressors[k] != 0 ) stage_compressors[k]->setMemoryResource(r);
+  }
+
+  void releaseMemory()
+  {
+    Buffer().swap(ubuffer);
+    Buffer().swap(cbuffer);
+    for(int i = 0; i < 2; ++i) {
+      Buffer().swap(fbuffer[i]);
+      Buffer().swap(pbuffer[i]);
+    }
+    for(int i = 0; i < NUM_METHODS; ++i)
+      if ( compressors[i] != 0 ) compressors[i]->releaseMemory();
+    for(size_t k = 0; k < MAX_STAGES; ++k)
+      if ( stage_compressors[k] != 0 ) stage_compressors[k]->releaseMemory();
+  }
+
+  void resetStats()
+  {
+    stats.reset();
+    for(int i = 0; i < NUM_METHODS; ++i)
+      if ( compressors[i] != 0 ) compressors[i]->resetStats();
+    for(size_t k = 0; k < MAX_STAGES; ++k)
+      if ( stage_compressors[k] != 0 ) stage_compressors[k]->resetStats();
+  }
+};
+
+#endif
@@ -8,12 +8,35 @@
 #ifndef __GENERICCOMPRESSOR_HPP__
 #define __GENERICCOMPRESSOR_HPP__
 
+#include <iostream>
+#include <cstddef>
+#include <CompressorStats.hpp>
+#include <MemoryAccount.hpp>
+
 /**
  * @class GenericCompressor
  * @brief Abstract class that defines the methods that all the compressors must provide.
+ *
+ * Data can be compressed from a stream to another stream, or from a memory buffer
+ * to another memory buffer. Both methods produce exactly the same compressed format.
  */
 class GenericCompressor {
+protected:
+  /** Timers and counters of the compressor (see CompressorStats). */
+  CompressorStats stats;
+  /** Memory allocated by the compressor. It must be charged through a
+      MemoryAccount::Scope wherever the compressor allocates. */
+  MemoryAccount memory;
+
 public:
+  /** Value returned by the buffer-to-buffer methods when they fail. */
+  static const size_t BUFFER_ERROR = (size_t)-1;
+
+  /**
+   * @brief Destructor.
+   */
+  virtual ~GenericCompressor() { }
+
   /**
    * @brief Compresses data from the input stream and the result is written to the output stream.
    * @param input input stream to be compressed.
@@ -29,7 +52,107 @@ public:
    * @return true if the decompression was successful, false if it was not.
    */
   virtual bool decompress(std::istream& input, std::ostream& output) = 0;
+
+  /**
+   * @brief Compresses a memory buffer and the result is written to the output stream.
+   * @param src data to be compressed.
+   * @param n size of the data to be compressed, in bytes.
+   * @param output output stream where the compressed data will be written.
+   * @return true if the compression was successful, false if it was not.
+   */
+  virtual bool compress(const void * src, size_t n, std::ostream& output) = 0;
+
+  /**
+   * @brief Decompresses a memory buffer and the result is written to the output stream.
+   * @param src data to be decompressed.
+   * @param n size of the data to be decompressed, in bytes.
+   * @param output output stream where the decompressed data will be written.
+   * @return true if the decompression was successful, false if it was not.
+   */
+  virtual bool decompress(const void * src, size_t n, std::ostream& output) = 0;
+
+  /**
+   * @brief Compresses a memory buffer and the result is written to another memory buffer.
+   * @param src data to be compressed.
+   * @param n size of the data to be compressed, in bytes.
+   * @param dst buffer where the compressed data will be written.
+   * @param cap capacity of dst, in bytes. getCompressBound(n) bytes are always enough.
+   * @return size of the compressed data, or BUFFER_ERROR if the compression failed.
+   */
+  virtual size_t compress(const void * src, size_t n, void * dst, size_t cap) = 0;
+
+  /**
+   * @brief Decompresses a memory buffer and the result is written to another memory buffer.
+   * @param src data to be decompressed.
+   * @param n size of the data to be decompressed, in bytes.
+   * @param dst buffer where the decompressed data will be written.
+   * @param cap capacity of dst, in bytes.
+   * @return size of the decompressed data, or BUFFER_ERROR if the decompression failed.
+   */
+  virtual size_t decompress(const void * src, size_t n, void * dst, size_t cap) = 0;
+
+  /**
+   * @brief Determines the size of the decompressed data from the header of the
+   * compressed data, when the format stores it.
+   * @param src compressed data.
+   * @param n size of the compressed data, in bytes.
+   * @param[out] size size of the decompressed data, in bytes.
+   * @return true if the size is known, false otherwise.
+   */
+  virtual bool getDecompressedSize(const void * src, size_t n, size_t& size) const
+  { return false; }
+
+  /**
+   * @brief Returns the maximum size of the compressed data, using the default
+   * parameters of the compressor.
+   * @param n size of the uncompressed data, in bytes.
+   * @return maximum size of the compressed data, in bytes.
+   */
+  virtual size_t getCompressBound(size_t n) const = 0;
+
+  /**
+   * @brief Changes the resource of the memory the compressor allocates from
+   * now on (windows, buffers, dictionaries and tree nodes).
+   * @param r resource, or NULL to use MemoryResource::getDefault(). It must
+   * outlive the memory allocated from it.
+   */
+  virtual void setMemoryResource(MemoryResource * r)
+  {
+    releaseMemory();
+    memory.setResource(r);
+  }
+
+  /**
+   * @brief Frees the working memory the compressor keeps between calls.
+   *
+   * Windows, buffers and dictionaries are kept after every call and reset at
+   * the start of the next one, so a compressor used for many small inputs
+   * allocates them only once. They are freed when the compressor is destroyed,
+   * when its memory resource changes or when this method is called (i.e.
+   * before the resource is released).
+   */
+  virtual void releaseMemory() { }
+
+  /**
+   * @brief Returns the timers and counters accumulated since the compressor was
+   * created (or since resetStats() was called), and its memory usage.
+   * @return statistics.
+   */
+  virtual const CompressorStats& getStats()
+  {
+    stats.setMemory(memory.getCurrent(), memory.getPeak(), memory.getAllocations());
+    return stats;
+  }
+
+  /**
+   * @brief Sets the timers and counters to zero, and starts measuring the
+   * peak memory again.
+   */
+  virtual void resetStats()
+  {
+    stats.reset();
+    memory.resetPeak();
+  }
 };
 
 #endif
-
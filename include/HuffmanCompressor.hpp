@@ -12,8 +12,11 @@
 #include <GenericCompressor.hpp>
 #include <NullSource.hpp>
 #include <HuffmanTree.hpp>
-#include <BitStreamWriter.hpp>
-#include <BitStreamReader.hpp>
+#include <BitWriter.hpp>
+#include <BitReader.hpp>
+#include <BitBufferWriter.hpp>
+#include <BitBufferReader.hpp>
+#include <ByteBuffer.hpp>
 #include <Bit.hpp>
 
 /**
@@ -57,10 +60,11 @@ private:
 
   /** 
    * @brief Writes the header to the output stream.
-   * @param output binary stream writer.
+   * @param output binary writer.
    * @return true if it was successful, false otherwise.
    */
-  inline bool writeHeader(BitStreamWriter& output)
+  template <typename BitWriter>
+  inline bool writeHeader(BitWriter& output)
   {
     if( !output.put(COMPRESSOR_VERSION, 8).good() ) return false;
     if( !output.put(numCompressedSymbols, 32).good() ) return false;
@@ -70,14 +74,16 @@ private:
 
   /** 
    * @brief Reads the header from the input stream.
-   * @param input binary stream reader.
+   * @param input binary reader.
    * @return true if it was successful, false otherwise.
    */
-  inline bool readHeader(BitStreamReader& input)
+  template <typename BitReader>
+  inline bool readHeader(BitReader& input)
   {
     unsigned char version = input.get(8);
     if ( version != COMPRESSOR_VERSION) return false;
     numCompressedSymbols = input.get(32);
+    MemoryAccount::Scope scope(memory);
     if( numCompressedSymbols > 0 && !(huffman.deserializeTree(input)) ) return false;
     if ( !input.good() ) return false;
     return true;
@@ -91,11 +97,43 @@ private:
    */
   inline bool readUncompressedData(std::istream& input) 
   {
-    if( !source.LoadFromStream(input) ) return false;
+    {
+      SCOMPRESSOR_STATS_PHASE(stats, HISTOGRAM);
+      if( !source.LoadFromStream(input) ) return false;
+    }
     numCompressedSymbols = source.getReadSymbols();
+    buildCodification();
+    return true;
+  }
+
+  /**
+   * @brief Reads the uncompressed data from a memory buffer and creates the null memory
+   * source and computes its optimal codification.
+   * @param input data to be compressed.
+   * @param n size of the data, in bytes.
+   */
+  inline void readUncompressedData(const char * input, size_t n)
+  {
+    {
+      SCOMPRESSOR_STATS_PHASE(stats, HISTOGRAM);
+      source.LoadFromBuffer(input, n);
+    }
+    numCompressedSymbols = source.getReadSymbols();
+    buildCodification();
+  }
+
+  /**
+   * @brief Builds the Huffman tree of the null memory source and its codification.
+   */
+  inline void buildCodification()
+  {
+    MemoryAccount::Scope scope(memory);
+    SCOMPRESSOR_STATS_PHASE(stats, TREE_BUILD);
     huffman.buildTree(source);
     codification = huffman.getCodification();
-    return true;
+    SCOMPRESSOR_STATS_ADD(stats, HUFFMAN_SYMBOLS, numCompressedSymbols);
+    SCOMPRESSOR_STATS_ADD(stats, HUFFMAN_CODE_BITS,
+			  (uint64_t)(huffman.getMedianLength(numCompressedSymbols)*numCompressedSymbols+0.5));
   }
 
   /**
@@ -104,8 +142,9 @@ private:
    * @param output binary stream writer.
    * @return true if it was successful, false otherwise.
    */
-  bool writeCompressedData(std::istream& input, BitStreamWriter& output)
+  bool writeCompressedData(std::istream& input, BitWriter<StreamSink>& output)
   {
+    SCOMPRESSOR_STATS_PHASE(stats, BIT_OUTPUT);
     /* We need to read all the data again. */
     input.clear();
     input.seekg(0, std::ios::beg);
@@ -128,14 +167,39 @@ private:
   }
 
   /**
-   * @brief Read the compressed data using a binary stream reader and writes the uncompressed
-   * data to a output stream.
-   * @param input binary stream reader.
-   * @param output output stream.
+   * @brief Writes the compressed data of a memory buffer using a binary writer.
+   * @param input data to be compressed.
+   * @param n size of the data, in bytes.
+   * @param output binary writer.
    * @return true if it was successful, false otherwise.
    */
-  bool writeUncompressedData(BitStreamReader& input, std::ostream& output) 
+  template <typename BitWriter>
+  bool writeCompressedData(const char * input, size_t n, BitWriter& output)
   {
+    SCOMPRESSOR_STATS_PHASE(stats, BIT_OUTPUT);
+    if ( codification.size() <= 1 ) return true;
+
+    for(size_t i = 0; i < n; ++i) {
+      const std::vector<Bit>& cod = codification[input[i]];
+      for(std::vector<Bit>::const_iterator it = cod.begin(); it != cod.end(); ++it)
+	output.put(*it);
+      if( !output.good() ) return false;
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Read the compressed data using a binary reader and writes the uncompressed
+   * data to a output stream or buffer.
+   * @param input binary reader.
+   * @param output output stream or buffer.
+   * @return true if it was successful, false otherwise.
+   */
+  template <typename BitReader, typename Output>
+  bool writeUncompressedData(BitReader& input, Output& output) 
+  {
+    SCOMPRESSOR_STATS_PHASE(stats, DECODE);
     size_t read_symbols = 0;
 
     /* If no symbols were compressed, it is done. */
@@ -175,7 +239,7 @@ private:
 public:
   bool compress(std::istream& input, std::ostream& output) 
   {
-    BitStreamWriter bos(output);
+    BitWriter<StreamSink> bos(output);
     if ( !readUncompressedData(input) ) return false;
     if ( !writeHeader(bos) ) return false;
     if ( !writeCompressedData(input, bos) ) return false;
@@ -186,11 +250,88 @@ public:
   
   bool decompress(std::istream& input, std::ostream& output)
   {
-    BitStreamReader bis(input);
+    BitReader<StreamSource> bis(input);
     if ( !readHeader(bis) ) return false;
     if ( !writeUncompressedData(bis, output) ) return false;
     return true;
   }
+
+  bool compress(const void * src, size_t n, std::ostream& output)
+  {
+    if ( n > 0xFFFFFFFFul ) return false;
+    BitWriter<StreamSink> bos(output);
+    readUncompressedData((const char *)src, n);
+    if ( !writeHeader(bos) ) return false;
+    if ( !writeCompressedData((const char *)src, n, bos) ) return false;
+    bos.flush();
+    if ( !bos.good() ) return false;
+    return true;
+  }
+
+  bool decompress(const void * src, size_t n, std::ostream& output)
+  {
+    BitBufferReader bis(src, n);
+    if ( !readHeader(bis) ) return false;
+    if ( !writeUncompressedData(bis, output) ) return false;
+    return true;
+  }
+
+  size_t compress(const void * src, size_t n, void * dst, size_t cap)
+  {
+    /* The compressed format stores the number of symbols using 32 bits. */
+    if ( n > 0xFFFFFFFFul ) return BUFFER_ERROR;
+    BitBufferWriter bos(dst, cap);
+    readUncompressedData((const char *)src, n);
+    if ( !writeHeader(bos) ) return BUFFER_ERROR;
+    if ( !writeCompressedData((const char *)src, n, bos) ) return BUFFER_ERROR;
+    if ( !bos.flush().good() ) return BUFFER_ERROR;
+    return bos.size();
+  }
+
+  size_t decompress(const void * src, size_t n, void * dst, size_t cap)
+  {
+    BitBufferReader bis(src, n);
+    ByteBufferWriter output(dst, cap);
+    if ( !readHeader(bis) ) return BUFFER_ERROR;
+    if ( !writeUncompressedData(bis, output) ) return BUFFER_ERROR;
+    return output.size();
+  }
+
+  /**
+   * @brief Determines the size of the decompressed data from the header.
+   *
+   * It is the number of compressed symbols stored after the version number.
+   * @param src compressed data.
+   * @param n size of the compressed data, in bytes.
+   * @param[out] size size of the decompressed data, in bytes.
+   * @return true if the header is valid, false otherwise.
+   */
+  bool getDecompressedSize(const void * src, size_t n, size_t& size) const
+  {
+    BitBufferReader bis(src, n);
+    if ( bis.get(8) != COMPRESSOR_VERSION ) return false;
+    size = bis.get(32);
+    return bis.good();
+  }
+
+  /**
+   * @brief Returns the maximum size of the compressed data.
+   *
+   * The header takes 40 bits plus the serialized tree, which has at most 256 leaves
+   * (9 bits each) and 255 internal nodes (1 bit each). Since the Huffman code is optimal,
+   * the data never takes more than 8 bits per symbol.
+   * @param n size of the uncompressed data, in bytes.
+   * @return maximum size of the compressed data, in bytes.
+   */
+  static size_t compressBound(size_t n)
+  {
+    return (40 + 256*9 + 255 + 7)/8 + n;
+  }
+
+  size_t getCompressBound(size_t n) const
+  {
+    return compressBound(n);
+  }
 };
 
 const unsigned char HuffmanCompressor::COMPRESSOR_VERSION = 1;
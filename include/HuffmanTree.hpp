@@ -15,11 +15,12 @@
 
 #include <cassert>
 
+#include <MemoryAccount.hpp>
 #include <NullSource.hpp>
 #include <Codification.hpp>
 #include <Bit.hpp>
-#include <BitStreamWriter.hpp>
-#include <BitStreamReader.hpp>
+#include <BitWriter.hpp>
+#include <BitReader.hpp>
 
 /**
  * @class HuffmanTree
@@ -65,6 +66,13 @@ private:
       : weight(weight), lchild(left), rchild(right)			       
     { }
 
+    /** The nodes are charged to the account of the compressor. */
+    static void * operator new(size_t n)
+    { return MemoryAccount::allocate(n); }
+
+    static void operator delete(void * p)
+    { MemoryAccount::deallocate(p); }
+
     /**
      * @brief Destructor.
      */
@@ -169,6 +177,8 @@ public:
   void clear(void)
   {
     if(root != NULL) delete root;
+    root = NULL;
+    curr_node = NULL;
   }
   
   /**
@@ -323,10 +333,11 @@ public:
    * escriptor de fluxe binari. 
    *
    * Utilitza l'algorisme de serialització vist en classe.
-   * @param output escriptor de fluxe d'eixida binari.
+   * @param output escriptor de fluxe d'eixida binari (BitWriter o BitStreamWriter).
    * @return true si tot ha anat bé, false en cas d'error.
    */
-  bool serializeTree(BitStreamWriter& output) const
+  template <typename BitWriter>
+  bool serializeTree(BitWriter& output) const
   { 
     if( root == NULL ) return true;
     
@@ -354,13 +365,14 @@ public:
    * lector de fluxe binari.
    *
    * Utilitza l'algorisme de deserialització vist en classe.
-   * @param input lector de fluxe d'entrada binari.
+   * @param input lector de fluxe d'entrada binari (BitReader o BitStreamReader).
    * @return true si tot ha anat bé, false en cas d'error.
    */
-  bool deserializeTree(BitStreamReader& input) {
+  template <typename BitReader>
+  bool deserializeTree(BitReader& input) {
     clear();
 
-    root = new HNode(0, NULL, NULL);
+    root = NULL;
     std::stack<HNode **> active_nodes;
     active_nodes.push(&root);
 
@@ -0,0 +1,301 @@
+/**
+ * @file IoUring.hpp
+ * @brief File including the implementation of IoUring class.
+ */
+
+#ifndef __IOURING_HPP__
+#define __IOURING_HPP__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define SCOMPRESSOR_HAVE_IO_URING 1
+#endif
+
+/**
+ * @class IoUring
+ * @brief Minimal wrapper of a Linux io_uring instance.
+ *
+ * It talks to the kernel directly through the io_uring_setup(), io_uring_enter()
+ * and io_uring_register() system calls, so no external library is needed.
+ * Only reads and writes at explicit offsets are supported, optionally on
+ * registered (fixed) buffers. The requests are queued by read() and write()
+ * and handed to the kernel in batches by submit(), so a single system call
+ * starts several of them. If the kernel does not support io_uring,
+ * or it is not allowed to be used, init() fails and the caller must fall back
+ * to regular system calls.
+ */
+class IoUring {
+#ifdef SCOMPRESSOR_HAVE_IO_URING
+private:
+  /** Ring file descriptor. */
+  int ring_fd;
+  /** Setup parameters returned by the kernel. */
+  struct io_uring_params params;
+  /** Mapping of the submission queue ring. */
+  void * sq_ptr;
+  /** Size of the submission queue ring mapping. */
+  size_t sq_size;
+  /** Mapping of the completion queue ring. */
+  void * cq_ptr;
+  /** Size of the completion queue ring mapping. */
+  size_t cq_size;
+  /** Submission queue entries. */
+  struct io_uring_sqe * sqes;
+  /** Whether buffers were registered. */
+  bool fixed;
+  /** Number of requests queued and not submitted yet. */
+  unsigned queued;
+
+  /** Pointer to a field of the submission queue ring. */
+  inline unsigned * sq_field(uint32_t off) const
+  { return (unsigned *)((char *)sq_ptr + off); }
+
+  /** Pointer to a field of the completion queue ring. */
+  inline unsigned * cq_field(uint32_t off) const
+  { return (unsigned *)((char *)cq_ptr + off); }
+
+  /**
+   * @brief Queues a request, to be handed to the kernel by submit().
+   * @return true if the request was queued, false if the queue is full.
+   */
+  bool queue(uint8_t opcode, int fd, void * buf, unsigned len,
+	     uint64_t offset, int buf_index, uint64_t user_data)
+  {
+    if ( ring_fd < 0 ) return false;
+    unsigned tail = *sq_field(params.sq_off.tail);
+    if ( tail - __atomic_load_n(sq_field(params.sq_off.head), __ATOMIC_ACQUIRE) >=
+	 params.sq_entries ) return false;
+    unsigned idx = tail & *sq_field(params.sq_off.ring_mask);
+    struct io_uring_sqe * sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = (buf_index >= 0 ? buf_index : 0);
+    sqe->user_data = user_data;
+    sq_field(params.sq_off.array)[idx] = idx;
+    __atomic_store_n(sq_field(params.sq_off.tail), tail+1, __ATOMIC_RELEASE);
+    ++queued;
+    return true;
+  }
+#endif
+
+  /** Non-copyable. */
+  IoUring(const IoUring&);
+  /** Non-copyable. */
+  IoUring& operator = (const IoUring&);
+
+public:
+  /**
+   * @brief Default constructor. The ring must be initialized with init().
+   */
+  IoUring()
+#ifdef SCOMPRESSOR_HAVE_IO_URING
+    : ring_fd(-1), sq_ptr(MAP_FAILED), sq_size(0), cq_ptr(MAP_FAILED), cq_size(0),
+      sqes((struct io_uring_sqe *)MAP_FAILED), fixed(false), queued(0)
+#endif
+  { }
+
+  /**
+   * @brief Destructor.
+   */
+  ~IoUring()
+  { close(); }
+
+  /**
+   * @brief Creates the ring.
+   * @param entries number of entries of the submission queue.
+   * @return true if io_uring is available and the ring was created, false otherwise.
+   */
+  bool init(unsigned entries)
+  {
+#ifdef SCOMPRESSOR_HAVE_IO_URING
+    close();
+    memset(&params, 0, sizeof(params));
+    ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if ( ring_fd < 0 ) return false;
+
+    sq_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    if ( params.features & IORING_FEAT_SINGLE_MMAP )
+      sq_size = cq_size = std::max(sq_size, cq_size);
+
+    sq_ptr = mmap(0, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		  ring_fd, IORING_OFF_SQ_RING);
+    if ( sq_ptr == MAP_FAILED ) { close(); return false; }
+    if ( params.features & IORING_FEAT_SINGLE_MMAP ) cq_ptr = sq_ptr;
+    else {
+      cq_ptr = mmap(0, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    ring_fd, IORING_OFF_CQ_RING);
+      if ( cq_ptr == MAP_FAILED ) { close(); return false; }
+    }
+    sqes = (struct io_uring_sqe *)mmap(0, params.sq_entries*sizeof(struct io_uring_sqe),
+				       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				       ring_fd, IORING_OFF_SQES);
+    if ( sqes == MAP_FAILED ) { close(); return false; }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Registers a set of buffers, so that the kernel does not need to map
+   * them on every request.
+   * @param iov buffers to be registered.
+   * @param n number of buffers.
+   * @return true if the buffers were registered, false otherwise.
+   */
+  bool registerBuffers(const struct iovec * iov, unsigned n)
+  {
+#ifdef SCOMPRESSOR_HAVE_IO_URING
+    if ( ring_fd < 0 ) return false;
+    fixed = (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iov, n) == 0);
+    return fixed;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Queues a read request.
+   * @param fd file descriptor.
+   * @param buf destination buffer.
+   * @param len number of bytes to read.
+   * @param offset position in the file.
+   * @param buf_index index of the registered buffer containing buf.
+   * @param user_data value returned with the completion.
+   * @return true if the request was queued, false otherwise.
+   */
+  bool read(int fd, void * buf, unsigned len, uint64_t offset, int buf_index,
+	    uint64_t user_data)
+  {
+#ifdef SCOMPRESSOR_HAVE_IO_URING
+    return queue(fixed ? IORING_OP_READ_FIXED : IORING_OP_READ,
+		  fd, buf, len, offset, buf_index, user_data);
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Queues a write request.
+   * @param fd file descriptor.
+   * @param buf source buffer.
+   * @param len number of bytes to write.
+   * @param offset position in the file.
+   * @param buf_index index of the registered buffer containing buf.
+   * @param user_data value returned with the completion.
+   * @return true if the request was queued, false otherwise.
+   */
+  bool write(int fd, const void * buf, unsigned len, uint64_t offset, int buf_index,
+	     uint64_t user_data)
+  {
+#ifdef SCOMPRESSOR_HAVE_IO_URING
+    return queue(fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+		  fd, (void *)buf, len, offset, buf_index, user_data);
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Hands the queued requests to the kernel with a single system call.
+   *
+   * The requests the kernel does not take (i.e. when it is short of
+   * resources) are withdrawn from the queue: they are the last ones queued.
+   * @param wait whether to wait for a completion in the same call.
+   * @return number of requests submitted, the first ones queued.
+   */
+  unsigned submit(bool wait = false)
+  {
+#ifdef SCOMPRESSOR_HAVE_IO_URING
+    unsigned n = queued;
+    if ( n == 0 && !wait ) return 0;
+    int r;
+    do r = syscall(__NR_io_uring_enter, ring_fd, n, (wait ? 1 : 0),
+		   (wait ? IORING_ENTER_GETEVENTS : 0), NULL, 0);
+    while ( r < 0 && errno == EINTR );
+    unsigned done = (r > 0 ? std::min((unsigned)r, n) : 0);
+    if ( done < n ) {
+      unsigned tail = *sq_field(params.sq_off.tail);
+      __atomic_store_n(sq_field(params.sq_off.tail), tail-(n-done), __ATOMIC_RELEASE);
+    }
+    queued = 0;
+    return done;
+#else
+    return 0;
+#endif
+  }
+
+  /**
+   * @brief Retrieves a completion, if there is any, without a system call.
+   * @param[out] user_data value given when the request was queued.
+   * @param[out] res result of the request (as returned by pread/pwrite, or -errno).
+   * @return true if a completion was retrieved, false otherwise.
+   */
+  bool peek(uint64_t& user_data, int& res)
+  {
+#ifdef SCOMPRESSOR_HAVE_IO_URING
+    unsigned head = *cq_field(params.cq_off.head);
+    if ( head == __atomic_load_n(cq_field(params.cq_off.tail), __ATOMIC_ACQUIRE) ) return false;
+    struct io_uring_cqe * cqes = (struct io_uring_cqe *)cq_field(params.cq_off.cqes);
+    struct io_uring_cqe * cqe = &cqes[head & *cq_field(params.cq_off.ring_mask)];
+    user_data = cqe->user_data;
+    res = cqe->res;
+    __atomic_store_n(cq_field(params.cq_off.head), head+1, __ATOMIC_RELEASE);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Waits for a completion of a submitted request.
+   * @param[out] user_data value given when the request was queued.
+   * @param[out] res result of the request (as returned by pread/pwrite, or -errno).
+   * @return true if a completion was retrieved, false on error.
+   */
+  bool wait(uint64_t& user_data, int& res)
+  {
+#ifdef SCOMPRESSOR_HAVE_IO_URING
+    for(;;) {
+      if ( peek(user_data, res) ) return true;
+      int r = syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+      if ( r < 0 && errno != EINTR ) return false;
+    }
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Destroys the ring.
+   */
+  void close()
+  {
+#ifdef SCOMPRESSOR_HAVE_IO_URING
+    if ( sqes != MAP_FAILED ) munmap(sqes, params.sq_entries*sizeof(struct io_uring_sqe));
+    if ( cq_ptr != MAP_FAILED && cq_ptr != sq_ptr ) munmap(cq_ptr, cq_size);
+    if ( sq_ptr != MAP_FAILED ) munmap(sq_ptr, sq_size);
+    if ( ring_fd >= 0 ) ::close(ring_fd);
+    ring_fd = -1; fixed = false; queued = 0;
+    sq_ptr = cq_ptr = MAP_FAILED;
+    sqes = (struct io_uring_sqe *)MAP_FAILED;
+#endif
+  }
+};
+
+#endif
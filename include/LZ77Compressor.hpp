@@ -9,10 +9,15 @@
 #define __LZ77Compressor_HPP__
 
 #include <GenericCompressor.hpp>
-#include <BitStreamWriter.hpp>
-#include <BitStreamReader.hpp>
+#include <BitWriter.hpp>
+#include <BitReader.hpp>
+#include <BitBufferWriter.hpp>
+#include <BitBufferReader.hpp>
+#include <ByteBuffer.hpp>
+#include <CpuDispatch.hpp>
 
 #include <cstring>
+#include <algorithm>
 #include <cassert>
 
 /**
@@ -47,6 +52,8 @@
  */
 class LZ77Compressor : public GenericCompressor 
 {
+  /** Mesura find_prefix() de forma aïllada (benchmarks/MicroBenchmark.cpp). */
+  friend struct KernelBenchmark;
 private:
   /** Versió del compressor. */
   static const unsigned char COMPRESSOR_VERSION;
@@ -62,8 +69,49 @@ private:
   /** Grandària en bytes de la finestra d'anàlisi. */
   size_t WINDOW_SIZE;
 
-  /** Finestra d'anàlisi (buffer de cerca i de dades). */
+  /**
+   * @class RuntimeWidths
+   * @brief Grandàries de la finestra copiades dels atributs del compressor,
+   * vàlides per a qualsevol paràmetre.
+   */
+  struct RuntimeWidths {
+    uint8_t search_bits, lahead_bits;
+    size_t search_size, lahead_size, window_size;
+
+    explicit RuntimeWidths(const LZ77Compressor& c)
+      : search_bits(c.SEARCH_BITS), lahead_bits(c.LAHEAD_BITS), search_size(c.SEARCH_SIZE),
+	lahead_size(c.LAHEAD_SIZE), window_size(c.WINDOW_SIZE)
+    { }
+    uint8_t searchBits() const { return search_bits; }
+    uint8_t laheadBits() const { return lahead_bits; }
+    size_t searchSize() const { return search_size; }
+    size_t laheadSize() const { return lahead_size; }
+    size_t windowSize() const { return window_size; }
+  };
+
+  /**
+   * @class FixedWidths
+   * @brief Grandàries de la finestra conegudes en temps de compilació.
+   *
+   * Amb elles, els mòduls de les possicions en la finestra i les amplades
+   * dels camps escrits i llegits són constants, i el compilador els
+   * converteix en multiplicacions, desplaçaments i màscares fixes.
+   */
+  template <uint8_t SB, uint8_t LB>
+  struct FixedWidths {
+    explicit FixedWidths(const LZ77Compressor&) { }
+    static uint8_t searchBits() { return SB; }
+    static uint8_t laheadBits() { return LB; }
+    static size_t searchSize() { return (size_t)1 << SB; }
+    static size_t laheadSize() { return (size_t)1 << LB; }
+    static size_t windowSize() { return ((size_t)1 << SB) + ((size_t)1 << LB); }
+  };
+
+  /** Finestra d'anàlisi (buffer de cerca i de dades). Es conserva entre
+      crides, fins a releaseMemory() o fins que cal una altra grandària. */
   char * window;
+  /** Grandària en bytes de la finestra reservada. */
+  size_t window_capacity;
   /** Començament de la finestra de cerca. */
   size_t search_start;
   /** Possició actual en la finestra de cerca. */
@@ -81,8 +129,9 @@ private:
    * 
    * @param sb nombre de bits utilitzats per al buffer de cerca.
    * @param lb nombre de bits utilitzats per al buffer de dades.
+   * @return false si no hi ha memòria per a la finestra, true en cas contrari.
    */
-  inline void init (const uint8_t sb, const uint8_t lb)
+  inline bool init (const uint8_t sb, const uint8_t lb)
   {
     assert( sb > 0 && sb < 30 );
     assert( lb > 0 && lb < sb );
@@ -94,10 +143,20 @@ private:
     LAHEAD_SIZE = (0x01 << LAHEAD_BITS);
     WINDOW_SIZE = SEARCH_SIZE+LAHEAD_SIZE;
     
-    assert( (window = new char[WINDOW_SIZE]) != 0 );
+    /* Es reutilitza la finestra de la crida anterior si té la mateixa
+       grandària; si no, es torna a reservar. */
+    if ( window != 0 && window_capacity != WINDOW_SIZE ) releaseMemory();
+    if ( window == 0 ) {
+      window = (char *)MemoryAccount::tryAllocate(WINDOW_SIZE);
+      if ( window == 0 ) return false;
+      window_capacity = WINDOW_SIZE;
+    }
     
+    /* Es buida perquè unes dades corruptes no puguen recuperar
+       les dades de la crida anterior. */
     memset(window, 0x00, WINDOW_SIZE);
     search_start = search_pos = lahead_start = lahead_end = 0;
+    return true;
   }
 
   /**
@@ -105,9 +164,11 @@ private:
    *
    * Operació \f$n = (n+1)\%WINDOW\_SIZE\f$.
    * @param[in,out] n possició a incrementar.
+   * @param w grandàries de la finestra.
    */
-  inline void INC_ROUND(size_t& n) const
-  { n = (n+1)%WINDOW_SIZE; }
+  template <typename Widths>
+  inline void INC_ROUND(size_t& n, const Widths& w) const
+  { n = (n+1)%w.windowSize(); }
 
   /**
    * @brief Incrementa una possició en la finestra d'anàlisi m unitats.
@@ -115,74 +176,151 @@ private:
    * Operació \f$n=(n+m)\%WINDOW\_SIZE\f$.
    * @param[in,out] n possició a incrementar.
    * @param[in] m nombre d'unitats a incrementar.
+   * @param w grandàries de la finestra.
    */
-  inline void INC_N_ROUND(size_t& n, size_t m) const
-  { n = (n+m)%WINDOW_SIZE; }
+  template <typename Widths>
+  inline void INC_N_ROUND(size_t& n, size_t m, const Widths& w) const
+  { n = (n+m)%w.windowSize(); }
 
   /**
    * @brief Obté la possició absoluta a partir de la possició relativa a una base,
    * tenint en compte la grandària de la finestra d'anàlisi.
    * @param position possició relativa.
    * @param base base de les possicions relatives.
+   * @param w grandàries de la finestra.
    * @return possició absoluta.
    */
-  inline size_t ABSOLUTE_POSITION(size_t position, size_t base) const
-  { return (base+position)%WINDOW_SIZE; }
+  template <typename Widths>
+  inline size_t ABSOLUTE_POSITION(size_t position, size_t base, const Widths& w) const
+  { return (base+position)%w.windowSize(); }
   
   /**
    * @brief Obté la possició relativa a partir de la possició absoluta i una base,
    * tenint en compte la grandària de la finestra d'anàlisi.
    * @param position possició absoluta.
    * @param base base de la possició relatives.
+   * @param w grandàries de la finestra.
    * @return possició relativa.
    */
-  inline size_t RELATIVE_POSITION(size_t position, size_t base) const
-  { return (position>=base ? position-base : WINDOW_SIZE-base+position); }
+  template <typename Widths>
+  inline size_t RELATIVE_POSITION(size_t position, size_t base, const Widths& w) const
+  { return (position>=base ? position-base : w.windowSize()-base+position); }
 
   /**
    * @brief Calcula la grandària actual del buffer de cerca.
    *
    * Quan s'estan comprimint els primers bytes del fluxe d'entrada, el buffer
    * de cerca serà menor que el màxim indicat SEARCH_SIZE.
+   * @param w grandàries de la finestra.
    * @return grandària en bytes del buffer de cerca.
    */
-  inline size_t SEARCH_CSIZE(void) const
+  template <typename Widths>
+  inline size_t SEARCH_CSIZE(const Widths& w) const
   { return  ((lahead_start>=search_start) ? (lahead_start-search_start) : 
-	     (WINDOW_SIZE-search_start+lahead_start)); }
+	     (w.windowSize()-search_start+lahead_start)); }
 
   /**
    * @brief Busca la possició en el buffer de cerca on es troba
    * el prefixe més llarg possible del buffer de dades.
+   * @param w grandàries de la finestra.
    * @param[out] max_l Longitud del prefixe.
    * @param[out] max_p Possició en el buffer de cerca on s'ha trobat el prefixe.
    */
-  inline void find_prefix(size_t& max_l, size_t &max_p)
+  template <typename Widths>
+  inline void find_prefix(const Widths& w, size_t& max_l, size_t &max_p)
   {
-    size_t sb_size = SEARCH_CSIZE();
+    const CpuDispatch::Kernels& kernels = CpuDispatch::kernels();
+    const size_t WINDOW_SIZE = w.windowSize();
+    size_t sb_size = SEARCH_CSIZE(w);
     search_pos = search_start;
     for(size_t i = 0; i < sb_size; ) {   
-      /* Busquem prefixe en el buffer de cerca... */
-      while( search_pos!=lahead_start && window[search_pos]!=window[lahead_start] )
-	{ INC_ROUND(search_pos); ++i; }
+      /* Busquem prefixe en el buffer de cerca, per trams que no
+	 donen la volta a la finestra... */
+      while ( search_pos != lahead_start ) {
+	size_t end = (search_pos < lahead_start ? lahead_start : WINDOW_SIZE);
+	const char * f = (const char *)memchr(window+search_pos, window[lahead_start], end-search_pos);
+	if ( f != 0 ) { i += f-(window+search_pos); search_pos = f-window; break; }
+	i += end-search_pos;
+	search_pos = end%WINDOW_SIZE;
+      }
       
       /* Si no s'ha trobat el prefixe, acabem. */
-      if ( search_pos == lahead_start ) return;
+      if ( search_pos == lahead_start ) { SCOMPRESSOR_STATS_ADD(stats, LZ77_COMPARISONS, i); return; }
       
       /* Avancem en el prefixe fins que deixe de coincidir
-	 amb el buffer de cerca. */
+	 amb el buffer de cerca. Es compara per trams que no donen
+	 la volta a la finestra ni passen del final del buffer de dades. */
       size_t prefix_start = search_pos;
       lahead_pos = lahead_start;
-      while( lahead_pos!=lahead_end && window[search_pos]==window[lahead_pos] )
-	{ INC_ROUND(search_pos); INC_ROUND(lahead_pos); ++i; }
+      for(;;) {
+	size_t n = std::min(std::min(WINDOW_SIZE-search_pos, WINDOW_SIZE-lahead_pos),
+			    RELATIVE_POSITION(lahead_end, lahead_pos, w));
+	size_t l = kernels.matchLength(window+search_pos, window+lahead_pos, n);
+	INC_N_ROUND(search_pos, l, w); INC_N_ROUND(lahead_pos, l, w); i += l;
+	if ( l < n || lahead_pos == lahead_end ) break;
+      }
       
       /* Si el prefixe trobat en el buffer de cerca és major
 	 que l'anterior, el substituïm. */
       if ( lahead_pos-lahead_start > max_l ) 
 	{ max_l = lahead_pos-lahead_start; max_p = prefix_start; }  
     }
+    SCOMPRESSOR_STATS_ADD(stats, LZ77_COMPARISONS, sb_size);
+  }
+
+  /**
+   * @brief Busca el prefixe més llarg de les dades de data[pos, end) en
+   * data[start, pos), directament en un buffer de memòria.
+   *
+   * Fa el mateix recorregut que find_prefix() sobre la finestra circular,
+   * de manera que troba el mateix prefixe.
+   * @param data dades que s'estan comprimint.
+   * @param start començament del buffer de cerca.
+   * @param pos començament del buffer de dades.
+   * @param end acabament del bloc de dades.
+   * @param[out] max_l Longitud del prefixe.
+   * @param[out] max_p Possició en data on s'ha trobat el prefixe.
+   */
+  inline void find_prefix(const char * data, size_t start, size_t pos, size_t end,
+			  size_t& max_l, size_t& max_p)
+  {
+    const CpuDispatch::Kernels& kernels = CpuDispatch::kernels();
+    size_t i = start;
+    while ( i < pos ) {
+      const char * f = (const char *)memchr(data+i, data[pos], pos-i);
+      if ( f == 0 ) { SCOMPRESSOR_STATS_ADD(stats, LZ77_COMPARISONS, pos-start); return; }
+      i = f-data;
+
+      /* Com en la finestra circular, es continua després del prefixe trobat. */
+      size_t l = kernels.matchLength(data+i, data+pos, end-pos);
+      if ( l > max_l ) { max_l = l; max_p = i; }
+      i += l;
+    }
+    SCOMPRESSOR_STATS_ADD(stats, LZ77_COMPARISONS, pos-start);
   }
   
 public:
+  /**
+   * @brief Constructor.
+   */
+  LZ77Compressor() : window(0), window_capacity(0) { }
+
+  /**
+   * @brief Destructor. Allibera la finestra d'anàlisi.
+   */
+  ~LZ77Compressor()
+  { releaseMemory(); }
+
+  /**
+   * @brief Allibera la finestra d'anàlisi conservada entre crides.
+   */
+  void releaseMemory()
+  {
+    MemoryAccount::deallocate(window);
+    window = 0;
+    window_capacity = 0;
+  }
+
   /**
    * @brief Comprimeix el fluxe d'entrada de input i escriu el resultat en output.
    * 
@@ -211,9 +349,124 @@ public:
   bool compress(std::istream& input, std::ostream& output, 
 		const uint8_t search_bits, const uint8_t lahead_bits)
   {
-    BitStreamWriter bos(output);
+    BitWriter<StreamSink> bos(output);
+    return compressData(input, bos, search_bits, lahead_bits);
+  }
+
+  /**
+   * @brief Comprimeix les dades del buffer src i escriu el resultat en el buffer dst.
+   *
+   * S'utilitzen \f$2^{9} = 512\f$ bytes per a la grandària del buffer de cerca i
+   * \f$2^5 = 32\f$ bytes per a la grandària del buffer de dades.
+   *
+   * @param src dades que volen comprimir-se.
+   * @param n grandària en bytes de les dades.
+   * @param dst buffer on es deixen les dades comprimides.
+   * @param cap capacitat en bytes de dst.
+   * @return grandària de les dades comprimides o BUFFER_ERROR en cas d'error.
+   */
+  size_t compress(const void * src, size_t n, void * dst, size_t cap)
+  {
+    return compress(src, n, dst, cap, 9, 5);
+  }
+
+  /**
+   * @brief Comprimeix les dades del buffer src i escriu el resultat en el buffer dst.
+   *
+   * @param src dades que volen comprimir-se.
+   * @param n grandària en bytes de les dades.
+   * @param dst buffer on es deixen les dades comprimides.
+   * @param cap capacitat en bytes de dst (compressBound(n, search_bits, lahead_bits) és suficient).
+   * @param search_bits nombre de bits utilitzats per al buffer de cerca.
+   * @param lahead_bits nombre de bits utilitzats per al buffer de dades.
+   * @return grandària de les dades comprimides o BUFFER_ERROR en cas d'error.
+   */
+  size_t compress(const void * src, size_t n, void * dst, size_t cap,
+		  const uint8_t search_bits, const uint8_t lahead_bits)
+  {
+    ByteBufferReader input(src, n);
+    BitBufferWriter bos(dst, cap);
+    if ( !compressData(input, bos, search_bits, lahead_bits) ) return BUFFER_ERROR;
+    return bos.size();
+  }
+
+  /**
+   * @brief Comprimeix les dades del buffer src i escriu el resultat en output.
+   *
+   * S'utilitzen els mateixos paràmetres per defecte que en la compressió de fluxes.
+   * @param src dades que volen comprimir-se.
+   * @param n grandària en bytes de les dades.
+   * @param output fluxe d'eixida on es deixen les dades comprimides.
+   */
+  bool compress(const void * src, size_t n, std::ostream& output)
+  {
+    ByteBufferReader input(src, n);
+    BitWriter<StreamSink> bos(output);
+    return compressData(input, bos, 9, 5);
+  }
+
+  bool decompress(std::istream& input, std::ostream& output)
+  {
+    BitReader<StreamSource> bis(input);
+    return decompressData(bis, output);
+  }
+
+  bool decompress(const void * src, size_t n, std::ostream& output)
+  {
+    BitBufferReader bis(src, n);
+    return decompressData(bis, output);
+  }
+
+  size_t decompress(const void * src, size_t n, void * dst, size_t cap)
+  {
+    BitBufferReader bis(src, n);
+    ByteBufferWriter output(dst, cap);
+    if ( !decompressData(bis, output) ) return BUFFER_ERROR;
+    return output.size();
+  }
+
+  /**
+   * @brief Calcula la grandària màxima de les dades comprimides.
+   *
+   * Cada bloc afegeix un bit (i el nombre de bytes, si és l'últim) i cada token
+   * codifica almenys un byte en 9 bits (literal) o almenys dos bytes en
+   * \f$9+lahead\_bits+search\_bits\f$ bits (prefixe).
+   * @param n grandària en bytes de les dades sense comprimir.
+   * @param search_bits nombre de bits utilitzats per al buffer de cerca.
+   * @param lahead_bits nombre de bits utilitzats per al buffer de dades.
+   * @return grandària màxima en bytes de les dades comprimides.
+   */
+  static size_t compressBound(size_t n, const uint8_t search_bits = 9, 
+			      const uint8_t lahead_bits = 5)
+  {
+    size_t blocks = (n >> lahead_bits) + 1;
+    size_t token_bits = std::max((size_t)18, (size_t)9+search_bits+lahead_bits);
+    size_t bits = 18 + blocks*(1+lahead_bits) + (n*token_bits+1)/2;
+    return (bits+7)/8;
+  }
 
-    init(search_bits, lahead_bits);
+  size_t getCompressBound(size_t n) const
+  {
+    return compressBound(n);
+  }
+
+private:
+  /**
+   * @brief Comprimeix les dades llegides de input i les escriu en bos.
+   *
+   * Aquest mètode és comú a la compressió des de fluxes i des de buffers.
+   * @param input fluxe o buffer d'entrada.
+   * @param bos escriptor binari de l'eixida.
+   * @param search_bits nombre de bits utilitzats per al buffer de cerca.
+   * @param lahead_bits nombre de bits utilitzats per al buffer de dades.
+   * @return true si tot ha anat bé, false en cas contrari.
+   */
+  template <typename Input, typename BitWriter>
+  bool compressData(Input& input, BitWriter& bos,
+		    const uint8_t search_bits, const uint8_t lahead_bits)
+  {
+    MemoryAccount::Scope scope(memory);
+    if ( !init(search_bits, lahead_bits) ) return false;
 
     /* Escrivim versió del compressor. */
     bos.put(COMPRESSOR_VERSION, 8);
@@ -223,18 +476,48 @@ public:
     bos.put(LAHEAD_BITS, 5);
     if ( !bos.good() ) return false;
 
+    /* Els paràmetres més utilitzats tenen el bucle especialitzat, amb les
+       grandàries constants; la resta utilitzen el genèric. */
+    switch ( SEARCH_BITS << 8 | LAHEAD_BITS ) {
+    case 9 << 8 | 5: return compressBlocks(input, bos, FixedWidths<9, 5>(*this));
+    case 11 << 8 | 6: return compressBlocks(input, bos, FixedWidths<11, 6>(*this));
+    case 12 << 8 | 8: return compressBlocks(input, bos, FixedWidths<12, 8>(*this));
+    default: return compressBlocks(input, bos, RuntimeWidths(*this));
+    }
+  }
+
+  /**
+   * @brief Comprimeix els blocs de dades llegits de input i els escriu en bos.
+   * @param input fluxe o buffer d'entrada.
+   * @param bos escriptor binari de l'eixida.
+   * @param w grandàries de la finestra.
+   * @return true si tot ha anat bé, false en cas contrari.
+   */
+  template <typename Input, typename BitWriter, typename Widths>
+  bool compressBlocks(Input& input, BitWriter& bos, const Widths& w)
+  {
+    /* Aquestes còpies oculten els atributs; amb FixedWidths són constants. */
+    const size_t WINDOW_SIZE = w.windowSize();
+    const size_t LAHEAD_SIZE = w.laheadSize();
+    const size_t SEARCH_SIZE = w.searchSize();
+    const uint8_t SEARCH_BITS = w.searchBits();
+    const uint8_t LAHEAD_BITS = w.laheadBits();
+
     while ( input.good() ) {
       size_t bytes_block = 0;
 
       /* Llegim un bloc de dades. */
-      if ( LAHEAD_SIZE > WINDOW_SIZE - lahead_start ) {
-	input.read(&window[lahead_start], WINDOW_SIZE-lahead_start);
-	bytes_block = input.gcount();
-	input.read(window, LAHEAD_SIZE-(WINDOW_SIZE-lahead_start));
-	bytes_block += input.gcount();
-      } else {
-	input.read(&window[lahead_start], LAHEAD_SIZE);
-	bytes_block = input.gcount();
+      {
+	SCOMPRESSOR_STATS_FINE_PHASE(stats, READ);
+	if ( LAHEAD_SIZE > WINDOW_SIZE - lahead_start ) {
+	  input.read(&window[lahead_start], WINDOW_SIZE-lahead_start);
+	  bytes_block = input.gcount();
+	  input.read(window, LAHEAD_SIZE-(WINDOW_SIZE-lahead_start));
+	  bytes_block += input.gcount();
+	} else {
+	  input.read(&window[lahead_start], LAHEAD_SIZE);
+	  bytes_block = input.gcount();
+	}
       }
 
       /* En cas d'haver menys bytes que la grandària del buffer
@@ -254,7 +537,10 @@ public:
 	/* Determinem la posició en el buffer de cerca
 	   del prefixe més gran possible en el buffer de dades. */
 	size_t max_l = 0, max_p = 0;
-	find_prefix(max_l, max_p);
+	{
+	  SCOMPRESSOR_STATS_FINE_PHASE(stats, MATCH_SEARCH);
+	  find_prefix(w, max_l, max_p);
+	}
 	
 	/* Si el prefixe es tan gran, com tots els bytes que quedaven
 	   per comprimir, considerarem un byte menys en el prefixe. */
@@ -270,12 +556,18 @@ public:
 	}
 #endif
 
+	SCOMPRESSOR_STATS_ADD(stats, LZ77_TOKENS, 1);
 	if (max_l == 0) { 
 	  /* El prefixe no estava en el buffer de cerca. */
+	  SCOMPRESSOR_STATS_FINE_PHASE(stats, BIT_OUTPUT);
+	  SCOMPRESSOR_STATS_ADD(stats, LZ77_LITERALS, 1);
 	  bos.put(0);
 	  bos.put(window[lahead_start+max_l], 8);
 	} else {
-	  size_t rpos = RELATIVE_POSITION(max_p, search_start);
+	  SCOMPRESSOR_STATS_FINE_PHASE(stats, BIT_OUTPUT);
+	  SCOMPRESSOR_STATS_ADD(stats, LZ77_MATCHES, 1);
+	  SCOMPRESSOR_STATS_ADD(stats, LZ77_MATCH_BYTES, max_l);
+	  size_t rpos = RELATIVE_POSITION(max_p, search_start, w);
 	  bos.put(1);
 	  bos.put(max_l, LAHEAD_BITS);
 	  bos.put(rpos, SEARCH_BITS);
@@ -286,8 +578,8 @@ public:
 	if ( !bos.good() ) return false;
 
 	/* Actualitzem les possicios dels buffers. */
-	INC_N_ROUND(lahead_start, max_l+1);
-	if ( SEARCH_CSIZE() > SEARCH_SIZE ) {
+	INC_N_ROUND(lahead_start, max_l+1, w);
+	if ( SEARCH_CSIZE(w) > SEARCH_SIZE ) {
 	  if ( lahead_start >= SEARCH_SIZE) search_start = lahead_start-SEARCH_SIZE;
 	  else search_start = WINDOW_SIZE - SEARCH_SIZE + lahead_start;
 	}
@@ -297,25 +589,137 @@ public:
       }
     }
 
-    delete [] window;
-
     return (bos.flush().good());
   }
 
-  bool decompress(std::istream& input, std::ostream& output)
+  /**
+   * @brief Comprimeix les dades d'un buffer de memòria i les escriu en bos.
+   *
+   * Les dades no es copien a la finestra d'anàlisi: es busca directament en el
+   * buffer (i.e. un fitxer projectat en memòria), on el buffer de cerca són els
+   * SEARCH_SIZE bytes anteriors a la possició actual. Com que els blocs sempre
+   * comencen en un múltiple de LAHEAD_SIZE, mai donen la volta a la finestra
+   * circular, i el resultat és el mateix que el de compressBlocks() genèric.
+   * @param input buffer d'entrada.
+   * @param bos escriptor binari de l'eixida.
+   * @param w grandàries de la finestra.
+   * @return true si tot ha anat bé, false en cas contrari.
+   */
+  template <typename BitWriter, typename Widths>
+  bool compressBlocks(ByteBufferReader& input, BitWriter& bos, const Widths& w)
   {
-    BitStreamReader bis(input);
+    const size_t WINDOW_SIZE = w.windowSize();
+    const size_t LAHEAD_SIZE = w.laheadSize();
+    const size_t SEARCH_SIZE = w.searchSize();
+    const uint8_t SEARCH_BITS = w.searchBits();
+    const uint8_t LAHEAD_BITS = w.laheadBits();
+
+    const char * data = input.take((size_t)-1);
+    const size_t n = input.gcount();
+    /* Començament del buffer de cerca i del buffer de dades en data. */
+    size_t start = 0, pos = 0;
+    for(;;) {
+      size_t bytes_block = std::min(LAHEAD_SIZE, n-pos);
+      if ( bytes_block == LAHEAD_SIZE )
+	bos.put(0);
+      else {
+	bos.put(1);
+	bos.put(bytes_block, LAHEAD_BITS);
+      }
+
+      const size_t end = pos+bytes_block;
+      while ( pos < end ) {
+	size_t max_l = 0, max_p = 0;
+	{
+	  SCOMPRESSOR_STATS_FINE_PHASE(stats, MATCH_SEARCH);
+	  find_prefix(data, start, pos, end, max_l, max_p);
+	}
+	if ( max_l+1 > end-pos )
+	  max_l = end-pos-1;
+
+	SCOMPRESSOR_STATS_ADD(stats, LZ77_TOKENS, 1);
+	if (max_l == 0) {
+	  SCOMPRESSOR_STATS_FINE_PHASE(stats, BIT_OUTPUT);
+	  SCOMPRESSOR_STATS_ADD(stats, LZ77_LITERALS, 1);
+	  bos.put(0);
+	  bos.put(data[pos], 8);
+	} else {
+	  SCOMPRESSOR_STATS_FINE_PHASE(stats, BIT_OUTPUT);
+	  SCOMPRESSOR_STATS_ADD(stats, LZ77_MATCHES, 1);
+	  SCOMPRESSOR_STATS_ADD(stats, LZ77_MATCH_BYTES, max_l);
+	  bos.put(1);
+	  bos.put(max_l, LAHEAD_BITS);
+	  bos.put(max_p-start, SEARCH_BITS);
+	  bos.put(data[pos+max_l], 8);
+	}
+	if ( !bos.good() ) return false;
+	pos += max_l+1;
+
+	/* Com SEARCH_CSIZE() en la finestra circular: si el buffer de cerca
+	   ocupa tota la finestra, es pren com a buit (i el descompressor
+	   fa el mateix). */
+	if ( pos-start == WINDOW_SIZE ) start = pos;
+	else if ( pos-start > SEARCH_SIZE ) start = pos-SEARCH_SIZE;
+      }
 
+      /* L'últim bloc és el que no està complet (encara que siga buit). */
+      if ( bytes_block < LAHEAD_SIZE ) break;
+    }
+
+    return (bos.flush().good());
+  }
+
+  /**
+   * @brief Descomprimeix les dades llegides de bis i les escriu en output.
+   *
+   * Aquest mètode és comú a la descompressió des de fluxes i des de buffers.
+   * @param bis lector binari de l'entrada.
+   * @param output fluxe o buffer d'eixida.
+   * @return true si tot ha anat bé, false en cas contrari.
+   */
+  template <typename BitReader, typename Output>
+  bool decompressData(BitReader& bis, Output& output)
+  {
+    MemoryAccount::Scope scope(memory);
+    SCOMPRESSOR_STATS_PHASE(stats, DECODE);
     /* Llegim versió del compressor. */
     if ( bis.get(8) != COMPRESSOR_VERSION ) return false;
     
     /* Llegim grandària dels buffers. */
     SEARCH_BITS = bis.get(5);
     LAHEAD_BITS = bis.get(5);
-    init(SEARCH_BITS, LAHEAD_BITS);
 
-    /* Error en la capçalera? */
-    if ( !bis.good() ) return false;
+    /* Error en la capçalera? Les grandàries es validen abans de reservar la
+       finestra, perquè unes dades corruptes no arriben a les asercions. */
+    if ( !bis.good() || SEARCH_BITS == 0 || SEARCH_BITS >= 30 ||
+	 LAHEAD_BITS == 0 || LAHEAD_BITS >= SEARCH_BITS ) return false;
+    if ( !init(SEARCH_BITS, LAHEAD_BITS) ) return false;
+
+    switch ( SEARCH_BITS << 8 | LAHEAD_BITS ) {
+    case 9 << 8 | 5: return decompressBlocks(bis, output, FixedWidths<9, 5>(*this));
+    case 11 << 8 | 6: return decompressBlocks(bis, output, FixedWidths<11, 6>(*this));
+    case 12 << 8 | 8: return decompressBlocks(bis, output, FixedWidths<12, 8>(*this));
+    default: return decompressBlocks(bis, output, RuntimeWidths(*this));
+    }
+  }
+
+  /**
+   * @brief Descomprimeix els blocs de dades llegits de bis i els escriu en output.
+   * @param bis lector binari de l'entrada.
+   * @param output fluxe o buffer d'eixida.
+   * @param w grandàries de la finestra.
+   * @return true si tot ha anat bé, false en cas contrari.
+   */
+  template <typename BitReader, typename Output, typename Widths>
+  bool decompressBlocks(BitReader& bis, Output& output, const Widths& w)
+  {
+    const CpuDispatch::Kernels& kernels = CpuDispatch::kernels();
+    /* Aquestes còpies oculten els atributs; amb FixedWidths són constants. */
+    const size_t WINDOW_SIZE = w.windowSize();
+    const size_t LAHEAD_SIZE = w.laheadSize();
+    const size_t SEARCH_SIZE = w.searchSize();
+    const uint8_t SEARCH_BITS = w.searchBits();
+    const uint8_t LAHEAD_BITS = w.laheadBits();
 
     /* Mentres queden dades per descomprimir i tot vaja bé... */
     Bit lb = 0;
@@ -335,7 +739,7 @@ public:
 	  /* La longitud és zero... */
 	  char c = bis.get(8); if (!bis.good()) return false;
 	  window[lahead_start] = c;
-	  INC_ROUND(lahead_start);
+	  INC_ROUND(lahead_start, w);
 	  output.put(c);
 
 	  --block_bytes;
@@ -349,17 +753,21 @@ public:
 	  char c = bis.get(8); if ( !bis.good() ) return false;
 	  
 	  /* Possició absoluta del començament prefixe en el buffer. */
-	  size_t st = ABSOLUTE_POSITION(max_p, search_start); 
+	  size_t st = ABSOLUTE_POSITION(max_p, search_start, w); 
 	  /* Possició absoluta del final del prefixe en el buffer. */
-	  size_t en = ABSOLUTE_POSITION(max_p+max_l, search_start);
-	  /* Descomprimim el prefixe. */
-	  for(size_t i = st; i != en; INC_ROUND(i)) {
-	    window[lahead_start] = window[i];
-	    INC_ROUND(lahead_start);
-	    output.put(window[i]);
+	  size_t en = ABSOLUTE_POSITION(max_p+max_l, search_start, w);
+	  /* Descomprimim el prefixe, per trams que no donen la volta
+	     a la finestra. */
+	  for(size_t i = st; i != en; ) {
+	    size_t n = std::min(RELATIVE_POSITION(en, i, w),
+				std::min(WINDOW_SIZE-i, WINDOW_SIZE-lahead_start));
+	    kernels.copyMatch(window+lahead_start, window+i, n);
+	    output.write(window+lahead_start, n);
+	    INC_N_ROUND(i, n, w);
+	    INC_N_ROUND(lahead_start, n, w);
 	  }
 	  window[lahead_start] = c;
-	  INC_ROUND(lahead_start);
+	  INC_ROUND(lahead_start, w);
 	  output.put(c);
 	  
 	  block_bytes -= max_l+1;
@@ -369,7 +777,7 @@ public:
 	}
 
 	/* Actualitzem les possicios dels buffers. */
-	if ( SEARCH_CSIZE() > SEARCH_SIZE ) {
+	if ( SEARCH_CSIZE(w) > SEARCH_SIZE ) {
 	  if ( lahead_start >= SEARCH_SIZE) search_start = lahead_start-SEARCH_SIZE;
 	  else search_start = WINDOW_SIZE - SEARCH_SIZE + lahead_start;
 	}
@@ -377,8 +785,6 @@ public:
       
     }
     
-    delete [] window;
-    
     if ( lb == 1 && output.good() ) return true;
     else return false;
   }
@@ -9,8 +9,11 @@
 #define __LZ78Compressor_HPP__
 
 #include <GenericCompressor.hpp>
-#include <BitStreamWriter.hpp>
-#include <BitStreamReader.hpp>
+#include <BitWriter.hpp>
+#include <BitReader.hpp>
+#include <BitBufferWriter.hpp>
+#include <BitBufferReader.hpp>
+#include <ByteBuffer.hpp>
 
 #include <ByteChunk.hpp>
 
@@ -57,6 +60,8 @@ class LZ78Compressor : public GenericCompressor {
 private:
   /** Versió del compressor. */
   static const unsigned char COMPRESSOR_VERSION;
+  /** Nombre màxim de bits per al diccionari acceptat en descomprimir. */
+  static const size_t MAX_DICTIONARY_BITS = 24;
   
   /** Nombre de bits per al diccionari. */
   size_t DICTIONARY_BITS;
@@ -67,14 +72,48 @@ private:
   /** Grandària en bytes del bloc de lectura. */
   size_t BLOCK_SIZE;
 
+  /**
+   * @class RuntimeWidths
+   * @brief Amplades copiades dels atributs del compressor, vàlides per a
+   * qualsevol paràmetre.
+   */
+  struct RuntimeWidths {
+    size_t dictionary_bits, dictionary_maxsize, block_bits, block_size;
+
+    explicit RuntimeWidths(const LZ78Compressor& c)
+      : dictionary_bits(c.DICTIONARY_BITS), dictionary_maxsize(c.DICTIONARY_MAXSIZE),
+	block_bits(c.BLOCK_BITS), block_size(c.BLOCK_SIZE)
+    { }
+    size_t dictionaryBits() const { return dictionary_bits; }
+    size_t dictionaryMaxSize() const { return dictionary_maxsize; }
+    size_t blockBits() const { return block_bits; }
+    size_t blockSize() const { return block_size; }
+  };
+
+  /**
+   * @class FixedWidths
+   * @brief Amplades conegudes en temps de compilació, amb les quals les
+   * escriptures i lectures dels codis són de desplaçaments i màscares fixes.
+   */
+  template <size_t DB, size_t BB>
+  struct FixedWidths {
+    explicit FixedWidths(const LZ78Compressor&) { }
+    static size_t dictionaryBits() { return DB; }
+    static size_t dictionaryMaxSize() { return (size_t)1 << DB; }
+    static size_t blockBits() { return BB; }
+    static size_t blockSize() { return (size_t)1 << BB; }
+  };
+
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
   /** Si s'està utilitzant el compilador de GNU C++, s'utilitza la classe
       unordered_map (una taula hash) per a implementar el diccionari de compressió. */
-  typedef std::tr1::unordered_map<ByteChunk,size_t,ByteChunkHash> CompDictionary;
+  typedef std::tr1::unordered_map<ByteChunk,size_t,ByteChunkHash,std::equal_to<ByteChunk>,
+				   AccountedAllocator<std::pair<const ByteChunk,size_t> > > CompDictionary;
 #else
   /** Si s'està utilitzant un compilador diferent de GNU C++, s'utilitza la classe
       map (una arbre binari) per a implementar el diccionari de compressió. */
-  typedef std::map<ByteChunk,size_t> CompDictionary;
+  typedef std::map<ByteChunk,size_t,std::less<ByteChunk>,
+		   AccountedAllocator<std::pair<const ByteChunk,size_t> > > CompDictionary;
 #endif
   
   /** Diccionari utilitzat en la compressió: taula hash o arbre. */
@@ -83,9 +122,16 @@ private:
   ByteChunk * dec_dictionary;
   /** Nombre d'elements (grandària) del diccionari de descompressió. */
   size_t dec_dictionary_csize;
+  /** Nombre d'entrades reservades del diccionari de descompressió. */
+  size_t dec_dictionary_capacity;
 
   /** Buffer de lectura utilitzat en la compressió. */
   char * buffer;
+  /** Grandària en bytes del buffer de lectura reservat. */
+  size_t buffer_capacity;
+  /** Bloc de dades que s'està comprimint: el buffer de lectura, o les
+      dades mateixes quan es comprimeix des d'un buffer de memòria. */
+  const char * block;
   /** Grandària del buffer de lectura. */
   size_t block_bytes;
   /** Possició actual en el buffer de lectura. */
@@ -97,16 +143,27 @@ private:
    * 
    * @param db nombre de bits utilitzats per al diccionari.
    * @param bb nombre de bits utilitzats per al buffer de lectura.
+   * @return false si no hi ha memòria per al buffer, true en cas contrari.
    */
-  inline void init_comp ( uint8_t db, uint8_t bb ) 
+  inline bool init_comp ( uint8_t db, uint8_t bb ) 
   {
     DICTIONARY_BITS = db;
     DICTIONARY_MAXSIZE = (0x01 << DICTIONARY_BITS);
     BLOCK_BITS = bb;
     BLOCK_SIZE = (0x01 << BLOCK_BITS);
-    assert((buffer = new char [BLOCK_SIZE]) != 0);
+    /* El buffer i les cubetes del diccionari es conserven entre crides. */
+    if ( buffer != 0 && buffer_capacity != BLOCK_SIZE ) {
+      MemoryAccount::deallocate(buffer);
+      buffer = 0;
+    }
+    if ( buffer == 0 ) {
+      buffer = (char *)MemoryAccount::tryAllocate(BLOCK_SIZE);
+      if ( buffer == 0 ) return false;
+      buffer_capacity = BLOCK_SIZE;
+    }
     block_bytes = block_pos = 0;
     com_dictionary.clear();
+    return true;
   }
   
   /** 
@@ -115,15 +172,27 @@ private:
    * 
    * @param db nombre de bits utilitzats per al diccionari.
    * @param bb nombre de bits utilitzats per al buffer de lectura.
+   * @return false si no hi ha memòria per al diccionari, true en cas contrari.
    */
-  inline void init_deco ( uint8_t db, uint8_t bb ) 
+  inline bool init_deco ( uint8_t db, uint8_t bb ) 
   {
     DICTIONARY_BITS = db;
     DICTIONARY_MAXSIZE = (0x01 << DICTIONARY_BITS);
     BLOCK_BITS = bb;
     BLOCK_SIZE = (0x01 << BLOCK_BITS);
-    assert((dec_dictionary = new ByteChunk [DICTIONARY_MAXSIZE]) != 0);
+    /* El diccionari es conserva entre crides, i les entrades reutilitzen
+       la memòria que ja tenien. */
+    if ( dec_dictionary != 0 && dec_dictionary_capacity != DICTIONARY_MAXSIZE ) {
+      MemoryAccount::deallocateArray(dec_dictionary, dec_dictionary_capacity);
+      dec_dictionary = 0;
+    }
+    if ( dec_dictionary == 0 ) {
+      dec_dictionary = MemoryAccount::tryAllocateArray<ByteChunk>(DICTIONARY_MAXSIZE);
+      if ( dec_dictionary == 0 ) return false;
+      dec_dictionary_capacity = DICTIONARY_MAXSIZE;
+    }
     dec_dictionary_csize = 0;
+    return true;
   }
   
   /**
@@ -140,14 +209,44 @@ private:
     CompDictionary::const_iterator found = com_dictionary.end();
     bc.resize(0);
     while(block_pos < block_bytes) {
-      bc.push_back(buffer[block_pos++]);
+      bc.push_back(block[block_pos++]);
       found = com_dictionary.find(bc);
-      if ( found == com_dictionary.end() ) return found;
+      if ( found == com_dictionary.end() ) {
+	SCOMPRESSOR_STATS_ADD(stats, DICTIONARY_MISSES, 1);
+	return found;
+      }
+      SCOMPRESSOR_STATS_ADD(stats, DICTIONARY_HITS, 1);
     }
     return found;
   }
 
 public:
+  /**
+   * @brief Constructor.
+   */
+  LZ78Compressor() : dec_dictionary(0), dec_dictionary_csize(0), dec_dictionary_capacity(0),
+		   buffer(0), buffer_capacity(0), block(0) { }
+
+  /**
+   * @brief Destructor. Allibera els diccionaris i el buffer de lectura.
+   */
+  ~LZ78Compressor()
+  { releaseMemory(); }
+
+  /**
+   * @brief Allibera els diccionaris i el buffer de lectura conservats entre crides.
+   */
+  void releaseMemory()
+  {
+    MemoryAccount::deallocate(buffer);
+    buffer = 0;
+    buffer_capacity = 0;
+    MemoryAccount::deallocateArray(dec_dictionary, dec_dictionary_capacity);
+    dec_dictionary = 0;
+    dec_dictionary_csize = dec_dictionary_capacity = 0;
+    CompDictionary().swap(com_dictionary);
+  }
+
   /**
    * @brief Comprimeix el fluxe d'entrada de input i escriu el resultat en output.
    * 
@@ -176,9 +275,147 @@ public:
   bool compress( std::istream& input, std::ostream& output,
 		 uint8_t dictionary_bits, uint8_t block_bits )
   {
-    BitStreamWriter bos(output);
+    BitWriter<StreamSink> bos(output);
+    return compressData(input, bos, dictionary_bits, block_bits);
+  }
+
+  /**
+   * @brief Comprimeix les dades del buffer src i escriu el resultat en el buffer dst.
+   *
+   * S'utilitzen els mateixos paràmetres per defecte que en la compressió de fluxes.
+   *
+   * @param src dades que volen comprimir-se.
+   * @param n grandària en bytes de les dades.
+   * @param dst buffer on es deixen les dades comprimides.
+   * @param cap capacitat en bytes de dst.
+   * @return grandària de les dades comprimides o BUFFER_ERROR en cas d'error.
+   */
+  size_t compress( const void * src, size_t n, void * dst, size_t cap )
+  {
+    return compress(src, n, dst, cap, 14, 5);
+  }
+
+  /**
+   * @brief Comprimeix les dades del buffer src i escriu el resultat en el buffer dst.
+   *
+   * @param src dades que volen comprimir-se.
+   * @param n grandària en bytes de les dades.
+   * @param dst buffer on es deixen les dades comprimides.
+   * @param cap capacitat en bytes de dst (compressBound(n, dictionary_bits, block_bits) és suficient).
+   * @param dictionary_bits nombre de bits utilitzats per a les entrades del diccionari.
+   * @param block_bits nombre de bits utilitzats per al buffer de lectura.
+   * @return grandària de les dades comprimides o BUFFER_ERROR en cas d'error.
+   */
+  size_t compress( const void * src, size_t n, void * dst, size_t cap,
+		   uint8_t dictionary_bits, uint8_t block_bits )
+  {
+    ByteBufferReader input(src, n);
+    BitBufferWriter bos(dst, cap);
+    if ( !compressData(input, bos, dictionary_bits, block_bits) ) return BUFFER_ERROR;
+    return bos.size();
+  }
+
+  /**
+   * @brief Comprimeix les dades del buffer src i escriu el resultat en output.
+   *
+   * S'utilitzen els mateixos paràmetres per defecte que en la compressió de fluxes.
+   * @param src dades que volen comprimir-se.
+   * @param n grandària en bytes de les dades.
+   * @param output fluxe d'eixida on es deixen les dades comprimides.
+   */
+  bool compress(const void * src, size_t n, std::ostream& output)
+  {
+    ByteBufferReader input(src, n);
+    BitWriter<StreamSink> bos(output);
+    return compressData(input, bos, 14, 5);
+  }
+
+  bool decompress(std::istream& input, std::ostream& output)
+  {
+    BitReader<StreamSource> bis(input);
+    return decompressData(bis, output);
+  }
+
+  bool decompress(const void * src, size_t n, std::ostream& output)
+  {
+    BitBufferReader bis(src, n);
+    return decompressData(bis, output);
+  }
+
+  size_t decompress( const void * src, size_t n, void * dst, size_t cap )
+  {
+    BitBufferReader bis(src, n);
+    ByteBufferWriter output(dst, cap);
+    if ( !decompressData(bis, output) ) return BUFFER_ERROR;
+    return output.size();
+  }
+
+  /**
+   * @brief Calcula la grandària màxima de les dades comprimides.
+   *
+   * Cada bloc afegeix un bit (i el nombre de bytes, si és l'últim) i cada token
+   * codifica almenys un byte en 9 bits (literal) o almenys dos bytes en
+   * \f$9+dictionary\_bits\f$ bits (prefixe).
+   * @param n grandària en bytes de les dades sense comprimir.
+   * @param dictionary_bits nombre de bits utilitzats per a les entrades del diccionari.
+   * @param block_bits nombre de bits utilitzats per al buffer de lectura.
+   * @return grandària màxima en bytes de les dades comprimides.
+   */
+  static size_t compressBound( size_t n, uint8_t dictionary_bits = 14,
+			       uint8_t block_bits = 5 )
+  {
+    size_t blocks = (n >> block_bits) + 1;
+    size_t token_bits = std::max((size_t)18, (size_t)9+dictionary_bits);
+    size_t bits = 18 + blocks*(1+block_bits) + (n*token_bits+1)/2;
+    return (bits+7)/8;
+  }
 
-    init_comp(dictionary_bits, block_bits);
+  size_t getCompressBound( size_t n ) const
+  {
+    return compressBound(n);
+  }
+
+private:
+  /**
+   * @brief Llegeix un bloc de dades d'un fluxe en el buffer de lectura.
+   * @param input fluxe d'entrada.
+   * @param n nombre de bytes a llegir.
+   * @return el buffer de lectura; input.gcount() indica els bytes llegits.
+   */
+  template <typename Input>
+  const char * read_block( Input& input, size_t n )
+  {
+    input.read(buffer, n);
+    return buffer;
+  }
+
+  /**
+   * @brief Pren un bloc de dades d'un buffer de memòria, sense copiar-lo.
+   * @param input buffer d'entrada.
+   * @param n nombre de bytes a prendre.
+   * @return les dades en el buffer; input.gcount() indica quantes n'hi ha.
+   */
+  const char * read_block( ByteBufferReader& input, size_t n )
+  {
+    return input.take(n);
+  }
+
+  /**
+   * @brief Comprimeix les dades llegides de input i les escriu en bos.
+   *
+   * Aquest mètode és comú a la compressió des de fluxes i des de buffers.
+   * @param input fluxe o buffer d'entrada.
+   * @param bos escriptor binari de l'eixida.
+   * @param dictionary_bits nombre de bits utilitzats per a les entrades del diccionari.
+   * @param block_bits nombre de bits utilitzats per al buffer de lectura.
+   * @return true si tot ha anat bé, false en cas contrari.
+   */
+  template <typename Input, typename BitWriter>
+  bool compressData( Input& input, BitWriter& bos,
+		     uint8_t dictionary_bits, uint8_t block_bits )
+  {
+    MemoryAccount::Scope scope(memory);
+    if ( !init_comp(dictionary_bits, block_bits) ) return false;
     
     /* Escrivim versió del compressor. */
     bos.put(COMPRESSOR_VERSION, 8);
@@ -188,11 +425,40 @@ public:
     bos.put(BLOCK_BITS, 5);
     if ( !bos.good() ) return false;
 
+    /* Els paràmetres més utilitzats tenen el bucle especialitzat, amb les
+       amplades constants; la resta utilitzen el genèric. */
+    switch ( DICTIONARY_BITS << 8 | BLOCK_BITS ) {
+    case 12 << 8 | 5: return compressBlocks(input, bos, FixedWidths<12, 5>(*this));
+    case 14 << 8 | 5: return compressBlocks(input, bos, FixedWidths<14, 5>(*this));
+    case 16 << 8 | 5: return compressBlocks(input, bos, FixedWidths<16, 5>(*this));
+    default: return compressBlocks(input, bos, RuntimeWidths(*this));
+    }
+  }
+
+  /**
+   * @brief Comprimeix els blocs de dades llegits de input i els escriu en bos.
+   * @param input fluxe o buffer d'entrada.
+   * @param bos escriptor binari de l'eixida.
+   * @param widths amplades dels camps.
+   * @return true si tot ha anat bé, false en cas contrari.
+   */
+  template <typename Input, typename BitWriter, typename Widths>
+  bool compressBlocks( Input& input, BitWriter& bos, const Widths& widths )
+  {
+    /* Aquestes còpies oculten els atributs; amb FixedWidths són constants. */
+    const size_t DICTIONARY_BITS = widths.dictionaryBits();
+    const size_t DICTIONARY_MAXSIZE = widths.dictionaryMaxSize();
+    const size_t BLOCK_BITS = widths.blockBits();
+    const size_t BLOCK_SIZE = widths.blockSize();
+
     ByteChunk chunk(BLOCK_SIZE);
     while( input.good() ) {
       /* Llegim bloc de dades... */
-      input.read(buffer, BLOCK_SIZE);
-      block_bytes = input.gcount();
+      {
+	SCOMPRESSOR_STATS_FINE_PHASE(stats, READ);
+	block = read_block(input, BLOCK_SIZE);
+	block_bytes = input.gcount();
+      }
       block_pos = 0;
 
       /* Indiquem si la grandària del bloc és menor que BLOCK_SIZE i 
@@ -206,13 +472,19 @@ public:
       
       /* Mentres queden dades a comprimir en el bloc... */
       while ( block_pos < block_bytes ) {
-	CompDictionary::const_iterator found = find_prefix(chunk);
+	{
+	  SCOMPRESSOR_STATS_FINE_PHASE(stats, MATCH_SEARCH);
+	  find_prefix(chunk);
+	}
 	
 	/* Si caben entrades en el diccionari i el bloc de dades a comprimir no
 	   estava ja en el diccionari (això sols pot passar a final de bloc),
 	   creem una nova entrada en el diccionari. */
-	if ( com_dictionary.size() < DICTIONARY_MAXSIZE && block_pos < block_bytes )
+	if ( com_dictionary.size() < DICTIONARY_MAXSIZE && block_pos < block_bytes ) {
+	  SCOMPRESSOR_STATS_FINE_PHASE(stats, DICTIONARY_FILL);
 	  com_dictionary.insert(std::pair<ByteChunk,size_t>(chunk, com_dictionary.size()));
+	  SCOMPRESSOR_STATS_ADD(stats, DICTIONARY_INSERTS, 1);
+	}
 	
 #ifdef DEBUG
 	if ( chunk.size() == 1 ) {
@@ -227,9 +499,11 @@ public:
 	
 	if ( chunk.size() == 1 ) {
 	  /* El prefixe no estava en el buffer de cerca. */
+	  SCOMPRESSOR_STATS_FINE_PHASE(stats, BIT_OUTPUT);
 	  bos.put(0);
 	  bos.put(chunk.back(), 8);
 	} else {  
+	  SCOMPRESSOR_STATS_FINE_PHASE(stats, BIT_OUTPUT);
 	  ByteChunk pre_chunk = ByteChunk(chunk.pchar(), chunk.size()-1);
 	  bos.put(1);
 	  bos.put(com_dictionary[pre_chunk], DICTIONARY_BITS);
@@ -241,25 +515,59 @@ public:
       }
     }
 
-    delete [] buffer;
+    SCOMPRESSOR_STATS_MAX(stats, DICTIONARY_SIZE, com_dictionary.size());
    
     return ( bos.flush().good() );
   }
 
-  bool decompress(std::istream& input, std::ostream& output)
+  /**
+   * @brief Descomprimeix les dades llegides de bis i les escriu en output.
+   *
+   * Aquest mètode és comú a la descompressió des de fluxes i des de buffers.
+   * @param bis lector binari de l'entrada.
+   * @param output fluxe o buffer d'eixida.
+   * @return true si tot ha anat bé, false en cas contrari.
+   */
+  template <typename BitReader, typename Output>
+  bool decompressData(BitReader& bis, Output& output)
   {
-    BitStreamReader bis(input);
-
+    MemoryAccount::Scope scope(memory);
+    SCOMPRESSOR_STATS_PHASE(stats, DECODE);
     /* Llegim versió del compressor. */
     if ( bis.get(8) != COMPRESSOR_VERSION ) return false;
 
     /* Llegim els paràmetres de compressió. */
     DICTIONARY_BITS = bis.get(5);
     BLOCK_BITS = bis.get(5);
-    init_deco(DICTIONARY_BITS, BLOCK_BITS);
 
-    /* Error en la capçalera? */
-    if ( !bis.good() ) return false;
+    /* Error en la capçalera? Els paràmetres es validen abans de reservar
+       el diccionari. */
+    if ( !bis.good() || DICTIONARY_BITS > MAX_DICTIONARY_BITS || BLOCK_BITS == 0 ) return false;
+    if ( !init_deco(DICTIONARY_BITS, BLOCK_BITS) ) return false;
+
+    switch ( DICTIONARY_BITS << 8 | BLOCK_BITS ) {
+    case 12 << 8 | 5: return decompressBlocks(bis, output, FixedWidths<12, 5>(*this));
+    case 14 << 8 | 5: return decompressBlocks(bis, output, FixedWidths<14, 5>(*this));
+    case 16 << 8 | 5: return decompressBlocks(bis, output, FixedWidths<16, 5>(*this));
+    default: return decompressBlocks(bis, output, RuntimeWidths(*this));
+    }
+  }
+
+  /**
+   * @brief Descomprimeix els blocs de dades llegits de bis i els escriu en output.
+   * @param bis lector binari de l'entrada.
+   * @param output fluxe o buffer d'eixida.
+   * @param widths amplades dels camps.
+   * @return true si tot ha anat bé, false en cas contrari.
+   */
+  template <typename BitReader, typename Output, typename Widths>
+  bool decompressBlocks(BitReader& bis, Output& output, const Widths& widths)
+  {
+    /* Aquestes còpies oculten els atributs; amb FixedWidths són constants. */
+    const size_t DICTIONARY_BITS = widths.dictionaryBits();
+    const size_t DICTIONARY_MAXSIZE = widths.dictionaryMaxSize();
+    const size_t BLOCK_BITS = widths.blockBits();
+    const size_t BLOCK_SIZE = widths.blockSize();
 
     /* Mentres queden dades per descomprimir i tot vaja bé... */
     Bit lb = 0;
@@ -289,7 +597,8 @@ public:
 	} else {
 	  /* Si el prefixe si estava, llegim l'entrada del diccionari. */
 	  size_t p = bis.get(DICTIONARY_BITS);
-	  if ( !bis.good() ) return false;
+	  /* Les entrades per damunt de dec_dictionary_csize són de la crida anterior. */
+	  if ( !bis.good() || p >= dec_dictionary_csize ) return false;
 	  output.write(dec_dictionary[p].pchar(), dec_dictionary[p].size());
 	  chunk.append(dec_dictionary[p]);
 	  /* Llegim també el caràcter següent al prefixe. */
@@ -310,8 +619,6 @@ public:
       }
     }
     
-    delete [] dec_dictionary;
-    
     if ( lb == 1 && output.good() ) return true;
     else return false;
   }
@@ -0,0 +1,81 @@
+/**
+ * @file MagicNumber.hpp
+ * @brief File including the magic numbers of the compressed files.
+ */
+
+#ifndef __MAGICNUMBER_HPP__
+#define __MAGICNUMBER_HPP__
+
+#include <iostream>
+#include <cstring>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include <HuffmanCompressor.hpp>
+#include <LZ77Compressor.hpp>
+#include <LZ78Compressor.hpp>
+#include <LZWCompressor.hpp>
+#include <FramedCompressor.hpp>
+
+/** Magic numbers of the files written by a single compressor. */
+static const uint16_t MAGIC_NUMBER[4] = {
+  0x27AB, // Huffman
+  0xA5E8, // LZ77
+  0x7869, // LZ78
+  0x8E83  // LZW
+};
+
+/* Framed format, written by every compression method. The magic numbers
+   above are still recognized when decompressing older files. */
+static const uint16_t FRAMED_MAGIC_NUMBER = 0x5C46;
+
+/** Size of a magic number, in bytes. */
+static const size_t MAGIC_NUMBER_SIZE = 2;
+
+inline uint16_t readMagicNumber(std::istream * input)
+{
+  uint16_t magicnum;
+  input->read((char *)(&magicnum), 2);
+  return ntohs(magicnum);
+}
+
+inline uint16_t readMagicNumber(const char * input)
+{
+  uint16_t magicnum;
+  memcpy(&magicnum, input, 2);
+  return ntohs(magicnum);
+}
+
+inline void writeMagicNumber(std::ostream * output, uint16_t mn)
+{
+  mn = htons(mn);
+  output->write((char*)(&mn), 2);
+}
+
+inline void writeMagicNumber(char * output, uint16_t mn)
+{
+  mn = htons(mn);
+  memcpy(output, &mn, 2);
+}
+
+inline bool checkMagicNumber(std::istream * input, uint16_t ref)
+{
+  return (readMagicNumber(input) == ref);
+}
+
+/**
+ * @brief Creates the decompressor of the files with a magic number.
+ * @param magicnum magic number.
+ * @return decompressor, or NULL if the magic number is not known.
+ */
+inline GenericCompressor * createDecompressor(uint16_t magicnum)
+{
+  if ( magicnum == FRAMED_MAGIC_NUMBER ) return new FramedCompressor();
+  else if ( magicnum == MAGIC_NUMBER[0] ) return new HuffmanCompressor();
+  else if ( magicnum == MAGIC_NUMBER[1] ) return new LZ77Compressor();
+  else if ( magicnum == MAGIC_NUMBER[2] ) return new LZ78Compressor();
+  else if ( magicnum == MAGIC_NUMBER[3] ) return new LZWCompressor();
+  return 0;
+}
+
+#endif
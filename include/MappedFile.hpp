@@ -0,0 +1,199 @@
+/**
+ * @file MappedFile.hpp
+ * @brief File including the implementation of MappedFile and MappedOutputFile classes.
+ */
+
+#ifndef __MAPPEDFILE_HPP__
+#define __MAPPEDFILE_HPP__
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @class MappedFile
+ * @brief This class maps a regular file into memory for reading.
+ *
+ * The whole file is mapped as a read-only contiguous span and the kernel is
+ * advised that it will be read sequentially (MADV_SEQUENTIAL), so it can read
+ * ahead aggressively. Only regular files can be mapped; pipes, terminals and
+ * other special files must be read through a stream.
+ */
+class MappedFile {
+private:
+  /** Start of the mapping. */
+  void * _data;
+  /** Size of the mapping, in bytes. */
+  size_t _size;
+  /** Whether a file is currently mapped. */
+  bool _open;
+
+  /** Non-copyable. */
+  MappedFile(const MappedFile&);
+  /** Non-copyable. */
+  MappedFile& operator = (const MappedFile&);
+
+public:
+  /**
+   * @brief Default constructor.
+   */
+  MappedFile() : _data(0), _size(0), _open(false) { }
+
+  /**
+   * @brief Destructor. The file is unmapped.
+   */
+  ~MappedFile()
+  { close(); }
+
+  /**
+   * @brief Maps a file into memory.
+   * @param filename name of the file to be mapped.
+   * @return true if the file is a regular file and it was mapped, false otherwise.
+   */
+  bool open(const std::string& filename)
+  {
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if ( fd < 0 ) return false;
+
+    struct stat st;
+    if ( fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ) { ::close(fd); return false; }
+
+    _size = st.st_size;
+    if ( _size > 0 ) {
+      _data = mmap(0, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if ( _data == MAP_FAILED ) { _data = 0; _size = 0; ::close(fd); return false; }
+      madvise(_data, _size, MADV_SEQUENTIAL);
+    }
+
+    /* The mapping remains valid after closing the descriptor. */
+    ::close(fd);
+    return (_open = true);
+  }
+
+  /**
+   * @brief Unmaps the file.
+   */
+  void close()
+  {
+    if ( _data != 0 ) munmap(_data, _size);
+    _data = 0; _size = 0; _open = false;
+  }
+
+  /**
+   * @brief Returns whether a file is mapped.
+   * @return true if a file is mapped, false otherwise.
+   */
+  bool is_open() const
+  { return _open; }
+
+  /**
+   * @brief Returns the start of the mapped file.
+   * @return pointer to the file content (NULL for empty files).
+   */
+  const char * data() const
+  { return (const char *)_data; }
+
+  /**
+   * @brief Returns the size of the mapped file.
+   * @return size in bytes.
+   */
+  size_t size() const
+  { return _size; }
+};
+
+/**
+ * @class MappedOutputFile
+ * @brief This class creates a file of a known size and maps it into memory for writing.
+ *
+ * The file is truncated to its final size with ftruncate() and mapped as a
+ * shared writable span, so that the data written to the span ends up in the
+ * file without any intermediate buffering or copies.
+ */
+class MappedOutputFile {
+private:
+  /** Start of the mapping. */
+  void * _data;
+  /** Size of the mapping, in bytes. */
+  size_t _size;
+  /** File descriptor. */
+  int _fd;
+
+  /** Non-copyable. */
+  MappedOutputFile(const MappedOutputFile&);
+  /** Non-copyable. */
+  MappedOutputFile& operator = (const MappedOutputFile&);
+
+public:
+  /**
+   * @brief Default constructor.
+   */
+  MappedOutputFile() : _data(0), _size(0), _fd(-1) { }
+
+  /**
+   * @brief Destructor. The file is unmapped and closed.
+   */
+  ~MappedOutputFile()
+  { close(); }
+
+  /**
+   * @brief Creates (or truncates) a file with the given size and maps it into memory.
+   * @param filename name of the file to be created.
+   * @param size final size of the file, in bytes.
+   * @return true if the file was created and mapped, false otherwise.
+   */
+  bool open(const std::string& filename, size_t size)
+  {
+    close();
+    _fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if ( _fd < 0 ) return false;
+
+    struct stat st;
+    if ( fstat(_fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+	 ftruncate(_fd, size) != 0 ) { close(); return false; }
+
+    _size = size;
+    if ( _size > 0 ) {
+      _data = mmap(0, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+      if ( _data == MAP_FAILED ) { _data = 0; close(); return false; }
+    }
+    return true;
+  }
+
+  /**
+   * @brief Unmaps and closes the file.
+   */
+  void close()
+  {
+    if ( _data != 0 ) munmap(_data, _size);
+    if ( _fd >= 0 ) ::close(_fd);
+    _data = 0; _size = 0; _fd = -1;
+  }
+
+  /**
+   * @brief Returns whether a file is mapped.
+   * @return true if a file is mapped, false otherwise.
+   */
+  bool is_open() const
+  { return _fd >= 0; }
+
+  /**
+   * @brief Returns the start of the mapped file.
+   * @return pointer to the file content (NULL for empty files).
+   */
+  char * data()
+  { return (char *)_data; }
+
+  /**
+   * @brief Returns the size of the mapped file.
+   * @return size in bytes.
+   */
+  size_t size() const
+  { return _size; }
+};
+
+#endif
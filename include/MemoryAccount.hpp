@@ -0,0 +1,252 @@
+/**
+ * @file MemoryAccount.hpp
+ * @brief File including the implementation of MemoryAccount and AccountedAllocator classes.
+ */
+
+#ifndef __MEMORYACCOUNT_HPP__
+#define __MEMORYACCOUNT_HPP__
+
+#include <cstddef>
+#include <new>
+#include <algorithm>
+
+#include <MemoryResource.hpp>
+
+/**
+ * @class MemoryAccount
+ * @brief Keeps track of the memory allocated by a compressor.
+ *
+ * The compressors open a Scope on their account while they work, and every
+ * allocation made through allocate() in the meantime (windows, buffers,
+ * dictionaries, ByteChunk contents, Huffman tree nodes...) is charged to it.
+ * Each block remembers its account in a small header, so it is credited back
+ * when it is freed, even if that happens out of the scope (i.e. when the
+ * compressor is destroyed). Blocks allocated with no scope open are not
+ * charged to any account.
+ *
+ * The memory is taken from the resource of the account (or from the default
+ * resource when there is none), and every block is given back to the
+ * resource it came from, so the resource may be changed at any time.
+ */
+class MemoryAccount {
+private:
+  /**
+   * @class Header
+   * @brief Header placed before every block.
+   */
+  union Header {
+    struct {
+      /** Resource the block was taken from. */
+      MemoryResource * resource;
+      /** Account charged with the block, or NULL. */
+      MemoryAccount * account;
+      /** Size of the block, in bytes. */
+      size_t size;
+    } block;
+    /** Keeps the blocks aligned as operator new does. */
+    long double align;
+  };
+
+  /** Bytes currently allocated. */
+  size_t current;
+  /** Maximum number of bytes allocated at the same time. */
+  size_t peak;
+  /** Number of allocations. */
+  size_t allocations;
+  /** Resource of the memory (NULL for the default resource). */
+  MemoryResource * resource;
+
+  /**
+   * @brief Returns the account charged by the calling thread.
+   */
+  static MemoryAccount *& active()
+  {
+    static thread_local MemoryAccount * account = 0;
+    return account;
+  }
+
+  MemoryAccount(const MemoryAccount&);
+  MemoryAccount& operator = (const MemoryAccount&);
+
+public:
+  /**
+   * @class Scope
+   * @brief Charges the allocations of the calling thread to an account during its life.
+   *
+   * Scopes can be nested: the previous account is charged again when it ends.
+   */
+  class Scope {
+  private:
+    MemoryAccount * previous;
+  public:
+    Scope(MemoryAccount& account) : previous(active())
+    { active() = &account; }
+
+    ~Scope()
+    { active() = previous; }
+  };
+
+  /**
+   * @brief Constructor.
+   */
+  MemoryAccount() : current(0), peak(0), allocations(0), resource(0) { }
+
+  /**
+   * @brief Changes the resource of the memory allocated from now on.
+   * @param r resource, or NULL to use the default resource.
+   */
+  void setResource(MemoryResource * r)
+  { resource = r; }
+
+  /**
+   * @brief Returns the resource of the memory (NULL for the default resource).
+   */
+  MemoryResource * getResource() const
+  { return resource; }
+
+  /**
+   * @brief Allocates a block, charged to the account of the current scope.
+   * @param n size of the block, in bytes.
+   * @return pointer to the block. std::bad_alloc is thrown if there is no memory.
+   */
+  static void * allocate(size_t n)
+  {
+    MemoryAccount * account = active();
+    MemoryResource * r = (account != 0 && account->resource != 0 ?
+			  account->resource : MemoryResource::getDefault());
+    Header * h = static_cast<Header *>(r->allocate(sizeof(Header)+n));
+    h->block.resource = r;
+    h->block.account = account;
+    h->block.size = n;
+    if ( account != 0 ) {
+      account->current += n;
+      account->peak = std::max(account->peak, account->current);
+      ++account->allocations;
+    }
+    return h+1;
+  }
+
+  /**
+   * @brief Frees a block returned by allocate().
+   * @param p pointer to the block (it may be NULL).
+   */
+  static void deallocate(void * p)
+  {
+    if ( p == 0 ) return;
+    Header * h = static_cast<Header *>(p)-1;
+    if ( h->block.account != 0 ) h->block.account->current -= h->block.size;
+    h->block.resource->deallocate(h, sizeof(Header)+h->block.size);
+  }
+
+  /**
+   * @brief Allocates a block, charged to the account of the current scope.
+   * Unlike allocate(), the failure has to be checked by the caller.
+   * @param n size of the block, in bytes.
+   * @return pointer to the block, or NULL if there is no memory.
+   */
+  static void * tryAllocate(size_t n)
+  {
+    try {
+      return allocate(n);
+    } catch ( std::bad_alloc& ) {
+      return 0;
+    }
+  }
+
+  /**
+   * @brief Allocates and default-constructs an array of objects.
+   * @param n number of objects.
+   * @return pointer to the array, or NULL if there is no memory.
+   */
+  template <typename T>
+  static T * tryAllocateArray(size_t n)
+  {
+    T * p = static_cast<T *>(tryAllocate(n*sizeof(T)));
+    if ( p != 0 )
+      for(size_t i = 0; i < n; ++i) new (p+i) T();
+    return p;
+  }
+
+  /**
+   * @brief Destroys and frees an array returned by tryAllocateArray().
+   * @param p pointer to the array (it may be NULL).
+   * @param n number of objects.
+   */
+  template <typename T>
+  static void deallocateArray(T * p, size_t n)
+  {
+    if ( p == 0 ) return;
+    for(size_t i = 0; i < n; ++i) p[i].~T();
+    deallocate(p);
+  }
+
+  /** Returns the bytes currently allocated. */
+  size_t getCurrent() const
+  { return current; }
+
+  /** Returns the maximum number of bytes allocated at the same time. */
+  size_t getPeak() const
+  { return peak; }
+
+  /** Returns the number of allocations. */
+  size_t getAllocations() const
+  { return allocations; }
+
+  /**
+   * @brief Starts measuring the peak and the allocations again. The memory
+   * currently allocated is kept.
+   */
+  void resetPeak()
+  {
+    peak = current;
+    allocations = 0;
+  }
+};
+
+/**
+ * @class AccountedAllocator
+ * @brief Allocator of the standard containers that goes through MemoryAccount.
+ */
+template <typename T>
+class AccountedAllocator {
+public:
+  typedef T value_type;
+  typedef T * pointer;
+  typedef const T * const_pointer;
+  typedef T & reference;
+  typedef const T & const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <typename U>
+  struct rebind { typedef AccountedAllocator<U> other; };
+
+  AccountedAllocator() { }
+  template <typename U>
+  AccountedAllocator(const AccountedAllocator<U>&) { }
+
+  pointer address(reference x) const { return &x; }
+  const_pointer address(const_reference x) const { return &x; }
+
+  pointer allocate(size_type n, const void * = 0)
+  { return static_cast<pointer>(MemoryAccount::allocate(n*sizeof(T))); }
+
+  void deallocate(pointer p, size_type)
+  { MemoryAccount::deallocate(p); }
+
+  size_type max_size() const
+  { return (size_type)-1/sizeof(T); }
+
+  void construct(pointer p, const T& v)
+  { new ((void *)p) T(v); }
+
+  void destroy(pointer p)
+  { p->~T(); }
+
+  template <typename U>
+  bool operator == (const AccountedAllocator<U>&) const { return true; }
+  template <typename U>
+  bool operator != (const AccountedAllocator<U>&) const { return false; }
+};
+
+#endif
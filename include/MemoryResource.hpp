@@ -0,0 +1,297 @@
+/**
+ * @file MemoryResource.hpp
+ * @brief File including the implementation of MemoryResource class and the
+ * resources provided with it.
+ */
+
+#ifndef __MEMORYRESOURCE_HPP__
+#define __MEMORYRESOURCE_HPP__
+
+#include <cstddef>
+#include <new>
+#include <algorithm>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define SCOMPRESSOR_HAVE_STD_PMR 1
+#endif
+#endif
+
+/**
+ * @class MemoryResource
+ * @brief Source of the memory used by the compressors.
+ *
+ * It has the same interface as std::pmr::memory_resource (which needs C++17,
+ * while the compressors only need C++0x); PmrResource adapts any
+ * std::pmr::memory_resource when it is available. As in std::pmr, allocate()
+ * throws std::bad_alloc when there is no memory.
+ */
+class MemoryResource {
+public:
+  /** Alignment used when none is given. */
+  static const size_t DEFAULT_ALIGNMENT = 16;
+
+  virtual ~MemoryResource() { }
+
+  /**
+   * @brief Allocates a block.
+   * @param bytes size of the block, in bytes.
+   * @param alignment alignment of the block (a power of 2).
+   * @return pointer to the block.
+   */
+  void * allocate(size_t bytes, size_t alignment = DEFAULT_ALIGNMENT)
+  { return doAllocate(bytes, alignment); }
+
+  /**
+   * @brief Frees a block returned by allocate().
+   * @param p pointer to the block.
+   * @param bytes size of the block, as given to allocate().
+   * @param alignment alignment of the block, as given to allocate().
+   */
+  void deallocate(void * p, size_t bytes, size_t alignment = DEFAULT_ALIGNMENT)
+  { doDeallocate(p, bytes, alignment); }
+
+  /**
+   * @brief Returns whether the blocks of a resource can be freed by this one.
+   */
+  bool isEqual(const MemoryResource& r) const
+  { return this == &r || doIsEqual(r); }
+
+  /**
+   * @brief Returns the resource used when the compressors are not given one.
+   */
+  static MemoryResource * getDefault()
+  { return defaultResource(); }
+
+  /**
+   * @brief Changes the resource used when the compressors are not given one.
+   * @param r new default resource, or NULL to use operator new again.
+   * @return previous default resource.
+   */
+  static MemoryResource * setDefault(MemoryResource * r);
+
+protected:
+  virtual void * doAllocate(size_t bytes, size_t alignment) = 0;
+  virtual void doDeallocate(void * p, size_t bytes, size_t alignment) = 0;
+  virtual bool doIsEqual(const MemoryResource& r) const
+  { return false; }
+
+private:
+  static MemoryResource *& defaultResource();
+};
+
+/**
+ * @class NewDeleteResource
+ * @brief Resource that uses the global operator new and operator delete.
+ */
+class NewDeleteResource : public MemoryResource {
+public:
+  /**
+   * @brief Returns the instance of the resource.
+   */
+  static NewDeleteResource * instance()
+  {
+    static NewDeleteResource resource;
+    return &resource;
+  }
+
+protected:
+  void * doAllocate(size_t bytes, size_t alignment)
+  { return ::operator new(bytes); }
+
+  void doDeallocate(void * p, size_t bytes, size_t alignment)
+  { ::operator delete(p); }
+
+  bool doIsEqual(const MemoryResource& r) const
+  { return dynamic_cast<const NewDeleteResource *>(&r) != 0; }
+};
+
+inline MemoryResource *& MemoryResource::defaultResource()
+{
+  static MemoryResource * resource = NewDeleteResource::instance();
+  return resource;
+}
+
+inline MemoryResource * MemoryResource::setDefault(MemoryResource * r)
+{
+  MemoryResource * previous = defaultResource();
+  defaultResource() = (r != 0 ? r : NewDeleteResource::instance());
+  return previous;
+}
+
+/**
+ * @class MonotonicResource
+ * @brief Arena that only frees its memory when it is released or destroyed.
+ *
+ * Blocks are carved out of chunks of growing size taken from an upstream
+ * resource, and deallocate() does nothing. It suits a compressor that is
+ * created, used for a request and thrown away. It is not thread-safe.
+ */
+class MonotonicResource : public MemoryResource {
+private:
+  /**
+   * @class Chunk
+   * @brief Header of a chunk taken from the upstream resource.
+   */
+  struct Chunk {
+    Chunk * next;
+    size_t size;
+  };
+
+  /** Resource that provides the chunks. */
+  MemoryResource * upstream;
+  /** Chunks taken so far. */
+  Chunk * chunks;
+  /** Free space of the last chunk. */
+  char * current;
+  /** Bytes left in the last chunk. */
+  size_t left;
+  /** Size of the next chunk. */
+  size_t next_size;
+
+  MonotonicResource(const MonotonicResource&);
+  MonotonicResource& operator = (const MonotonicResource&);
+
+protected:
+  void * doAllocate(size_t bytes, size_t alignment)
+  {
+    size_t pad = (alignment - (uintptr_t)current % alignment) % alignment;
+    if ( current == 0 || pad+bytes > left ) {
+      size_t size = std::max(next_size, sizeof(Chunk)+alignment+bytes);
+      Chunk * c = static_cast<Chunk *>(upstream->allocate(size));
+      c->next = chunks;
+      c->size = size;
+      chunks = c;
+      current = (char *)(c+1);
+      left = size-sizeof(Chunk);
+      next_size = std::min(next_size*2, (size_t)1 << 30);
+      pad = (alignment - (uintptr_t)current % alignment) % alignment;
+    }
+    void * p = current+pad;
+    current += pad+bytes;
+    left -= pad+bytes;
+    return p;
+  }
+
+  void doDeallocate(void * p, size_t bytes, size_t alignment)
+  { }
+
+public:
+  /**
+   * @brief Constructor.
+   * @param initial_size size of the first chunk, in bytes.
+   * @param up resource that provides the chunks (NULL for the default resource).
+   */
+  MonotonicResource(size_t initial_size = 65536, MemoryResource * up = 0)
+    : upstream(up != 0 ? up : getDefault()), chunks(0), current(0), left(0),
+      next_size(std::max(initial_size, (size_t)1024))
+  { }
+
+  /**
+   * @brief Destructor. All the memory is returned to the upstream resource.
+   */
+  ~MonotonicResource()
+  { release(); }
+
+  /**
+   * @brief Returns all the memory to the upstream resource. The blocks
+   * allocated so far must not be used anymore.
+   */
+  void release()
+  {
+    while ( chunks != 0 ) {
+      Chunk * c = chunks;
+      chunks = c->next;
+      upstream->deallocate(c, c->size);
+    }
+    current = 0;
+    left = 0;
+  }
+};
+
+/**
+ * @class HugePageResource
+ * @brief Resource that maps big blocks with transparent huge pages.
+ *
+ * Blocks of at least the threshold (i.e. big LZ77 windows or LZ78/LZW
+ * decompression dictionaries) are mapped directly and advised to be backed by
+ * huge pages, which saves TLB misses on random accesses. Smaller blocks go to
+ * the upstream resource.
+ */
+class HugePageResource : public MemoryResource {
+private:
+  /** Size of a huge page. */
+  static const size_t HUGE_PAGE_SIZE = (size_t)2 << 20;
+  /** Resource of the small blocks. */
+  MemoryResource * upstream;
+  /** Minimum size of the blocks that are mapped. */
+  size_t threshold;
+
+  /** Rounds a size up to a whole number of huge pages. */
+  static size_t roundUp(size_t bytes)
+  { return (bytes+HUGE_PAGE_SIZE-1) & ~(HUGE_PAGE_SIZE-1); }
+
+protected:
+  void * doAllocate(size_t bytes, size_t alignment)
+  {
+    if ( bytes < threshold ) return upstream->allocate(bytes, alignment);
+    void * p = mmap(0, roundUp(bytes), PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ( p == MAP_FAILED ) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    madvise(p, roundUp(bytes), MADV_HUGEPAGE);
+#endif
+    return p;
+  }
+
+  void doDeallocate(void * p, size_t bytes, size_t alignment)
+  {
+    if ( bytes < threshold ) upstream->deallocate(p, bytes, alignment);
+    else munmap(p, roundUp(bytes));
+  }
+
+public:
+  /**
+   * @brief Constructor.
+   * @param min_bytes minimum size of the blocks that are mapped (default: 1 MiB).
+   * @param up resource of the small blocks (NULL for the default resource).
+   */
+  HugePageResource(size_t min_bytes = (size_t)1 << 20, MemoryResource * up = 0)
+    : upstream(up != 0 ? up : getDefault()), threshold(min_bytes)
+  { }
+};
+
+#ifdef SCOMPRESSOR_HAVE_STD_PMR
+/**
+ * @class PmrResource
+ * @brief Adapts a std::pmr::memory_resource (i.e. std::pmr::monotonic_buffer_resource
+ * or std::pmr::synchronized_pool_resource) to MemoryResource.
+ */
+class PmrResource : public MemoryResource {
+private:
+  std::pmr::memory_resource * resource;
+
+protected:
+  void * doAllocate(size_t bytes, size_t alignment)
+  { return resource->allocate(bytes, alignment); }
+
+  void doDeallocate(void * p, size_t bytes, size_t alignment)
+  { resource->deallocate(p, bytes, alignment); }
+
+  bool doIsEqual(const MemoryResource& r) const
+  {
+    const PmrResource * p = dynamic_cast<const PmrResource *>(&r);
+    return p != 0 && resource->is_equal(*p->resource);
+  }
+
+public:
+  PmrResource(std::pmr::memory_resource * r) : resource(r) { }
+};
+#endif
+
+#endif
@@ -13,6 +13,8 @@
 #include <string>
 #include <map>
 
+#include <CpuDispatch.hpp>
+
 /**
  * @class NullSource
  * @brief Implementació d'una font de memòria nula.
@@ -66,6 +68,23 @@ public:
     return reader.eof();
   }
   
+  /**
+   * @brief Construeix la font de memòria nula a partir d'un buffer de memòria.
+   * @param buffer dades a llegir.
+   * @param n grandària en bytes del buffer.
+   */
+  void LoadFromBuffer(const char * buffer, size_t n)
+  {
+    this->clear();
+    /* Es compta sobre una taula plana i sols s'insereixen en el map
+       els símbols que apareixen. */
+    size_t counts[256] = { 0 };
+    CpuDispatch::histogram((const unsigned char *)buffer, n, counts);
+    for(int s = 0; s < 256; ++s)
+      if ( counts[s] > 0 ) (*this)[(char)s] = counts[s];
+    read_symbols = n;
+  }
+
   /**
    * @brief Construeix la font de memòria nula a partir d'un fitxer de dades.
    * @param filename nom del fitxer a utilitzar.
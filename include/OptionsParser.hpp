@@ -4,21 +4,29 @@
 #include <cctype>
 #include <cstdlib>
 #include <unistd.h>
+#include <getopt.h>
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <algorithm>
+
+#include <Filter.hpp>
 
 using namespace std;
 
 class OptionsParser {
 public:
-  typedef enum {Compression = 0, Decompression} WorkMode;
-  typedef enum {Huffman = 0, LZ77, LZ78, LZW, None} CompressionMethod;
+  typedef enum {Compression = 0, Decompression, Benchmark} WorkMode;
+  typedef enum {Huffman = 0, LZ77, LZ78, LZW, Auto, None} CompressionMethod;
 private:
   WorkMode workMode;
   CompressionMethod comprMethod;
-  string inputFile, outputFile;
-  bool parsed, showhelp;
+  vector<CompressionMethod> pipeline;
+  string inputFile, outputFile, traceFile;
+  FilterChain filters;
+  bool parsed, showhelp, asyncio, checksums, stats, perf, stagethreads;
+  unsigned iterations;
   int argc;
   char * const * argv;
 public:
@@ -27,9 +35,23 @@ public:
   {
   }
 
+  /**
+   * @brief Parses the name of a compression method.
+   * @return the method, or None if the name is not valid.
+   */
+  static CompressionMethod parseMethod(const string& name)
+  {
+    if ( name == "lzw" ) return LZW;
+    else if ( name == "lz77" ) return LZ77;
+    else if ( name == "lz78" ) return LZ78;
+    else if ( name == "huf" ) return Huffman;
+    else if ( name == "auto" ) return Auto;
+    return None;
+  }
+
   void help() const 
   {
-    cerr << "Usage: " << argv[0] << " [-c input | -x input] [-a algorithm] [-o output] [-h]" << endl;
+    cerr << "Usage: " << argv[0] << " [-c input | -x input | -b input] [-a algorithm] [-f filters] [-o output] [-n iterations] [-k] [-u] [--stage-threads] [--stats] [--perf] [--trace file] [-h]" << endl;
     cerr << "Options: " << endl;
     cerr << "-c <input>" << "\t"
 	 << "Compresses from the input source. Use '-' to use stdin." 
@@ -37,11 +59,41 @@ public:
     cerr << "-x <input>" << "\t"
 	 << "Decompresses from the input source. Use '-' to use stdin." 
 	 << endl;
+    cerr << "-b <input>" << "\t"
+	 << "Benchmarks the algorithms (or the one given with -a) in memory." 
+	 << endl;
     cerr << "-o <output>" << "\t"
 	 << "The result is written to output. Use '-' to use stdout." 
 	 << endl;
     cerr << "-a <algorithm>" << "\t"
-	 << "Valid algorithms are 'huf', 'lz77', 'lz78' and 'lzw'." 
+	 << "Valid algorithms are 'huf', 'lz77', 'lz78', 'lzw' and 'auto' (chosen for each frame)." 
+	 << endl;
+    cerr << "\t\t"
+	 << "Several ones separated by '+' (i.e. 'lz77+huf') are applied one after the other."
+	 << endl;
+    cerr << "-f <filters>" << "\t"
+	 << "Filters applied before compressing: 'delta:<stride>' and 'shuffle:<size>', separated by commas."
+	 << endl;
+    cerr << "-n <iterations>" << "\t"
+	 << "Number of runs of every benchmark (default: 3)." 
+	 << endl;
+    cerr << "-k" << "\t"
+	 << "Adds CRC-32C checksums of every frame and of the whole content." 
+	 << endl;
+    cerr << "-u" << "\t"
+	 << "Uses io_uring for file-to-file I/O (pread/pwrite if not available)." 
+	 << endl;
+    cerr << "--stage-threads" << "\t"
+	 << "Runs every algorithm of a pipeline (-a) on a thread of its own."
+	 << endl;
+    cerr << "--stats" << "\t"
+	 << "Writes the time of every phase and the algorithm counters to stderr." 
+	 << endl;
+    cerr << "--perf" << "\t"
+	 << "Reads the hardware performance counters in the benchmarks (-b)." 
+	 << endl;
+    cerr << "--trace <file>" << "\t"
+	 << "Writes a timeline of the work of every thread (Chrome trace format)." 
 	 << endl;
     cerr << "-h" << "\t"
 	 << "Shows this help." 
@@ -50,16 +102,34 @@ public:
 
   bool parse()
   {
+    /* Options without a short form. */
+    enum { STATS_OPTION = 256, PERF_OPTION, TRACE_OPTION, STAGE_THREADS_OPTION };
+    static const struct option long_options[] = {
+      { "stage-threads", no_argument, 0, STAGE_THREADS_OPTION },
+      { "stats", no_argument, 0, STATS_OPTION },
+      { "perf", no_argument, 0, PERF_OPTION },
+      { "trace", required_argument, 0, TRACE_OPTION },
+      { 0, 0, 0, 0 }
+    };
     int c;
 
     workMode = Decompression;
     inputFile = "-"; // stdin
     outputFile = "-"; // stdout
     showhelp = false;
+    asyncio = false;
+    checksums = false;
+    stats = false;
+    perf = false;
+    stagethreads = false;
+    traceFile = "";
+    iterations = 3;
     parsed = false;
     comprMethod = None;
+    pipeline.clear();
+    filters = FilterChain();
 
-    while( (c = getopt(argc, argv, "c:x:o:a:h")) != -1 ) {
+    while( (c = getopt_long(argc, argv, "c:x:b:o:a:f:n:kuh", long_options, 0)) != -1 ) {
       switch(c) {
       case 'c': 
 	workMode = Compression; 
@@ -69,46 +139,90 @@ public:
 	workMode = Decompression; 
 	inputFile = string(optarg);
 	break;
+      case 'b': 
+	workMode = Benchmark; 
+	inputFile = string(optarg);
+	break;
+      case 'n':
+	iterations = atoi(optarg);
+	if ( iterations == 0 ) {
+	  cerr << "Invalid number of iterations: " << optarg << endl;
+	  return false;
+	}
+	break;
       case 'o':
 	outputFile = string(optarg);
 	break;
-      case 'a':
-	if ( !strcmp(optarg, "lzw") )
-	  comprMethod = LZW;
-	else if ( !strcmp(optarg, "lz77") )
-	  comprMethod = LZ77;
-	else if ( !strcmp(optarg, "lz78") )
-	  comprMethod = LZ78;
-	else if ( !strcmp(optarg, "huf") )
-	  comprMethod = Huffman;
-	else {
-	  cerr << "Unknown compression method: " << optarg << endl;
+      case 'a': {
+	string list(optarg);
+	pipeline.clear();
+	for(size_t start = 0, end; start <= list.size(); start = end+1) {
+	  end = list.find('+', start);
+	  if ( end == string::npos ) end = list.size();
+	  CompressionMethod m = parseMethod(list.substr(start, end-start));
+	  if ( m == None ) {
+	    cerr << "Unknown compression method: " << optarg << endl;
+	    return false;
+	  }
+	  pipeline.push_back(m);
+	}
+	if ( pipeline.size() > 1 &&
+	     find(pipeline.begin(), pipeline.end(), Auto) != pipeline.end() ) {
+	  cerr << "'auto' cannot be a stage of a pipeline: " << optarg << endl;
 	  return false;
 	}
+	comprMethod = pipeline[0];
+	break;
+      }
+      case 'f':
+	if ( !filters.parse(optarg) ) {
+	  cerr << "Invalid filters: " << optarg << endl;
+	  return false;
+	}
+	break;
+      case 'k':
+	checksums = true;
+	break;
+      case 'u':
+	asyncio = true;
+	break;
       case 'h': 
 	showhelp = true; 
 	break;
+      case STATS_OPTION:
+	stats = true;
+	break;
+      case PERF_OPTION:
+	perf = true;
+	break;
+      case TRACE_OPTION:
+	traceFile = string(optarg);
+	break;
+      case STAGE_THREADS_OPTION:
+	stagethreads = true;
+	break;
       default:
-	if ( optopt == 'c' || optopt == 'x' || 
-	     optopt == 'a' || optopt == 'o')
+	if ( optopt == 'c' || optopt == 'x' || optopt == 'b' ||
+	     optopt == 'a' || optopt == 'f' || optopt == 'o' || optopt == 'n' )
 	  cerr << "Option -" << (char)optopt 
 	       << " requires an argument." << endl;
-	else 
+	else if ( optopt == TRACE_OPTION )
+	  cerr << "Option --trace requires an argument." << endl;
+	else if ( optopt != 0 )
 	  cerr << "Unknow option character -" << (char)optopt << endl;
 	return false;
       }
     }
 
-    if (workMode == Compression && comprMethod == None)
+    if (workMode == Compression && comprMethod == None) {
       comprMethod = LZW;
+      pipeline.assign(1, LZW);
+    }
 
     if (workMode == Decompression && comprMethod != None)
       cerr << "The decompression will be selected from the input." << endl;
-
-    if (comprMethod == Huffman && inputFile == "-") {
-      cerr << "Huffman can't compress from a stream. Choose a file." << endl;
-      return false;
-    }
+    if (workMode == Decompression && !filters.empty())
+      cerr << "The filters will be read from the input." << endl;
 
     return (parsed = true);
   }
@@ -123,6 +237,15 @@ public:
     return comprMethod;
   }
 
+  /**
+   * @brief Returns the methods given with -a, in the order they are applied.
+   * It has a single one unless a pipeline was given.
+   */
+  const vector<CompressionMethod>& getPipeline() const
+  {
+    return pipeline;
+  }
+
   string getInputFile() const 
   {
     return inputFile;
@@ -135,6 +258,30 @@ public:
 
   bool showHelp() const
   { return showhelp; }
+
+  unsigned getIterations() const
+  { return iterations; }
+
+  const FilterChain& getFilters() const
+  { return filters; }
+
+  bool useChecksums() const
+  { return checksums; }
+
+  bool useAsyncIO() const
+  { return asyncio; }
+
+  bool useStats() const
+  { return stats; }
+
+  bool usePerfCounters() const
+  { return perf; }
+
+  bool useStageThreads() const
+  { return stagethreads; }
+
+  string getTraceFile() const
+  { return traceFile; }
 };
 
 #endif
@@ -0,0 +1,182 @@
+/**
+ * @file PerfCounters.hpp
+ * @brief File including the implementation of PerfCounters class.
+ */
+
+#ifndef __PERFCOUNTERS_HPP__
+#define __PERFCOUNTERS_HPP__
+
+#include <cerrno>
+#include <cstring>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__NR_perf_event_open)
+#include <linux/perf_event.h>
+#define SCOMPRESSOR_HAVE_PERF_EVENTS 1
+#endif
+
+/**
+ * @class PerfCounters
+ * @brief Hardware performance counters of the calling thread.
+ *
+ * The counters are read with the Linux perf_event_open() system call, so no
+ * external profiler is needed. Only user-space events are counted, which is
+ * allowed with the default perf_event_paranoid setting. Every event is opened
+ * on its own, so that a processor (or a virtual machine) without one of them
+ * still reports the others. When the kernel multiplexes the counters, the
+ * values are scaled by the fraction of the time they were running.
+ */
+class PerfCounters {
+public:
+  /** Events that are counted. */
+  enum Event { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, NUM_EVENTS };
+
+private:
+  /** File descriptor of every event (-1 if it is not available). */
+  int fd[NUM_EVENTS];
+  /** Value, time enabled and time running of every event when start() was called. */
+  uint64_t started[NUM_EVENTS][3];
+  /** Accumulated (scaled) value of every event. */
+  uint64_t values[NUM_EVENTS];
+  /** Error of the last event that could not be opened. */
+  int error;
+
+  /**
+   * @brief Reads the value, time enabled and time running of an event.
+   * @return true if it was read, false otherwise.
+   */
+  bool readEvent(int e, uint64_t v[3]) const
+  {
+    return fd[e] >= 0 && read(fd[e], v, 3*sizeof(uint64_t)) == 3*sizeof(uint64_t);
+  }
+
+public:
+  /**
+   * @brief Constructor. The counters are not opened until open() is called.
+   */
+  PerfCounters() : error(0)
+  {
+    for(int e = 0; e < NUM_EVENTS; ++e) fd[e] = -1;
+    reset();
+  }
+
+  /**
+   * @brief Destructor.
+   */
+  ~PerfCounters()
+  { close(); }
+
+  /**
+   * @brief Opens the counters of the calling thread.
+   * @return true if at least one of them could be opened, false otherwise.
+   */
+  bool open()
+  {
+    close();
+#ifdef SCOMPRESSOR_HAVE_PERF_EVENTS
+    static const struct { uint32_t type; uint64_t config; } events[NUM_EVENTS] = {
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+      { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	(PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES }
+    };
+    bool any = false;
+    for(int e = 0; e < NUM_EVENTS; ++e) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = events[e].type;
+      attr.config = events[e].config;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fd[e] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      if ( fd[e] < 0 ) error = errno;
+      else any = true;
+    }
+    return any;
+#else
+    error = ENOSYS;
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Closes the counters.
+   */
+  void close()
+  {
+    for(int e = 0; e < NUM_EVENTS; ++e)
+      if ( fd[e] >= 0 ) { ::close(fd[e]); fd[e] = -1; }
+  }
+
+  /**
+   * @brief Returns whether an event is being counted.
+   */
+  bool available(Event e) const
+  { return fd[e] >= 0; }
+
+  /**
+   * @brief Returns the error of the last event that could not be opened.
+   */
+  const char * errorMessage() const
+  { return strerror(error); }
+
+  /**
+   * @brief Sets the accumulated values to zero.
+   */
+  void reset()
+  {
+    memset(values, 0, sizeof(values));
+    memset(started, 0, sizeof(started));
+  }
+
+  /**
+   * @brief Starts counting.
+   */
+  void start()
+  {
+    for(int e = 0; e < NUM_EVENTS; ++e)
+      if ( !readEvent(e, started[e]) ) memset(started[e], 0, sizeof(started[e]));
+  }
+
+  /**
+   * @brief Stops counting. The events since start() are added to the values.
+   */
+  void stop()
+  {
+    uint64_t v[3];
+    for(int e = 0; e < NUM_EVENTS; ++e) {
+      if ( !readEvent(e, v) ) continue;
+      uint64_t value = v[0]-started[e][0], enabled = v[1]-started[e][1];
+      uint64_t running = v[2]-started[e][2];
+      if ( running > 0 && running < enabled ) value = (uint64_t)((double)value*enabled/running);
+      values[e] += value;
+    }
+  }
+
+  /**
+   * @brief Returns the accumulated value of an event.
+   */
+  uint64_t get(Event e) const
+  { return values[e]; }
+
+  /**
+   * @brief Returns the name of an event.
+   */
+  static const char * name(Event e)
+  {
+    static const char * names[NUM_EVENTS] = {
+      "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses"
+    };
+    return names[e];
+  }
+};
+
+#endif
@@ -0,0 +1,324 @@
+/**
+ * @file PipelinedStream.hpp
+ * @brief File including the implementation of PipelinedReader and PipelinedWriter classes.
+ */
+
+#ifndef __PIPELINEDSTREAM_HPP__
+#define __PIPELINEDSTREAM_HPP__
+
+#include <iostream>
+#include <streambuf>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include <SPSCQueue.hpp>
+#include <Trace.hpp>
+
+/**
+ * @class PipelineBlock
+ * @brief Block of data exchanged between the stages of the pipeline.
+ */
+struct PipelineBlock {
+  /** Data of the block. */
+  char * data;
+  /** Number of valid bytes in the block. */
+  size_t size;
+  /** Whether reading the block from the source failed. */
+  bool failed;
+};
+
+/**
+ * @class PipelinedInputBuffer
+ * @brief Stream buffer whose data is read ahead from another stream by a reader thread.
+ *
+ * The reader thread fills free blocks from the source stream and passes them through
+ * a bounded SPSC queue to the consumer, which returns them through a second queue
+ * once they have been consumed. A block shorter than the block size marks the end
+ * of the source stream. A read error of the source is passed on too: it ends
+ * the data and sets the badbit of the stream given to the constructor.
+ */
+class PipelinedInputBuffer : public std::streambuf {
+private:
+  /** Source stream. */
+  std::istream& source;
+  /** Size of each block, in bytes. */
+  size_t block_size;
+  /** Storage of all the blocks. */
+  std::vector<char> storage;
+  /** Blocks filled by the reader thread. */
+  SPSCQueue<PipelineBlock> full_blocks;
+  /** Blocks already consumed, ready to be filled again. */
+  SPSCQueue<PipelineBlock> free_blocks;
+  /** Block being consumed. */
+  PipelineBlock current;
+  /** Whether the last block of the source stream was received. */
+  bool finished;
+  /** Stream whose badbit is set on a read error, or NULL. */
+  std::ios * owner;
+  /** Reader thread. */
+  std::thread reader;
+
+  /**
+   * @brief Body of the reader thread.
+   */
+  void run()
+  {
+    Trace::setThreadName("reader");
+    PipelineBlock b;
+    do {
+      if ( !free_blocks.try_pop(b) ) {
+	SCOMPRESSOR_TRACE("wait free block", "wait");
+	if ( !free_blocks.pop(b) ) return;
+      }
+      {
+	SCOMPRESSOR_TRACE("read block", "io");
+	source.read(b.data, block_size);
+	b.size = source.gcount();
+	b.failed = source.bad();
+      }
+      if ( !full_blocks.try_push(b) ) {
+	SCOMPRESSOR_TRACE("wait consumer", "wait");
+	if ( !full_blocks.push(b) ) return;
+      }
+    } while ( b.size == block_size && !b.failed );
+  }
+
+protected:
+  int_type underflow()
+  {
+    if ( gptr() < egptr() ) return traits_type::to_int_type(*gptr());
+    if ( finished ) return traits_type::eof();
+    if ( current.data != 0 ) free_blocks.push(current);
+    if ( !full_blocks.try_pop(current) ) {
+      SCOMPRESSOR_TRACE("wait input", "wait");
+      if ( !full_blocks.pop(current) ) {
+	current.data = 0;
+	finished = true;
+	return traits_type::eof();
+      }
+    }
+    if ( current.size < block_size || current.failed ) finished = true;
+    if ( current.failed ) {
+      setg(0, 0, 0);
+      if ( owner != 0 ) owner->setstate(std::ios::badbit);
+      return traits_type::eof();
+    }
+    setg(current.data, current.data, current.data+current.size);
+    if ( current.size == 0 ) return traits_type::eof();
+    return traits_type::to_int_type(*gptr());
+  }
+
+public:
+  /**
+   * @brief Constructor. The reader thread starts reading immediately.
+   * @param src source stream.
+   * @param bsize size of each block, in bytes.
+   * @param nblocks number of blocks in flight.
+   * @param own stream whose badbit is set if the source fails, or NULL.
+   */
+  PipelinedInputBuffer(std::istream& src, size_t bsize, size_t nblocks, std::ios * own = 0)
+    : source(src), block_size(bsize), storage(bsize*nblocks),
+      full_blocks(nblocks), free_blocks(nblocks), finished(false), owner(own)
+  {
+    current.data = 0; current.size = 0; current.failed = false;
+    for(size_t i = 0; i < nblocks; ++i) {
+      PipelineBlock b = { &storage[i*bsize], 0, false };
+      free_blocks.push(b);
+    }
+    reader = std::thread(&PipelinedInputBuffer::run, this);
+  }
+
+  /**
+   * @brief Destructor. The reader thread is stopped.
+   */
+  ~PipelinedInputBuffer()
+  {
+    free_blocks.close();
+    full_blocks.close();
+    reader.join();
+  }
+};
+
+/**
+ * @class PipelinedOutputBuffer
+ * @brief Stream buffer whose data is written to another stream by a writer thread.
+ *
+ * Full blocks are passed through a bounded SPSC queue to the writer thread, which
+ * writes them to the destination stream and returns them through a second queue.
+ * close() must be called to write the last block and wait for the writer thread.
+ */
+class PipelinedOutputBuffer : public std::streambuf {
+private:
+  /** Destination stream. */
+  std::ostream& sink;
+  /** Size of each block, in bytes. */
+  size_t block_size;
+  /** Storage of all the blocks. */
+  std::vector<char> storage;
+  /** Blocks ready to be written by the writer thread. */
+  SPSCQueue<PipelineBlock> full_blocks;
+  /** Blocks already written, ready to be filled again. */
+  SPSCQueue<PipelineBlock> free_blocks;
+  /** Block being filled. */
+  PipelineBlock current;
+  /** Whether the destination stream failed. */
+  std::atomic<bool> failed;
+  /** Writer thread. */
+  std::thread writer;
+
+  /**
+   * @brief Body of the writer thread. A block without data ends the thread.
+   */
+  void run()
+  {
+    Trace::setThreadName("writer");
+    for(;;) {
+      PipelineBlock b;
+      if ( !full_blocks.try_pop(b) ) {
+	SCOMPRESSOR_TRACE("wait producer", "wait");
+	if ( !full_blocks.pop(b) ) return;
+      }
+      if ( b.data == 0 ) return;
+      {
+	SCOMPRESSOR_TRACE("write block", "io");
+	if ( !failed.load() && !sink.write(b.data, b.size).good() ) failed.store(true);
+      }
+      free_blocks.push(b);
+    }
+  }
+
+  /**
+   * @brief Passes the current block to the writer thread and takes a free block.
+   * @return false if the destination stream failed, true otherwise.
+   */
+  bool submit()
+  {
+    if ( pptr() > pbase() ) {
+      current.size = pptr()-pbase();
+      full_blocks.push(current);
+      if ( !free_blocks.try_pop(current) ) {
+	SCOMPRESSOR_TRACE("wait output", "wait");
+	free_blocks.pop(current);
+      }
+      setp(current.data, current.data+block_size);
+    }
+    return !failed.load();
+  }
+
+protected:
+  int_type overflow(int_type c)
+  {
+    if ( !submit() ) return traits_type::eof();
+    if ( !traits_type::eq_int_type(c, traits_type::eof()) ) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync()
+  {
+    return (submit() ? 0 : -1);
+  }
+
+public:
+  /**
+   * @brief Constructor. The writer thread starts immediately.
+   * @param dst destination stream.
+   * @param bsize size of each block, in bytes.
+   * @param nblocks number of blocks in flight.
+   */
+  PipelinedOutputBuffer(std::ostream& dst, size_t bsize, size_t nblocks)
+    : sink(dst), block_size(bsize), storage(bsize*nblocks),
+      full_blocks(nblocks+1), free_blocks(nblocks), failed(false)
+  {
+    for(size_t i = 1; i < nblocks; ++i) {
+      PipelineBlock b = { &storage[i*bsize], 0, false };
+      free_blocks.push(b);
+    }
+    current.data = &storage[0]; current.size = 0; current.failed = false;
+    setp(current.data, current.data+block_size);
+    writer = std::thread(&PipelinedOutputBuffer::run, this);
+  }
+
+  /**
+   * @brief Destructor. The pipeline is closed if it was not closed yet.
+   */
+  ~PipelinedOutputBuffer()
+  {
+    close();
+  }
+
+  /**
+   * @brief Writes the pending data and waits for the writer thread to finish.
+   * @return true if all the data was written to the destination stream, false otherwise.
+   */
+  bool close()
+  {
+    if ( writer.joinable() ) {
+      submit();
+      PipelineBlock end = { 0, 0, false };
+      full_blocks.push(end);
+      writer.join();
+      setp(0, 0);
+      if ( !sink.flush().good() ) failed.store(true);
+    }
+    return !failed.load();
+  }
+};
+
+/**
+ * @class PipelinedReader
+ * @brief Input stream that reads ahead from another stream in a separate thread.
+ * @see PipelinedInputBuffer
+ */
+class PipelinedReader : public std::istream {
+private:
+  /** Stream buffer. */
+  PipelinedInputBuffer buffer;
+public:
+  /**
+   * @brief Constructor.
+   * @param src source stream.
+   * @param bsize size of each block, in bytes (default: 64 KiB).
+   * @param nblocks number of blocks in flight (default: 4).
+   */
+  PipelinedReader(std::istream& src, size_t bsize = 65536, size_t nblocks = 4)
+    : std::istream(0), buffer(src, bsize, nblocks, this)
+  { rdbuf(&buffer); }
+};
+
+/**
+ * @class PipelinedWriter
+ * @brief Output stream that writes to another stream in a separate thread.
+ * @see PipelinedOutputBuffer
+ */
+class PipelinedWriter : public std::ostream {
+private:
+  /** Stream buffer. */
+  PipelinedOutputBuffer buffer;
+public:
+  /**
+   * @brief Constructor.
+   * @param dst destination stream.
+   * @param bsize size of each block, in bytes (default: 64 KiB).
+   * @param nblocks number of blocks in flight (default: 4).
+   */
+  PipelinedWriter(std::ostream& dst, size_t bsize = 65536, size_t nblocks = 4)
+    : std::ostream(0), buffer(dst, bsize, nblocks)
+  { rdbuf(&buffer); }
+
+  /**
+   * @brief Writes the pending data and waits for the writer thread to finish.
+   * @return true if all the data was written, false otherwise.
+   */
+  bool close()
+  {
+    bool ok = buffer.close();
+    if ( !ok ) setstate(std::ios::badbit);
+    return ok;
+  }
+};
+
+#endif
@@ -0,0 +1,183 @@
+/**
+ * @file SPSCQueue.hpp
+ * @brief File including the implementation of SPSCQueue class.
+ */
+
+#ifndef __SPSCQUEUE_HPP__
+#define __SPSCQUEUE_HPP__
+
+#include <cstddef>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+/**
+ * @class SPSCQueue
+ * @brief Bounded lock-free queue for a single producer and a single consumer.
+ *
+ * The queue is a ring buffer where only the producer modifies the tail and
+ * only the consumer modifies the head, so no locks are needed. One slot is
+ * always left empty to distinguish a full queue from an empty one.
+ * The blocking operations push() and pop() yield the processor for a while
+ * when the queue is full or empty, respectively, and then sleep on a condition
+ * variable, so a thread waiting on a slow pipe or disk does not burn a core.
+ * The mutex is only taken by a thread that goes to sleep and by the one that
+ * wakes it up.
+ */
+template <typename T>
+class SPSCQueue {
+private:
+  /** Ring buffer. */
+  std::vector<T> ring;
+  /** Position of the next element to pop. Only modified by the consumer. */
+  std::atomic<size_t> head;
+  /** Position of the next element to push. Only modified by the producer. */
+  std::atomic<size_t> tail;
+  /** Number of threads sleeping on the queue. */
+  std::atomic<unsigned> sleepers;
+  /** Whether the queue is closed. */
+  std::atomic<bool> closed;
+  std::mutex mutex;
+  std::condition_variable cond;
+
+  /** Number of times a blocking operation yields before sleeping. */
+  static const unsigned SPIN_LIMIT = 64;
+
+  /** Non-copyable. */
+  SPSCQueue(const SPSCQueue&);
+  /** Non-copyable. */
+  SPSCQueue& operator = (const SPSCQueue&);
+
+public:
+  /**
+   * @brief Constructor.
+   * @param capacity maximum number of elements in the queue.
+   */
+  explicit SPSCQueue(size_t capacity)
+    : ring(capacity+1), head(0), tail(0), sleepers(0), closed(false)
+  { }
+
+private:
+  /** Adds an element if the queue is not full, without waking anyone. */
+  bool enqueue(const T& v)
+  {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t n = (t+1) % ring.size();
+    if ( n == head.load(std::memory_order_acquire) ) return false;
+    ring[t] = v;
+    tail.store(n, std::memory_order_release);
+    return true;
+  }
+
+  /** Removes an element if the queue is not empty, without waking anyone. */
+  bool dequeue(T& v)
+  {
+    size_t h = head.load(std::memory_order_relaxed);
+    if ( h == tail.load(std::memory_order_acquire) ) return false;
+    v = ring[h];
+    head.store((h+1) % ring.size(), std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Wakes up the other thread if it is sleeping.
+   *
+   * Both threads modify the counter of sleepers with read-modify-write
+   * operations: if this one does not see the sleeper, the sleeper's increment
+   * comes later and synchronizes with it, so the sleeper sees the change of
+   * the queue before sleeping.
+   */
+  void wake()
+  {
+    if ( sleepers.fetch_add(0) > 0 ) {
+      std::lock_guard<std::mutex> lock(mutex);
+      cond.notify_all();
+    }
+  }
+
+  /**
+   * @brief Retries an operation until it succeeds or the queue is closed,
+   * spinning first and sleeping afterwards.
+   * @param op operation (enqueue or dequeue).
+   * @return true if the operation succeeded, false if the queue was closed.
+   */
+  template <typename Op>
+  bool wait(Op op)
+  {
+    for(unsigned i = 0; i < SPIN_LIMIT; ++i) {
+      if ( op() ) return true;
+      if ( closed.load(std::memory_order_acquire) ) return false;
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    sleepers.fetch_add(1);
+    bool done;
+    while ( !(done = op()) && !closed.load(std::memory_order_acquire) ) cond.wait(lock);
+    sleepers.fetch_sub(1);
+    return done;
+  }
+
+public:
+  /**
+   * @brief Tries to add an element at the end of the queue.
+   * @param v element to be added.
+   * @return false if the queue is full, true otherwise.
+   */
+  bool try_push(const T& v)
+  {
+    if ( !enqueue(v) ) return false;
+    wake();
+    return true;
+  }
+
+  /**
+   * @brief Tries to remove the element at the front of the queue.
+   * @param[out] v removed element.
+   * @return false if the queue is empty, true otherwise.
+   */
+  bool try_pop(T& v)
+  {
+    if ( !dequeue(v) ) return false;
+    wake();
+    return true;
+  }
+
+  /**
+   * @brief Adds an element at the end of the queue, waiting while it is full.
+   * @param v element to be added.
+   * @return false if the queue was closed while waiting, true otherwise.
+   */
+  bool push(const T& v)
+  {
+    if ( !wait([&]() { return enqueue(v); }) ) return false;
+    wake();
+    return true;
+  }
+
+  /**
+   * @brief Removes the element at the front of the queue, waiting while it is empty.
+   * @param[out] v removed element.
+   * @return false if the queue was closed while it was empty, true otherwise.
+   */
+  bool pop(T& v)
+  {
+    if ( !wait([&]() { return dequeue(v); }) ) return false;
+    wake();
+    return true;
+  }
+
+  /**
+   * @brief Closes the queue and wakes up the threads waiting on it, i.e. to
+   * stop a thread blocked in push() or pop().
+   */
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed.store(true, std::memory_order_release);
+    cond.notify_all();
+  }
+};
+
+#endif
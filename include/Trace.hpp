@@ -0,0 +1,221 @@
+/**
+ * @file Trace.hpp
+ * @brief File including the implementation of Trace class.
+ */
+
+#ifndef __TRACE_HPP__
+#define __TRACE_HPP__
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <stdint.h>
+
+/**
+ * @class Trace
+ * @brief Timeline of the work done by every thread, in the Chrome trace format.
+ *
+ * Spans are recorded with the SCOMPRESSOR_TRACE macro around block-sized work
+ * (a block read, a frame compressed, a wait on a queue...), never around
+ * per-byte work. Every thread appends its spans to its own buffer, so
+ * recording a span takes two clock reads and no lock; while the trace is not
+ * enabled it is a single test. The file written by write() can be opened
+ * with chrome://tracing or https://ui.perfetto.dev.
+ */
+class Trace {
+public:
+  /**
+   * @class Event
+   * @brief Span of a thread.
+   */
+  struct Event {
+    /** Name of the span (a string literal). */
+    const char * name;
+    /** Category of the span (a string literal). */
+    const char * category;
+    /** Start of the span, in nanoseconds. */
+    uint64_t start;
+    /** Duration of the span, in nanoseconds. */
+    uint64_t duration;
+  };
+
+private:
+  /**
+   * @class ThreadBuffer
+   * @brief Spans recorded by a thread.
+   */
+  struct ThreadBuffer {
+    /** Sequential identifier of the thread. */
+    unsigned tid;
+    /** Name of the thread. */
+    std::string name;
+    /** Spans of the thread. */
+    std::vector<Event> events;
+  };
+
+  /** Mutex of the list of buffers. */
+  std::mutex mutex;
+  /** Buffers of all the threads that recorded a span. They are never freed,
+      so the spans of the threads that already finished are kept. */
+  std::vector<ThreadBuffer *> buffers;
+
+  Trace() { }
+
+  /**
+   * @brief Returns the buffer of the calling thread, creating it the first time.
+   */
+  ThreadBuffer& local()
+  {
+    static thread_local ThreadBuffer * buffer = 0;
+    if ( buffer == 0 ) {
+      std::lock_guard<std::mutex> lock(mutex);
+      buffer = new ThreadBuffer();
+      buffer->tid = buffers.size()+1;
+      buffers.push_back(buffer);
+    }
+    return *buffer;
+  }
+
+  /** Writes a string as a JSON string. */
+  static void writeString(std::ostream& os, const std::string& s)
+  {
+    os << '"';
+    for(size_t i = 0; i < s.size(); ++i) {
+      if ( s[i] == '"' || s[i] == '\\' ) os << '\\';
+      os << s[i];
+    }
+    os << '"';
+  }
+
+public:
+  /**
+   * @brief Returns the trace of the process.
+   */
+  static Trace& instance()
+  {
+    static Trace trace;
+    return trace;
+  }
+
+  /**
+   * @brief Returns the switch that enables the trace.
+   * @return reference to the switch (false by default).
+   */
+  static bool& enabled()
+  {
+    static bool on = false;
+    return on;
+  }
+
+  /**
+   * @brief Returns a monotonic time, in nanoseconds.
+   */
+  static uint64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+      (std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /**
+   * @brief Names the calling thread in the trace.
+   * @param name name of the thread.
+   */
+  static void setThreadName(const char * name)
+  {
+    if ( enabled() ) instance().local().name = name;
+  }
+
+  /**
+   * @brief Records a span of the calling thread.
+   * @param name name of the span.
+   * @param category category of the span.
+   * @param start start of the span, as returned by now().
+   * @param end end of the span, as returned by now().
+   */
+  void record(const char * name, const char * category, uint64_t start, uint64_t end)
+  {
+    Event e = { name, category, start, end-start };
+    local().events.push_back(e);
+  }
+
+  /**
+   * @class Span
+   * @brief Records a span from its construction to its destruction.
+   */
+  class Span {
+  private:
+    const char * name;
+    const char * category;
+    uint64_t start;
+  public:
+    /**
+     * @brief Constructor. It does nothing if the trace is not enabled.
+     * @param n name of the span (a string literal).
+     * @param c category of the span (a string literal).
+     */
+    Span(const char * n, const char * c)
+      : name(n), category(c), start(enabled() ? now() : 0)
+    { }
+
+    /**
+     * @brief Destructor. The span is recorded.
+     */
+    ~Span()
+    {
+      if ( start != 0 ) instance().record(name, category, start, now());
+    }
+  };
+
+  /**
+   * @brief Writes all the spans recorded so far as a Chrome trace (JSON).
+   *
+   * No thread may be recording spans while they are written.
+   * @param os output stream.
+   * @return true if it was written, false otherwise.
+   */
+  bool write(std::ostream& os)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    /* The times are written relative to the first span. */
+    uint64_t origin = (uint64_t)-1;
+    for(size_t b = 0; b < buffers.size(); ++b)
+      for(size_t i = 0; i < buffers[b]->events.size(); ++i)
+	origin = std::min(origin, buffers[b]->events[i].start);
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+    bool first = true;
+    char ts[64];
+    for(size_t b = 0; b < buffers.size(); ++b) {
+      const ThreadBuffer& tb = *buffers[b];
+      if ( !tb.name.empty() ) {
+	os << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+	   << tb.tid << ",\"args\":{\"name\":";
+	writeString(os, tb.name);
+	os << "}}";
+	first = false;
+      }
+      for(size_t i = 0; i < tb.events.size(); ++i) {
+	const Event& e = tb.events[i];
+	/* Microseconds with nanosecond precision. */
+	snprintf(ts, sizeof(ts), "\"ts\":%.3f,\"dur\":%.3f",
+		 (e.start-origin)/1e3, e.duration/1e3);
+	os << (first ? "" : ",\n") << "{\"ph\":\"X\",\"name\":";
+	writeString(os, e.name);
+	os << ",\"cat\":";
+	writeString(os, e.category);
+	os << ",\"pid\":1,\"tid\":" << tb.tid << "," << ts << "}";
+	first = false;
+      }
+    }
+    os << std::endl << "]}" << std::endl;
+    return os.good();
+  }
+};
+
+/** Records the rest of the scope as a span of the calling thread. */
+#define SCOMPRESSOR_TRACE(name, category) Trace::Span trace_span_(name, category)
+
+#endif
@@ -0,0 +1,217 @@
+/**
+ * @file scompressor.h
+ * @brief C interface of libscompressor.
+ *
+ * The library compresses in the same format as the scompressor program
+ * (framed, with its magic number), so the data compressed by one can be
+ * decompressed by the other. The older files written by a single compressor
+ * are decompressed too.
+ *
+ * A context keeps the parameters, the statistics and the working memory of
+ * the compressors between calls, so reusing one for many inputs is cheaper
+ * than creating one for each. A context must not be used by two threads at
+ * the same time; use one context per thread.
+ *
+ * @code
+ * scompressor_ctx * ctx = scompressor_create();
+ * scompressor_set_param(ctx, SCOMPRESSOR_PARAM_METHOD, SCOMPRESSOR_AUTO);
+ * size_t cap = scompressor_compress_bound(ctx, n);
+ * size_t c = scompressor_compress(ctx, dst, cap, src, n);
+ * if ( scompressor_is_error(c) ) ...
+ * scompressor_free(ctx);
+ * @endcode
+ */
+
+#ifndef __SCOMPRESSOR_H__
+#define __SCOMPRESSOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define SCOMPRESSOR_API __attribute__ ((visibility ("default")))
+#else
+#define SCOMPRESSOR_API
+#endif
+
+/** Version of the interface. The major version changes when the ABI breaks. */
+#define SCOMPRESSOR_VERSION_MAJOR 1
+#define SCOMPRESSOR_VERSION_MINOR 1
+#define SCOMPRESSOR_VERSION_NUMBER (SCOMPRESSOR_VERSION_MAJOR*100 + SCOMPRESSOR_VERSION_MINOR)
+
+/** Value returned by the functions that return a size when they fail. */
+#define SCOMPRESSOR_ERROR ((size_t)-1)
+
+/** Compression context (opaque). */
+typedef struct scompressor_ctx scompressor_ctx;
+
+/** Compression methods. */
+typedef enum {
+  SCOMPRESSOR_HUFFMAN = 0,
+  SCOMPRESSOR_LZ77 = 1,
+  SCOMPRESSOR_LZ78 = 2,
+  SCOMPRESSOR_LZW = 3,
+  /** Chosen for every frame from a sample of it. */
+  SCOMPRESSOR_AUTO = 4
+} scompressor_method;
+
+/** Parameters of the compression. */
+typedef enum {
+  /** Compression method (scompressor_method; default: SCOMPRESSOR_LZW). */
+  SCOMPRESSOR_PARAM_METHOD = 0,
+  /** Whether CRC-32C checksums of every frame and of the content are written (default: 0). */
+  SCOMPRESSOR_PARAM_CHECKSUMS = 1,
+  /** Size of the frames, in bytes (default: 1 MiB, maximum: 256 MiB). */
+  SCOMPRESSOR_PARAM_FRAME_SIZE = 2,
+  /** Stride of the delta filter, in bytes (0 to disable it, the default; maximum: 255). */
+  SCOMPRESSOR_PARAM_DELTA = 3,
+  /** Element size of the shuffle filter, applied after the delta filter, in bytes
+      (0 to disable it, the default; 2 to 255). */
+  SCOMPRESSOR_PARAM_SHUFFLE = 4
+} scompressor_param;
+
+/** Statistics of a context, as returned by scompressor_get_stat(). */
+typedef enum {
+  /** Wall time of every phase, in nanoseconds (needs scompressor_enable_stats()). */
+  SCOMPRESSOR_STAT_READ_NS = 0,
+  SCOMPRESSOR_STAT_HISTOGRAM_NS,
+  SCOMPRESSOR_STAT_TREE_BUILD_NS,
+  SCOMPRESSOR_STAT_MATCH_SEARCH_NS,
+  SCOMPRESSOR_STAT_DICTIONARY_FILL_NS,
+  SCOMPRESSOR_STAT_BIT_OUTPUT_NS,
+  SCOMPRESSOR_STAT_DECODE_NS,
+  SCOMPRESSOR_STAT_WRITE_NS,
+  /** Algorithm counters. */
+  SCOMPRESSOR_STAT_LZ77_TOKENS,
+  SCOMPRESSOR_STAT_LZ77_LITERALS,
+  SCOMPRESSOR_STAT_LZ77_MATCHES,
+  SCOMPRESSOR_STAT_LZ77_MATCH_BYTES,
+  SCOMPRESSOR_STAT_LZ77_COMPARISONS,
+  SCOMPRESSOR_STAT_DICTIONARY_SIZE,
+  SCOMPRESSOR_STAT_DICTIONARY_HITS,
+  SCOMPRESSOR_STAT_DICTIONARY_MISSES,
+  SCOMPRESSOR_STAT_DICTIONARY_INSERTS,
+  SCOMPRESSOR_STAT_HUFFMAN_SYMBOLS,
+  SCOMPRESSOR_STAT_HUFFMAN_CODE_BITS,
+  /** Memory of the compressors: bytes allocated, peak and number of allocations. */
+  SCOMPRESSOR_STAT_MEMORY_CURRENT,
+  SCOMPRESSOR_STAT_MEMORY_PEAK,
+  SCOMPRESSOR_STAT_ALLOCATIONS
+} scompressor_stat;
+
+/**
+ * Reads up to n bytes into buf.
+ * @return number of bytes read, 0 at the end of the input, or
+ * SCOMPRESSOR_ERROR if the input failed.
+ */
+typedef size_t (*scompressor_read_fn)(void * opaque, void * buf, size_t n);
+
+/**
+ * Writes n bytes from buf.
+ * @return n, or any other value if the output failed.
+ */
+typedef size_t (*scompressor_write_fn)(void * opaque, const void * buf, size_t n);
+
+/** Returns SCOMPRESSOR_VERSION_NUMBER of the library. */
+SCOMPRESSOR_API unsigned scompressor_version(void);
+
+/** Returns whether a size returned by the library is an error. */
+SCOMPRESSOR_API int scompressor_is_error(size_t code);
+
+/** Creates a context with the default parameters, or returns NULL if there is no memory. */
+SCOMPRESSOR_API scompressor_ctx * scompressor_create(void);
+
+/** Frees a context and its memory (ctx may be NULL). */
+SCOMPRESSOR_API void scompressor_free(scompressor_ctx * ctx);
+
+/**
+ * Changes a parameter of the compression.
+ * @return 0 on success, -1 if the parameter or the value are not valid.
+ */
+SCOMPRESSOR_API int scompressor_set_param(scompressor_ctx * ctx, scompressor_param param, long value);
+
+/** Returns the value of a parameter, or -1 if it is not valid. */
+SCOMPRESSOR_API long scompressor_get_param(const scompressor_ctx * ctx, scompressor_param param);
+
+/** Returns the maximum size of n bytes compressed with the parameters of ctx. */
+SCOMPRESSOR_API size_t scompressor_compress_bound(const scompressor_ctx * ctx, size_t n);
+
+/**
+ * Compresses a buffer into another one.
+ * @return size of the compressed data, or SCOMPRESSOR_ERROR if it failed
+ * (i.e. cap is smaller than scompressor_compress_bound() and the data did not fit).
+ */
+SCOMPRESSOR_API size_t scompressor_compress(scompressor_ctx * ctx, void * dst, size_t cap,
+					    const void * src, size_t n);
+
+/**
+ * Decompresses a buffer into another one.
+ * @return size of the decompressed data, or SCOMPRESSOR_ERROR if it failed.
+ */
+SCOMPRESSOR_API size_t scompressor_decompress(scompressor_ctx * ctx, void * dst, size_t cap,
+					      const void * src, size_t n);
+
+/**
+ * Gets the size of the decompressed data from the header of the compressed data.
+ * @return 0 if it is known (and stored in size), -1 otherwise (i.e. the data was
+ * compressed from a stream).
+ */
+SCOMPRESSOR_API int scompressor_get_decompressed_size(const void * src, size_t n, uint64_t * size);
+
+/**
+ * Compresses the data read by a callback and writes it with another one.
+ * @return 0 on success, -1 on error.
+ */
+SCOMPRESSOR_API int scompressor_compress_stream(scompressor_ctx * ctx,
+						scompressor_read_fn read, void * in,
+						scompressor_write_fn write, void * out);
+
+/**
+ * Decompresses the data read by a callback and writes it with another one.
+ * @return 0 on success, -1 on error.
+ */
+SCOMPRESSOR_API int scompressor_decompress_stream(scompressor_ctx * ctx,
+						  scompressor_read_fn read, void * in,
+						  scompressor_write_fn write, void * out);
+
+/** Compresses from a file descriptor to another. @return 0 on success, -1 on error. */
+SCOMPRESSOR_API int scompressor_compress_fd(scompressor_ctx * ctx, int in, int out);
+
+/** Decompresses from a file descriptor to another. @return 0 on success, -1 on error. */
+SCOMPRESSOR_API int scompressor_decompress_fd(scompressor_ctx * ctx, int in, int out);
+
+/**
+ * Enables or disables the timers of the phases in all the contexts (disabled by
+ * default). The counters and the memory are always measured, unless the
+ * library was built with STATS=0.
+ */
+SCOMPRESSOR_API void scompressor_enable_stats(int enabled);
+
+/**
+ * Gets a statistic accumulated by a context since it was created or reset.
+ * @return 0 on success, -1 if the statistic is not valid.
+ */
+SCOMPRESSOR_API int scompressor_get_stat(scompressor_ctx * ctx, scompressor_stat stat, uint64_t * value);
+
+/** Sets the statistics of a context to zero. */
+SCOMPRESSOR_API void scompressor_reset_stats(scompressor_ctx * ctx);
+
+/**
+ * Writes the statistics of a context as the text of scompressor --stats.
+ * @return length of the whole text (without the final '\0'); at most cap-1
+ * characters are written.
+ */
+SCOMPRESSOR_API size_t scompressor_stats_report(scompressor_ctx * ctx, char * buf, size_t cap);
+
+/** Frees the working memory a context keeps between calls. */
+SCOMPRESSOR_API void scompressor_release_memory(scompressor_ctx * ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,413 @@
+/**
+ * @file libscompressor.cpp
+ * @brief Implementation of the C interface of libscompressor (see scompressor.h).
+ *
+ * Every function catches the exceptions of the compressors (i.e.
+ * std::bad_alloc), so none crosses the C interface.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+#include <scompressor.h>
+#include <MagicNumber.hpp>
+
+/* The enumerations of the interface follow the ones of the compressors. */
+static_assert((int)SCOMPRESSOR_AUTO == (int)FramedCompressor::AUTO, "methods");
+static_assert((int)SCOMPRESSOR_STAT_LZ77_TOKENS == (int)CompressorStats::NUM_PHASES, "stats");
+static_assert((int)SCOMPRESSOR_STAT_MEMORY_CURRENT ==
+	      (int)CompressorStats::NUM_PHASES + (int)CompressorStats::NUM_COUNTERS, "stats");
+
+/** Size of the buffers of the callback streams. They are allocated on the
+    heap, since the library may run on threads with small stacks. */
+static const size_t CALLBACK_BUFFER_SIZE = 1 << 16;
+
+/**
+ * @class CallbackInputBuffer
+ * @brief Stream buffer that reads through a scompressor_read_fn.
+ */
+class CallbackInputBuffer : public std::streambuf {
+private:
+  scompressor_read_fn fn;
+  void * opaque;
+  std::vector<char> buffer;
+
+protected:
+  int_type underflow()
+  {
+    char * p = &buffer[0];
+    size_t n = fn(opaque, p, buffer.size());
+    /* Errors are reported as the end of the input: the decompressors
+       detect the truncated data, and the callers check error. */
+    if ( n == SCOMPRESSOR_ERROR ) error = true;
+    if ( n == 0 || n > buffer.size() ) return traits_type::eof();
+    setg(p, p, p+n);
+    return traits_type::to_int_type(p[0]);
+  }
+
+public:
+  /** Whether the callback failed. */
+  bool error;
+
+  CallbackInputBuffer(scompressor_read_fn f, void * o)
+    : fn(f), opaque(o), buffer(CALLBACK_BUFFER_SIZE), error(false)
+  { setg(&buffer[0], &buffer[0], &buffer[0]); }
+};
+
+/**
+ * @class CallbackOutputBuffer
+ * @brief Stream buffer that writes through a scompressor_write_fn.
+ */
+class CallbackOutputBuffer : public std::streambuf {
+private:
+  scompressor_write_fn fn;
+  void * opaque;
+  std::vector<char> buffer;
+
+  bool flush()
+  {
+    size_t n = pptr()-pbase();
+    if ( n > 0 && fn(opaque, pbase(), n) != n ) return false;
+    setp(&buffer[0], &buffer[0]+buffer.size());
+    return true;
+  }
+
+protected:
+  int_type overflow(int_type c)
+  {
+    if ( !flush() ) return traits_type::eof();
+    if ( !traits_type::eq_int_type(c, traits_type::eof()) ) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync()
+  { return flush() ? 0 : -1; }
+
+public:
+  CallbackOutputBuffer(scompressor_write_fn f, void * o)
+    : fn(f), opaque(o), buffer(CALLBACK_BUFFER_SIZE)
+  { setp(&buffer[0], &buffer[0]+buffer.size()); }
+};
+
+struct scompressor_ctx {
+  /** Parameters. */
+  uint8_t method;
+  bool checksums;
+  size_t frame_size;
+  /** Stride of the delta filter and element size of the shuffle filter (0 if not used). */
+  uint8_t delta, shuffle;
+  /** Framed compressor, created on demand with the current parameters. */
+  FramedCompressor * framed;
+  /** Decompressors of the files written by a single compressor, created on demand. */
+  GenericCompressor * legacy[4];
+  /** Statistics merged by scompressor_get_stat() and scompressor_stats_report(). */
+  CompressorStats merged;
+
+  scompressor_ctx() : method(FramedCompressor::LZW), checksums(false),
+		      frame_size(FramedCompressor::DEFAULT_FRAME_SIZE), delta(0), shuffle(0),
+		      framed(0)
+  {
+    for(int i = 0; i < 4; ++i) legacy[i] = 0;
+  }
+
+  ~scompressor_ctx()
+  {
+    delete framed;
+    for(int i = 0; i < 4; ++i) delete legacy[i];
+  }
+
+  /** Returns the framed compressor. */
+  FramedCompressor * getFramed()
+  {
+    if ( framed == 0 ) {
+      framed = new FramedCompressor(method, checksums, frame_size);
+      framed->setFilters(getFilters());
+    }
+    return framed;
+  }
+
+  /** Returns the filters of the parameters. */
+  FilterChain getFilters() const
+  {
+    FilterChain f;
+    if ( delta != 0 ) f.add(Filter::DELTA, delta);
+    if ( shuffle != 0 ) f.add(Filter::SHUFFLE, shuffle);
+    return f;
+  }
+
+  /** Returns the decompressor of a magic number, or NULL if it is not known. */
+  GenericCompressor * getDecompressor(uint16_t magicnum)
+  {
+    if ( magicnum == FRAMED_MAGIC_NUMBER ) return getFramed();
+    for(int i = 0; i < 4; ++i) {
+      if ( magicnum != MAGIC_NUMBER[i] ) continue;
+      if ( legacy[i] == 0 ) legacy[i] = createDecompressor(magicnum);
+      return legacy[i];
+    }
+    return 0;
+  }
+
+  /** Forgets the framed compressor, so that it is created with new parameters.
+      Its statistics are kept. */
+  void invalidate()
+  {
+    if ( framed == 0 ) return;
+    /* Its memory is freed, but the peak and the allocations are kept. */
+    CompressorStats s = framed->getStats();
+    s.setMemory(0, s.getMemoryPeak(), s.getAllocations());
+    merged.merge(s);
+    delete framed;
+    framed = 0;
+  }
+
+  /** Returns the statistics of all the compressors. */
+  CompressorStats getStats()
+  {
+    CompressorStats s = merged;
+    if ( framed != 0 ) s.merge(framed->getStats());
+    for(int i = 0; i < 4; ++i)
+      if ( legacy[i] != 0 ) s.merge(legacy[i]->getStats());
+    return s;
+  }
+};
+
+static size_t readFd(void * opaque, void * buf, size_t n)
+{
+  ssize_t r;
+  do r = read(*(int *)opaque, buf, n); while ( r < 0 && errno == EINTR );
+  return (r < 0 ? SCOMPRESSOR_ERROR : (size_t)r);
+}
+
+static size_t writeFd(void * opaque, const void * buf, size_t n)
+{
+  size_t done = 0;
+  while ( done < n ) {
+    ssize_t w = write(*(int *)opaque, (const char *)buf+done, n-done);
+    if ( w < 0 && errno == EINTR ) continue;
+    if ( w <= 0 ) break;
+    done += w;
+  }
+  return done;
+}
+
+unsigned scompressor_version(void)
+{
+  return SCOMPRESSOR_VERSION_NUMBER;
+}
+
+int scompressor_is_error(size_t code)
+{
+  return code == SCOMPRESSOR_ERROR;
+}
+
+scompressor_ctx * scompressor_create(void)
+{
+  try {
+    return new scompressor_ctx();
+  } catch ( ... ) {
+    return 0;
+  }
+}
+
+void scompressor_free(scompressor_ctx * ctx)
+{
+  delete ctx;
+}
+
+int scompressor_set_param(scompressor_ctx * ctx, scompressor_param param, long value)
+{
+  switch ( param ) {
+  case SCOMPRESSOR_PARAM_METHOD:
+    if ( value < SCOMPRESSOR_HUFFMAN || value > SCOMPRESSOR_AUTO ) return -1;
+    ctx->method = (uint8_t)value;
+    break;
+  case SCOMPRESSOR_PARAM_CHECKSUMS:
+    ctx->checksums = (value != 0);
+    break;
+  case SCOMPRESSOR_PARAM_FRAME_SIZE:
+    if ( value <= 0 || (unsigned long)value > FramedCompressor::MAX_FRAME_SIZE ) return -1;
+    ctx->frame_size = (size_t)value;
+    break;
+  case SCOMPRESSOR_PARAM_DELTA:
+    if ( value < 0 || value > 255 ) return -1;
+    ctx->delta = (uint8_t)value;
+    break;
+  case SCOMPRESSOR_PARAM_SHUFFLE:
+    if ( value < 0 || value == 1 || value > 255 ) return -1;
+    ctx->shuffle = (uint8_t)value;
+    break;
+  default:
+    return -1;
+  }
+  ctx->invalidate();
+  return 0;
+}
+
+long scompressor_get_param(const scompressor_ctx * ctx, scompressor_param param)
+{
+  switch ( param ) {
+  case SCOMPRESSOR_PARAM_METHOD: return ctx->method;
+  case SCOMPRESSOR_PARAM_CHECKSUMS: return ctx->checksums;
+  case SCOMPRESSOR_PARAM_FRAME_SIZE: return (long)ctx->frame_size;
+  case SCOMPRESSOR_PARAM_DELTA: return ctx->delta;
+  case SCOMPRESSOR_PARAM_SHUFFLE: return ctx->shuffle;
+  default: return -1;
+  }
+}
+
+size_t scompressor_compress_bound(const scompressor_ctx * ctx, size_t n)
+{
+  FramedCompressor framed(ctx->method, ctx->checksums, ctx->frame_size);
+  return MAGIC_NUMBER_SIZE + framed.getCompressBound(n);
+}
+
+size_t scompressor_compress(scompressor_ctx * ctx, void * dst, size_t cap,
+			    const void * src, size_t n)
+{
+  if ( cap < MAGIC_NUMBER_SIZE ) return SCOMPRESSOR_ERROR;
+  try {
+    writeMagicNumber((char *)dst, FRAMED_MAGIC_NUMBER);
+    size_t c = ctx->getFramed()->compress(src, n, (char *)dst+MAGIC_NUMBER_SIZE,
+					  cap-MAGIC_NUMBER_SIZE);
+    return (c == GenericCompressor::BUFFER_ERROR ? SCOMPRESSOR_ERROR : MAGIC_NUMBER_SIZE+c);
+  } catch ( ... ) {
+    return SCOMPRESSOR_ERROR;
+  }
+}
+
+size_t scompressor_decompress(scompressor_ctx * ctx, void * dst, size_t cap,
+			      const void * src, size_t n)
+{
+  if ( n < MAGIC_NUMBER_SIZE ) return SCOMPRESSOR_ERROR;
+  try {
+    GenericCompressor * compr = ctx->getDecompressor(readMagicNumber((const char *)src));
+    if ( compr == 0 ) return SCOMPRESSOR_ERROR;
+    size_t d = compr->decompress((const char *)src+MAGIC_NUMBER_SIZE, n-MAGIC_NUMBER_SIZE,
+				 dst, cap);
+    return (d == GenericCompressor::BUFFER_ERROR ? SCOMPRESSOR_ERROR : d);
+  } catch ( ... ) {
+    return SCOMPRESSOR_ERROR;
+  }
+}
+
+int scompressor_get_decompressed_size(const void * src, size_t n, uint64_t * size)
+{
+  if ( n < MAGIC_NUMBER_SIZE ||
+       readMagicNumber((const char *)src) != FRAMED_MAGIC_NUMBER ) return -1;
+  FramedCompressor framed;
+  size_t s;
+  if ( !framed.getDecompressedSize((const char *)src+MAGIC_NUMBER_SIZE,
+				   n-MAGIC_NUMBER_SIZE, s) ) return -1;
+  *size = s;
+  return 0;
+}
+
+int scompressor_compress_stream(scompressor_ctx * ctx,
+				scompressor_read_fn read, void * in,
+				scompressor_write_fn write, void * out)
+{
+  try {
+    CallbackInputBuffer ibuf(read, in);
+    CallbackOutputBuffer obuf(write, out);
+    std::istream input(&ibuf);
+    std::ostream output(&obuf);
+    writeMagicNumber(&output, FRAMED_MAGIC_NUMBER);
+    bool ok = ctx->getFramed()->compress(input, output);
+    output.flush();
+    return (ok && output.good() && !ibuf.error ? 0 : -1);
+  } catch ( ... ) {
+    return -1;
+  }
+}
+
+int scompressor_decompress_stream(scompressor_ctx * ctx,
+				  scompressor_read_fn read, void * in,
+				  scompressor_write_fn write, void * out)
+{
+  try {
+    CallbackInputBuffer ibuf(read, in);
+    CallbackOutputBuffer obuf(write, out);
+    std::istream input(&ibuf);
+    std::ostream output(&obuf);
+    uint16_t magicnum = readMagicNumber(&input);
+    if ( !input.good() ) return -1;
+    GenericCompressor * compr = ctx->getDecompressor(magicnum);
+    if ( compr == 0 ) return -1;
+    bool ok = compr->decompress(input, output);
+    output.flush();
+    return (ok && output.good() && !ibuf.error ? 0 : -1);
+  } catch ( ... ) {
+    return -1;
+  }
+}
+
+int scompressor_compress_fd(scompressor_ctx * ctx, int in, int out)
+{
+  return scompressor_compress_stream(ctx, readFd, &in, writeFd, &out);
+}
+
+int scompressor_decompress_fd(scompressor_ctx * ctx, int in, int out)
+{
+  return scompressor_decompress_stream(ctx, readFd, &in, writeFd, &out);
+}
+
+void scompressor_enable_stats(int enabled)
+{
+  CompressorStats::enabled() = (enabled != 0);
+}
+
+int scompressor_get_stat(scompressor_ctx * ctx, scompressor_stat stat, uint64_t * value)
+{
+  const int phases = CompressorStats::NUM_PHASES;
+  const int counters = CompressorStats::NUM_COUNTERS;
+  CompressorStats s = ctx->getStats();
+  if ( stat >= 0 && stat < phases )
+    *value = s.getWallTime((CompressorStats::Phase)stat);
+  else if ( stat >= phases && stat < phases+counters )
+    *value = s.get((CompressorStats::Counter)(stat-phases));
+  else if ( stat == SCOMPRESSOR_STAT_MEMORY_CURRENT )
+    *value = s.getMemoryCurrent();
+  else if ( stat == SCOMPRESSOR_STAT_MEMORY_PEAK )
+    *value = s.getMemoryPeak();
+  else if ( stat == SCOMPRESSOR_STAT_ALLOCATIONS )
+    *value = s.getAllocations();
+  else
+    return -1;
+  return 0;
+}
+
+void scompressor_reset_stats(scompressor_ctx * ctx)
+{
+  ctx->merged.reset();
+  if ( ctx->framed != 0 ) ctx->framed->resetStats();
+  for(int i = 0; i < 4; ++i)
+    if ( ctx->legacy[i] != 0 ) ctx->legacy[i]->resetStats();
+}
+
+size_t scompressor_stats_report(scompressor_ctx * ctx, char * buf, size_t cap)
+{
+  std::ostringstream os;
+  ctx->getStats().report(os);
+  std::string s = os.str();
+  if ( cap > 0 ) {
+    size_t n = std::min(s.size(), cap-1);
+    memcpy(buf, s.data(), n);
+    buf[n] = '\0';
+  }
+  return s.size();
+}
+
+void scompressor_release_memory(scompressor_ctx * ctx)
+{
+  if ( ctx->framed != 0 ) ctx->framed->releaseMemory();
+  for(int i = 0; i < 4; ++i)
+    if ( ctx->legacy[i] != 0 ) ctx->legacy[i]->releaseMemory();
+}
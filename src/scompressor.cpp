@@ -1,38 +1,71 @@
 #include <iostream>
 #include <fstream>
-#include <netinet/in.h>
+#include <cstring>
+#include <cstdio>
+#include <sys/stat.h>
 
 #include <HuffmanCompressor.hpp>
 #include <LZ77Compressor.hpp>
 #include <LZ78Compressor.hpp>
 #include <LZWCompressor.hpp>
+#include <FramedCompressor.hpp>
+#include <MagicNumber.hpp>
 #include <OptionsParser.hpp>
+#include <MappedFile.hpp>
+#include <PipelinedStream.hpp>
+#include <AsyncFile.hpp>
+#include <Benchmark.hpp>
+#include <Trace.hpp>
+#include <CpuDispatch.hpp>
 
 using namespace std;
 
-static const uint16_t MAGIC_NUMBER[4] = {
-  0x27AB, // Huffman
-  0xA5E8, // LZ77
-  0x7869, // LZ78
-  0x8E83  // LZW
-};
-
-uint16_t readMagicNumber(istream * input)
+bool isRegularFile(const string& filename)
 {
-  uint16_t magicnum;
-  input->read((char *)(&magicnum), 2);
-  return ntohs(magicnum);
+  struct stat st;
+  return (stat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode));
 }
 
-void writeMagicNumber(ostream * output, uint16_t mn)
+int benchmark(const OptionsParser& options)
 {
-  mn = htons(mn);
-  output->write((char*)(&mn), 2);
-}
+  static const char * ALGORITHM_NAMES[] = { "huf", "lz77", "lz78", "lzw", "auto" };
 
-bool checkMagicNumber(istream * input, uint16_t ref)
-{
-  return (readMagicNumber(input) == ref);
+  /* The whole input is loaded before measuring anything. */
+  ifstream fin;
+  istream * input = &cin;
+  if ( options.getInputFile() != "-" ) {
+    fin.open(options.getInputFile(), ios::binary);
+    input = &fin;
+    if ( !fin.is_open() ) {
+      cerr << "File " << options.getInputFile() 
+	   << " could not been opened!" << endl;
+      return 1;
+    }
+  }
+  vector<char> data((istreambuf_iterator<char>(*input)), istreambuf_iterator<char>());
+  if ( input->bad() ) {
+    cerr << "Error reading " << options.getInputFile() << endl;
+    return 1;
+  }
+
+  if ( options.getPipeline().size() > 1 ) {
+    cerr << "The benchmarks run a single algorithm, not a pipeline." << endl;
+    return 1;
+  }
+  const char * algorithm = 0;
+  if ( options.getCompressionMethod() != OptionsParser::None )
+    algorithm = ALGORITHM_NAMES[options.getCompressionMethod()];
+
+  cout << options.getInputFile() << ": " << data.size() << " bytes, best of "
+       << options.getIterations() << " runs, " << CpuDispatch::name(CpuDispatch::level())
+       << " kernels" << endl;
+  Benchmark bench(data.empty() ? 0 : &data[0], data.size(), options.getIterations());
+  if ( options.usePerfCounters() ) bench.enablePerfCounters(cerr);
+  if ( !bench.runAll(algorithm, cout) ) {
+    cerr << "Benchmark error!" << endl;
+    return 1;
+  }
+  return 0;
 }
 
 int main(int argc, char ** argv)
@@ -43,12 +76,36 @@ int main(int argc, char ** argv)
   } else if ( options.showHelp() ) {
     options.help();
     return 0;
+  } else if ( options.getWorkMode() == OptionsParser::Benchmark ) {
+    return benchmark(options);
   }
+  CompressorStats::enabled() = options.useStats();
+  Trace::enabled() = !options.getTraceFile().empty();
+  Trace::setThreadName("main");
+#ifndef SCOMPRESSOR_STATS
+  if ( options.useStats() )
+    cerr << "The statistics were not compiled in (build with STATS=1)." << endl;
+#endif
+
+  istream * input = 0; ifstream fin; MappedFile fmap;
+  ostream * output = 0; ofstream fout; MappedOutputFile fomap;
+  AsyncFileReader ain; AsyncFileWriter aout;
+
+  /* File-to-file I/O through io_uring, keeping several blocks in flight. */
+  bool asyncio = ( options.useAsyncIO() && options.getOutputFile() != "-" &&
+		   options.getInputFile() != "-" && isRegularFile(options.getInputFile()) );
 
-  istream * input; ifstream fin;
-  ostream * output; ofstream fout;
   if ( options.getInputFile() == "-" ) input = &cin;
-  else {
+  else if ( asyncio ) {
+    input = &ain;
+    if ( !ain.open(options.getInputFile()) ) {
+      cerr << "File " << options.getInputFile() 
+	   << " could not been opened!" << endl;
+      return 1;
+    }
+  }
+  else if ( !fmap.open(options.getInputFile()) ) {
+    /* Not a regular file (i.e. a named pipe): read it as a stream. */
     fin.open(options.getInputFile());
     input = &fin;
     if ( !fin.is_open() ) {
@@ -58,7 +115,55 @@ int main(int argc, char ** argv)
     }
   }
   
-  if ( options.getOutputFile() == "-" ) output = &cout;
+  /* Streams are read ahead by a separate thread, so that the I/O latency
+     is hidden behind the compression. */
+  PipelinedReader * pinput = 0;
+  if ( !fmap.is_open() && !asyncio ) input = pinput = new PipelinedReader(*input);
+
+  GenericCompressor * compr = 0;
+  uint16_t magicnum;
+  if ( options.getWorkMode() == OptionsParser::Compression ) {
+    FramedCompressor * framed = new FramedCompressor(options.getCompressionMethod(),
+						     options.useChecksums());
+    framed->setFilters(options.getFilters());
+    vector<uint8_t> stages(options.getPipeline().begin(), options.getPipeline().end());
+    if ( !framed->setPipeline(&stages[0], stages.size(), options.useStageThreads()) ) {
+      cerr << "A pipeline has at most " << FramedCompressor::MAX_STAGES << " algorithms." << endl;
+      return 1;
+    }
+    compr = framed;
+  } else {
+    if ( fmap.is_open() ) {
+      if ( fmap.size() < 2 ) {
+	cerr << "Bad magic number!" << endl;
+	return 1;
+      }
+      magicnum = readMagicNumber(fmap.data());
+    } else magicnum = readMagicNumber(input);
+    compr = createDecompressor(magicnum);
+    if ( compr == 0 ) {
+      cerr << "Bad magic number!" << endl;
+      return 1;
+    }
+  }
+
+  /* When decompressing a mapped file to a regular file and the size of the decompressed
+     data is known, the output is pre-sized and the data is decompressed in place. */
+  size_t dsize = 0;
+  if ( options.getWorkMode() == OptionsParser::Decompression && fmap.is_open() &&
+       options.getOutputFile() != "-" &&
+       compr->getDecompressedSize(fmap.data()+2, fmap.size()-2, dsize) )
+    fomap.open(options.getOutputFile(), dsize);
+
+  if ( fomap.is_open() ) output = 0;
+  else if ( asyncio ) {
+    output = &aout;
+    if ( !aout.open(options.getOutputFile()) ) {
+      cerr << "File " << options.getOutputFile() 
+	   << " could not been opened!" << endl;
+      return 1;
+    }
+  } else if ( options.getOutputFile() == "-" ) output = &cout;
   else {
     fout.open(options.getOutputFile());
     output = &fout;
@@ -68,48 +173,59 @@ int main(int argc, char ** argv)
       return 1;
     }
   }
-  
-  GenericCompressor * compr = 0;
-  uint16_t magicnum;
-  switch ( options.getCompressionMethod() ) {
-  case OptionsParser::Huffman:
-    compr = new HuffmanCompressor();
-    break;
-  case OptionsParser::LZ77:
-    compr = new LZ77Compressor();
-    break;
-  case OptionsParser::LZ78:
-    compr = new LZ78Compressor();
-    break;
-  case OptionsParser::LZW:
-    compr = new LZWCompressor();
-    break;
-  default:
-    // decompressing
-    magicnum = readMagicNumber(input);
-    if ( magicnum == MAGIC_NUMBER[0] )
-      compr = new HuffmanCompressor();
-    else if ( magicnum == MAGIC_NUMBER[1] )
-      compr = new LZ77Compressor();
-    else if ( magicnum == MAGIC_NUMBER[2] )
-      compr = new LZ78Compressor();
-    else if ( magicnum == MAGIC_NUMBER[3] )
-      compr = new LZWCompressor();
-    else {
-      cerr << "Bad magic number!" << endl;
-      return 1;
-    }
-  }
 
+  /* The output is written by a separate thread too. */
+  PipelinedWriter * poutput = 0;
+  if ( output != 0 && !asyncio ) output = poutput = new PipelinedWriter(*output);
+
+  bool ok;
   if ( options.getWorkMode() == OptionsParser::Compression ) {
-    writeMagicNumber(output, MAGIC_NUMBER[options.getCompressionMethod()]);
-    compr->compress(*input, *output);
-  } else
-    compr->decompress(*input, *output);
+    writeMagicNumber(output, FRAMED_MAGIC_NUMBER);
+    if ( fmap.is_open() ) ok = compr->compress(fmap.data(), fmap.size(), *output);
+    else ok = compr->compress(*input, *output);
+  } else {
+    if ( fomap.is_open() )
+      ok = (compr->decompress(fmap.data()+2, fmap.size()-2, fomap.data(), fomap.size())
+	    == fomap.size());
+    else if ( fmap.is_open() ) ok = compr->decompress(fmap.data()+2, fmap.size()-2, *output);
+    else ok = compr->decompress(*input, *output);
+  }
+
+  if ( !ok )
+    cerr << (options.getWorkMode() == OptionsParser::Compression ?
+	     "Compressing error!" : "Decompressing error!") << endl;
+#ifdef SCOMPRESSOR_STATS
+  if ( options.useStats() ) compr->getStats().report(cerr);
+#endif
+
+  if ( poutput != 0 && !poutput->close() ) {
+    cerr << "Error writing " << options.getOutputFile() << endl;
+    ok = false;
+  }
+  if ( asyncio && !aout.close() ) {
+    cerr << "Error writing " << options.getOutputFile() << endl;
+    ok = false;
+  }
+  delete poutput;
+  delete pinput;
 
   if ( fin.is_open() ) fin.close();
   if ( fout.is_open() ) fout.close();
+  fomap.close();
   delete compr;
+
+  /* A failed decompression does not leave a partial (or pre-sized) file behind. */
+  if ( !ok && options.getWorkMode() == OptionsParser::Decompression &&
+       options.getOutputFile() != "-" )
+    remove(options.getOutputFile().c_str());
+
+  if ( Trace::enabled() ) {
+    ofstream trace(options.getTraceFile().c_str());
+    if ( !Trace::instance().write(trace) ) {
+      cerr << "Error writing " << options.getTraceFile() << endl;
+      ok = false;
+    }
+  }
     
-  return 0;
+  return (ok ? 0 : 1);
 }